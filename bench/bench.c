@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+void benchBufferInit(BenchBuffer *buf)
+{
+    buf->alloc  = 4096;
+    buf->size   = 0;
+    buf->memory = malloc(buf->alloc);
+    buf->memory[0] = 0;
+}
+
+void benchBufferFree(BenchBuffer *buf)
+{
+    free(buf->memory);
+    buf->memory = NULL;
+    buf->size = buf->alloc = 0;
+}
+
+void benchBufferPrintf(BenchBuffer *buf, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    for (;;) {
+        va_start(args, fmt);
+        len = vsnprintf(buf->memory + buf->size, buf->alloc - buf->size, fmt, args);
+        va_end(args);
+
+        if (len >= 0 && buf->size + len < buf->alloc)
+            break;
+
+        buf->alloc *= 2;
+        buf->memory = realloc(buf->memory, buf->alloc);
+    }
+
+    buf->size += len;
+}
+
+double benchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long benchRss()
+{
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm == NULL)
+        return 0;
+
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+
+    fclose(statm);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+int benchTokenize(const char *js, size_t len, bool indexed, size_t chunk, jsmntok_t **tokens, int *alloc)
+{
+    char *text = malloc(len + 1);
+    jsmn_parser jsmnParser;
+    size_t avail = 0;
+    int result;
+
+    jsmn_init(&jsmnParser);
+    do {
+        avail += chunk ? 1 + (size_t)rand() % chunk : len;
+        if (avail > len)
+            avail = len;
+        memcpy(text, js, avail);
+        text[avail] = '\0';
+
+        while ((result = indexed ? jsmn_parse_indexed(&jsmnParser, text, avail, *tokens, *alloc)
+                                 : jsmn_parse(&jsmnParser, text, *tokens, *alloc)) == JSMN_ERROR_NOMEM) {
+            *alloc *= 2;
+            *tokens = realloc(*tokens, *alloc * sizeof(jsmntok_t));
+        }
+    } while ((result >= 0 || result == JSMN_ERROR_PART) && avail < len);
+
+    free(text);
+    return result;
+}
+
+/*
+ * A tiny LCG, so the generated thread doesn't depend on the libc's rand()
+ */
+static unsigned int benchRandom(unsigned int *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (*seed >> 16) & 0x7FFF;
+}
+
+static const char *benchWords[] = {
+    "the", "reddit", "comment", "thread", "parser", "quite", "a", "lot",
+    "of", "text", "is", "here", "and", "that's", "fine", "I", "think",
+    "you're", "wrong", "about", "this", "actually", "source?", "edit:",
+    "thanks", "for", "the", "gold", "kind", "stranger", "&amp;", "&gt;",
+    "caf\\u00e9", "na\\u00efve", "\\\"quoted\\\"", "line\\nbreak",
+    "\\ud83d\\ude02", "\xc3\xbc" "ber", "tab\\there", "and\\/or"
+};
+
+#define BENCH_WORD_COUNT (sizeof(benchWords) / sizeof(benchWords[0]))
+
+static void benchGenerateBody(BenchBuffer *buf, unsigned int *seed)
+{
+    int words = 5 + benchRandom(seed) % 60;
+    int i;
+
+    for (i = 0; i < words; i++)
+        benchBufferPrintf(buf, "%s%s", (i == 0) ? "" : " ", benchWords[benchRandom(seed) % BENCH_WORD_COUNT]);
+}
+
+static void benchGenerateMore(BenchBuffer *buf, const char *parent, unsigned int *seed)
+{
+    int count = 1 + benchRandom(seed) % 8;
+    int i;
+
+    benchBufferPrintf(buf, "{\"kind\": \"more\", \"data\": {\"count\": %d, \"parent_id\": \"t1_%s\", "
+                           "\"id\": \"m%s\", \"name\": \"t1_m%s\", \"children\": [", count * 3, parent, parent, parent);
+    for (i = 0; i < count; i++)
+        benchBufferPrintf(buf, "%s\"%sc%d\"", (i == 0) ? "" : ", ", parent, i);
+    benchBufferPrintf(buf, "]}}");
+}
+
+static void benchGenerateComment(BenchBuffer *buf, const char *id, const char *parent, int depth, unsigned int *seed)
+{
+    int ups = benchRandom(seed) % 5000;
+    int replies = (depth > 0) ? 1 + benchRandom(seed) % 3 : 0;
+    long created = 1380000000L + benchRandom(seed) * 97L;
+    char childId[64];
+    int i;
+
+    benchBufferPrintf(buf,
+        "{\"kind\": \"t1\", \"data\": {\"subreddit_id\": \"t5_2qh1i\", \"banned_by\": null, "
+        "\"link_id\": \"t3_bench\", \"likes\": null, ");
+
+    benchBufferPrintf(buf, "\"replies\": ");
+    if (replies == 0) {
+        benchBufferPrintf(buf, "\"\", ");
+    } else {
+        benchBufferPrintf(buf, "{\"kind\": \"Listing\", \"data\": {\"modhash\": \"\", \"children\": [");
+        for (i = 0; i < replies; i++) {
+            snprintf(childId, sizeof(childId), "%s%c", id, 'a' + i);
+            if (i > 0)
+                benchBufferPrintf(buf, ", ");
+            benchGenerateComment(buf, childId, id, depth - 1, seed);
+        }
+        if (benchRandom(seed) % 4 == 0) {
+            benchBufferPrintf(buf, ", ");
+            benchGenerateMore(buf, id, seed);
+        }
+        benchBufferPrintf(buf, "], \"after\": null, \"before\": null}}, ");
+    }
+
+    benchBufferPrintf(buf,
+        "\"user_reports\": [], \"saved\": false, \"id\": \"%s\", \"gilded\": %d, "
+        "\"archived\": false, \"report_reasons\": null, \"author\": \"user%u\", "
+        "\"parent_id\": \"%s%s\", \"score\": %d, \"approved_by\": null, "
+        "\"controversiality\": 0, \"body\": \"",
+        id, ups % 97 == 0, benchRandom(seed) % 1000, parent[0] ? "t1_" : "t3_", parent[0] ? parent : "bench", ups);
+    benchGenerateBody(buf, seed);
+    benchBufferPrintf(buf,
+        "\", \"edited\": %s, \"author_flair_css_class\": null, \"downs\": 0, "
+        "\"body_html\": \"&lt;div class=\\\"md\\\"&gt;&lt;p&gt;",
+        (ups % 11 == 0) ? "1380001234.0" : "false");
+    benchGenerateBody(buf, seed);
+    benchBufferPrintf(buf,
+        "&lt;/p&gt;\\n&lt;/div&gt;\", \"subreddit\": \"bench\", \"score_hidden\": %s, "
+        "\"name\": \"t1_%s\", \"created\": %ld.0, \"author_flair_text\": null, "
+        "\"created_utc\": %ld.0, \"distinguished\": %s, \"mod_reports\": [], "
+        "\"num_reports\": null, \"ups\": %d}}",
+        (ups % 13 == 0) ? "true" : "false", id, created + 28800, created,
+        (ups % 17 == 0) ? "\"moderator\"" : "null", ups);
+}
+
+void benchGenerateThread(BenchBuffer *buf, int topLevel, int depth)
+{
+    unsigned int seed = 1;
+    char id[64];
+    int i;
+
+    benchBufferPrintf(buf,
+        "[{\"kind\": \"Listing\", \"data\": {\"modhash\": \"\", \"children\": [{\"kind\": \"t3\", \"data\": {"
+        "\"domain\": \"self.bench\", \"subreddit\": \"bench\", \"selftext\": \"A large thread for benchmarks &amp; such\", "
+        "\"id\": \"bench\", \"author\": \"op\", \"score\": 9001, \"over_18\": false, \"is_self\": true, "
+        "\"permalink\": \"/r/bench/comments/bench/a_large_thread/\", \"name\": \"t3_bench\", "
+        "\"created_utc\": 1380000000.0, \"url\": \"http://www.reddit.com/r/bench/comments/bench/a_large_thread/\", "
+        "\"title\": \"A large thread\", \"num_comments\": %d, \"ups\": 9001, \"downs\": 0, \"num_reports\": null, "
+        "\"stickied\": false, \"clicked\": false, \"hidden\": false, \"edited\": false, \"distinguished\": null}}], "
+        "\"after\": null, \"before\": null}}, "
+        "{\"kind\": \"Listing\", \"data\": {\"modhash\": \"\", \"children\": [", topLevel);
+
+    for (i = 0; i < topLevel; i++) {
+        snprintf(id, sizeof(id), "c%d", i);
+        if (i > 0)
+            benchBufferPrintf(buf, ", ");
+        benchGenerateComment(buf, id, "", depth, &seed);
+    }
+
+    benchBufferPrintf(buf, "], \"after\": null, \"before\": null}}]");
+}
+
+static void benchGenerateImage(BenchBuffer *buf, const char *key, int id, int width)
+{
+    benchBufferPrintf(buf, "{\"url\": \"https://preview.redd.it/%s%d.jpg?width=%d&amp;crop=smart&amp;auto=webp&amp;s=0f3a9c\", "
+                           "\"width\": %d, \"height\": %d}", key, id, width, width, width * 3 / 4);
+}
+
+static void benchGenerateAward(BenchBuffer *buf, int id)
+{
+    static const int sizes[] = { 16, 32, 48, 64, 128 };
+    int i;
+
+    benchBufferPrintf(buf,
+        "{\"giver_coin_reward\": null, \"subreddit_id\": null, \"is_new\": false, \"days_of_drip_extension\": null, "
+        "\"coin_price\": %d, \"id\": \"award_%d\", \"penny_donate\": null, \"coin_reward\": 0, "
+        "\"icon_url\": \"https://www.redditstatic.com/gold/awards/icon/%d_512.png\", \"days_of_premium\": null, "
+        "\"icon_height\": 512, \"tiers_by_required_awardings\": null, \"resized_icons\": [",
+        100 * (id + 1), id, id);
+    for (i = 0; i < 5; i++) {
+        if (i > 0)
+            benchBufferPrintf(buf, ", ");
+        benchGenerateImage(buf, "award", id, sizes[i]);
+    }
+    benchBufferPrintf(buf,
+        "], \"icon_width\": 512, \"static_icon_width\": 512, \"start_date\": null, \"is_enabled\": true, "
+        "\"awardings_required_to_grant_benefits\": null, \"description\": \"Shows the Award and grants %d Coins.\", "
+        "\"end_date\": null, \"subreddit_coin_reward\": 0, \"count\": %d, \"static_icon_height\": 512, "
+        "\"name\": \"Award %d\", \"resized_static_icons\": [", id * 10, 1 + id % 3, id);
+    for (i = 0; i < 5; i++) {
+        if (i > 0)
+            benchBufferPrintf(buf, ", ");
+        benchGenerateImage(buf, "static", id, sizes[i]);
+    }
+    benchBufferPrintf(buf,
+        "], \"icon_format\": null, \"award_sub_type\": \"GLOBAL\", \"penny_price\": null, "
+        "\"award_type\": \"global\", \"static_icon_url\": \"https://i.redd.it/award_images/%d.png\"}", id);
+}
+
+static void benchGenerateLink(BenchBuffer *buf, int id, unsigned int *seed)
+{
+    static const int widths[] = { 108, 216, 320, 640, 960, 1080 };
+    int ups = benchRandom(seed) % 90000;
+    int video = benchRandom(seed) % 3 == 0;
+    int awards = benchRandom(seed) % 4;
+    long created = 1380000000L + benchRandom(seed) * 13L;
+    int i;
+
+    benchBufferPrintf(buf,
+        "{\"kind\": \"t3\", \"data\": {\"approved_at_utc\": null, \"subreddit\": \"sub%u\", \"selftext\": \"\", "
+        "\"author_fullname\": \"t2_a%d\", \"saved\": false, \"mod_reason_title\": null, \"gilded\": %d, "
+        "\"clicked\": false, \"title\": \"Link number %d, with &amp; and \\u00e9 in it\", \"link_flair_richtext\": "
+        "[{\"e\": \"text\", \"t\": \"Flair\"}], \"subreddit_name_prefixed\": \"r/sub%u\", \"hidden\": false, "
+        "\"pwls\": 6, \"link_flair_css_class\": \"flair\", \"downs\": 0, \"thumbnail_height\": 105, "
+        "\"top_awarded_type\": null, \"hide_score\": false, \"name\": \"t3_l%d\", \"quarantine\": false, "
+        "\"link_flair_text_color\": \"dark\", \"upvote_ratio\": 0.9%d, \"author_flair_background_color\": null, "
+        "\"subreddit_type\": \"public\", \"ups\": %d, \"total_awards_received\": %d, ",
+        benchRandom(seed) % 50, id, awards > 2, id, benchRandom(seed) % 50, id, benchRandom(seed) % 10, ups, awards);
+
+    benchBufferPrintf(buf, "\"media_embed\": ");
+    if (video)
+        benchBufferPrintf(buf, "{\"content\": \"&lt;iframe width=\\\"356\\\" height=\\\"200\\\" "
+                               "src=\\\"https://www.youtube.com/embed/v%d\\\"&gt;&lt;/iframe&gt;\", "
+                               "\"width\": 356, \"scrolling\": false, \"height\": 200}, ", id);
+    else
+        benchBufferPrintf(buf, "{}, ");
+
+    benchBufferPrintf(buf,
+        "\"thumbnail_width\": 140, \"author_flair_template_id\": null, \"is_original_content\": false, "
+        "\"user_reports\": [], \"secure_media\": ");
+    if (video)
+        benchBufferPrintf(buf,
+            "{\"type\": \"youtube.com\", \"oembed\": {\"provider_url\": \"https://www.youtube.com/\", "
+            "\"version\": \"1.0\", \"title\": \"Video title %d\", \"type\": \"video\", "
+            "\"thumbnail_width\": 480, \"height\": 200, \"width\": 356, \"html\": \"&lt;iframe&gt;\", "
+            "\"author_name\": \"channel%d\", \"provider_name\": \"YouTube\", "
+            "\"thumbnail_url\": \"https://i.ytimg.com/vi/v%d/hqdefault.jpg\", \"thumbnail_height\": 360, "
+            "\"author_url\": \"https://www.youtube.com/c/channel%d\"}}, ", id, id, id, id);
+    else
+        benchBufferPrintf(buf, "null, ");
+
+    benchBufferPrintf(buf,
+        "\"is_reddit_media_domain\": %s, \"is_meta\": false, \"category\": null, \"secure_media_embed\": {}, "
+        "\"link_flair_text\": \"Flair\", \"can_mod_post\": false, \"score\": %d, \"approved_by\": null, "
+        "\"is_created_from_ads_ui\": false, \"author_premium\": false, "
+        "\"thumbnail\": \"https://b.thumbs.redditmedia.com/t%d.jpg\", \"edited\": false, "
+        "\"author_flair_css_class\": null, \"author_flair_richtext\": [], \"gildings\": {\"gid_1\": %d}, "
+        "\"post_hint\": \"%s\", \"content_categories\": null, \"is_self\": false, \"mod_note\": null, "
+        "\"created\": %ld.0, \"link_flair_type\": \"richtext\", \"wls\": 6, \"removed_by_category\": null, "
+        "\"banned_by\": null, \"author_flair_type\": \"text\", \"domain\": \"%s\", "
+        "\"allow_live_comments\": true, \"selftext_html\": null, \"likes\": null, \"suggested_sort\": null, "
+        "\"banned_at_utc\": null, \"url_overridden_by_dest\": \"https://i.redd.it/i%d.jpg\", "
+        "\"view_count\": null, \"archived\": false, \"no_follow\": false, \"is_crosspostable\": true, "
+        "\"pinned\": false, \"over_18\": %s, ",
+        video ? "false" : "true", ups, id, awards, video ? "rich:video" : "image", created + 28800,
+        video ? "youtube.com" : "i.redd.it", id, (ups % 19 == 0) ? "true" : "false");
+
+    benchBufferPrintf(buf, "\"preview\": {\"images\": [{\"source\": ");
+    benchGenerateImage(buf, "source", id, 1920);
+    benchBufferPrintf(buf, ", \"resolutions\": [");
+    for (i = 0; i < 6; i++) {
+        if (i > 0)
+            benchBufferPrintf(buf, ", ");
+        benchGenerateImage(buf, "res", id, widths[i]);
+    }
+    benchBufferPrintf(buf, "], \"variants\": {}, \"id\": \"img%d\"}], \"enabled\": true}, \"all_awardings\": [", id);
+    for (i = 0; i < awards; i++) {
+        if (i > 0)
+            benchBufferPrintf(buf, ", ");
+        benchGenerateAward(buf, i);
+    }
+
+    benchBufferPrintf(buf,
+        "], \"awarders\": [], \"media_only\": false, \"link_flair_template_id\": \"f%d\", \"can_gild\": true, "
+        "\"spoiler\": false, \"locked\": false, \"author_flair_text\": null, \"treatment_tags\": [], "
+        "\"visited\": false, \"removed_by\": null, \"num_reports\": null, \"distinguished\": null, "
+        "\"subreddit_id\": \"t5_%d\", \"author_is_blocked\": false, \"mod_reason_by\": null, "
+        "\"removal_reason\": null, \"link_flair_background_color\": \"\", \"id\": \"l%d\", "
+        "\"is_robot_indexable\": true, \"report_reasons\": null, \"author\": \"poster%d\", "
+        "\"discussion_type\": null, \"num_comments\": %d, \"send_replies\": true, \"whitelist_status\": \"all_ads\", "
+        "\"contest_mode\": false, \"mod_reports\": [], \"author_patreon_flair\": false, "
+        "\"author_flair_text_color\": null, \"permalink\": \"/r/sub/comments/l%d/link_number_%d/\", "
+        "\"parent_whitelist_status\": \"all_ads\", \"stickied\": false, \"url\": \"https://i.redd.it/i%d.jpg\", "
+        "\"subreddit_subscribers\": %d, \"created_utc\": %ld.0, \"num_crossposts\": %d, \"media\": ",
+        id, id % 50, id, id, benchRandom(seed) % 4000, id, id, id, benchRandom(seed) * 100, created,
+        benchRandom(seed) % 5);
+    if (video)
+        benchBufferPrintf(buf,
+            "{\"type\": \"youtube.com\", \"oembed\": {\"provider_url\": \"https://www.youtube.com/\", "
+            "\"title\": \"Video title %d\", \"author_name\": \"channel%d\", \"html\": \"&lt;iframe&gt;\"}}, ",
+            id, id);
+    else
+        benchBufferPrintf(buf, "null, ");
+    benchBufferPrintf(buf, "\"is_video\": false}}");
+}
+
+void benchGenerateListing(BenchBuffer *buf, int links)
+{
+    unsigned int seed = 2;
+    int i;
+
+    benchBufferPrintf(buf, "{\"kind\": \"Listing\", \"data\": {\"after\": \"t3_l%d\", \"dist\": %d, "
+                           "\"modhash\": \"\", \"geo_filter\": null, \"children\": [", links - 1, links);
+
+    for (i = 0; i < links; i++) {
+        if (i > 0)
+            benchBufferPrintf(buf, ", ");
+        benchGenerateLink(buf, i, &seed);
+    }
+
+    benchBufferPrintf(buf, "], \"before\": null}}");
+}
@@ -0,0 +1,62 @@
+#ifndef _REDDIT_BENCH_H_
+#define _REDDIT_BENCH_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "jsmn.h"
+
+/*
+ * Small helpers shared by the benchmarks in this directory. The benchmarks
+ * link against the combined libreddit object, so they can call the library's
+ * internal functions directly.
+ */
+
+/*
+ * A growable buffer of text. 'memory' is always nul terminated.
+ */
+typedef struct BenchBuffer {
+    char   *memory;
+    size_t  size;
+    size_t  alloc;
+} BenchBuffer;
+
+void benchBufferInit   (BenchBuffer *buf);
+void benchBufferFree   (BenchBuffer *buf);
+void benchBufferPrintf (BenchBuffer *buf, const char *fmt, ...);
+
+/*
+ * Fills 'buf' with a comment thread in the same format Reddit returns for
+ * '/comments/<id>.json'. The thread has 'topLevel' top-level comments, each
+ * with a tree of replies 'depth' levels deep, and every comment has the full
+ * set of fields Reddit sends along (Most of which libreddit ignores). A few
+ * 'more' stubs are mixed in as well.
+ *
+ * The output only depends on the arguments, so every run gets the same text.
+ */
+void benchGenerateThread (BenchBuffer *buf, int topLevel, int depth);
+
+/*
+ * Fills 'buf' with a subreddit listing of 'links' links, shaped like what
+ * '/r/all.json' returns: Besides the fields libreddit reads, every link
+ * carries the media embeds, preview images, flair and award lists Reddit
+ * sends along.
+ */
+void benchGenerateListing (BenchBuffer *buf, int links);
+
+/*
+ * Tokenizes the first 'len' bytes of 'js' with either jsmn_parse or
+ * jsmn_parse_indexed, growing '*tokens' (Which holds '*alloc' tokens) as
+ * needed. If 'chunk' isn't 0, the text is handed over a random amount (Up to
+ * 'chunk' bytes) at a time, with the rest of it cut off, like a response
+ * that's still coming in. Returns what jsmn returned last.
+ */
+int benchTokenize (const char *js, size_t len, bool indexed, size_t chunk, jsmntok_t **tokens, int *alloc);
+
+/* Current time in seconds, from a monotonic clock */
+double benchNow ();
+
+/* Current resident set size of the process in KB, or 0 if it can't be read */
+long benchRss ();
+
+#endif
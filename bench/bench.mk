@@ -0,0 +1,59 @@
+# Benchmarks for libreddit
+#
+# 'make bench' builds every benchmark into ./build/bench/ and runs them.
+# The benchmarks link against the combined libreddit object instead of the
+# shared library, so they can get at the library's internal functions.
+#
+# 'make bench_json' only runs the parser suite (bench/suite.c) over the corpus
+# in ./bench/corpus, and writes the results to ./build/bench/suite.json so
+# they can be diffed against another version's.
+#
+# 'make check' only runs bench/jsmncheck.c, which checks jsmn_parse_indexed
+# gives back the same tokens as jsmn_parse, with no timing.
+
+BENCH_DIR:=bench
+BENCH_CMP_DIR:=$(BUILD_DIR)/bench
+
+BENCH_CFLAGS:=$(PROJCFLAGS) -I./$(LIBREDDIT_DIR) -I./$(BENCH_DIR)
+BENCH_LDFLAGS:=`curl-config --libs` -pthread -lm
+
+# bench.c holds the shared helpers, every other file is its own benchmark
+BENCH_COMMON:=$(BENCH_CMP_DIR)/bench.o
+BENCH_SOURCES:=$(filter-out bench.c,$(patsubst $(BENCH_DIR)/%,%,$(wildcard $(BENCH_DIR)/*.c)))
+BENCH_PROGRAMS:=$(patsubst %,$(BENCH_CMP_DIR)/%,$(BENCH_SOURCES:.c=))
+
+CLEAN_TARGETS+=bench_clean
+
+.PHONY: bench bench_build bench_json check
+
+# Keep the object files around between runs
+.PRECIOUS: $(BENCH_CMP_DIR)/%.o
+
+bench: bench_build
+	$(QUIETLY)for prog in $(BENCH_PROGRAMS); do $$prog || exit 1; done
+
+bench_build: $(BENCH_PROGRAMS)
+
+check: $(BENCH_CMP_DIR)/jsmncheck
+	$(ECHO) " CHECK $<"
+	$(QUIETLY)$<
+
+bench_json: $(BENCH_CMP_DIR)/suite
+	$(ECHO) " BENCH $(BENCH_CMP_DIR)/suite.json"
+	$(QUIETLY)$(BENCH_CMP_DIR)/suite -j > $(BENCH_CMP_DIR)/suite.json
+
+$(BENCH_CMP_DIR): | $(BUILD_DIR)
+	$(ECHO) " MKDIR $(BENCH_CMP_DIR)"
+	$(MKDIR) $(BENCH_CMP_DIR)
+
+bench_clean:
+	$(ECHO) " RM $(BENCH_CMP_DIR)"
+	$(RM) -fr $(BENCH_CMP_DIR)
+
+$(BENCH_CMP_DIR)/%.o: $(BENCH_DIR)/%.c $(BENCH_DIR)/bench.h | $(BENCH_CMP_DIR)
+	$(ECHO) " CC $@"
+	$(CC) $(BENCH_CFLAGS) -c $< -o $@
+
+$(BENCH_CMP_DIR)/%: $(BENCH_CMP_DIR)/%.o $(BENCH_COMMON) $(LIBREDDIT_COMBINED)
+	$(ECHO) " CC $@"
+	$(CC) $^ $(BENCH_LDFLAGS) -o $@
@@ -0,0 +1,278 @@
+/*
+ * Benchmark for parsing Esc codes out of comment bodies.
+ *
+ * The corpus is every body in a generated thread, which has the same mix of
+ * entities, quotes, newlines and '\u' codes as bodies from Reddit. Each body
+ * is parsed into both the plain char and wchar_t versions.
+ *
+ * 'before' is the parser as it used to be: One pass over the text for each
+ * version, a character at a time. It's only kept here so there's something
+ * to compare the speed against, it got surrogate pairs and entities wrong. For
+ * every body the char version is checked to be the UTF-8 encoding of the
+ * wchar_t version. 'memcpy' is just copying the text, which is as fast as the
+ * parser could possibly get.
+ *
+ * Usage: esc [top-level comments] [iterations]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <locale.h>
+
+#include "global.h"
+#include "token.h"
+#include "comment.h"
+#include "esc.h"
+#include "bench.h"
+
+struct charParser {
+    const char *text;
+    int cur;
+    int offset;
+    int wide;
+    void *new_text;
+};
+
+static void parseCharBefore (struct charParser *p)
+{
+    int k;
+    wchar_t temp;
+    switch(p->text[p->cur]) {
+    case '\\':
+        p->cur++;
+        switch(p->text[p->cur]) {
+        case 'n':
+            if (p->wide)
+                ((wchar_t*)(p->new_text))[p->offset] = L'\n';
+            else
+                ((char*)(p->new_text))[p->offset] = '\n';
+            p->offset++;
+            break;
+
+        case 'u':
+            if (p->wide) {
+                temp = L'\0';
+                for (k = 3; k >= 0; k--) {
+                    p->cur++;
+                    temp |= (((p->text[p->cur] < 58)? p->text[p->cur] - 48: ((p->text[p->cur] & 0x0F) + 9))) << (k << 2);
+                }
+                ((wchar_t*)(p->new_text))[p->offset] = temp;
+                p->offset++;
+            } else {
+                p->cur+=4;
+            }
+            break;
+
+        case '\"':
+            if (p->wide)
+                ((wchar_t*)(p->new_text))[p->offset] = L'\"';
+            else
+                ((char*)(p->new_text))[p->offset] = '\"';
+            p->offset++;
+            break;
+
+        }
+        break;
+    default:
+        if (p->wide)
+            ((wchar_t*)(p->new_text))[p->offset] = btowc(p->text[p->cur]);
+        else
+            ((char*)(p->new_text))[p->offset] = p->text[p->cur];
+        p->offset++;
+        break;
+    }
+}
+
+static void *parseEscCodesBefore (const char *text, int len, int wide)
+{
+    struct charParser parser;
+
+    if (len == 0)
+        return NULL;
+
+    parser.wide = wide;
+    parser.text = text;
+    parser.cur = 0;
+    parser.offset = 0;
+
+    if (wide)
+        parser.new_text = rmalloc((len + 1) * sizeof(wchar_t));
+    else
+        parser.new_text = rmalloc((len + 1) * sizeof(char));
+
+    for (parser.cur = 0; parser.cur < len; parser.cur++)
+        parseCharBefore(&parser);
+
+    if (wide)
+        ((wchar_t*)(parser.new_text))[parser.offset] = L'\0';
+    else
+        ((char*)(parser.new_text))[parser.offset] = '\0';
+
+    return parser.new_text;
+}
+
+typedef struct Corpus {
+    const char **bodies;
+    int         *lengths;
+    int          count;
+    int          alloc;
+    size_t       bytes;
+} Corpus;
+
+static void corpusAdd(Corpus *corpus, RedditComment *comment)
+{
+    int i;
+
+    for (i = 0; i < comment->replyCount; i++) {
+        RedditComment *reply = comment->replies[i];
+
+        if (reply->body != NULL) {
+            if (corpus->count == corpus->alloc) {
+                corpus->alloc = corpus->alloc ? corpus->alloc * 2 : 1024;
+                corpus->bodies  = realloc(corpus->bodies,  corpus->alloc * sizeof(char*));
+                corpus->lengths = realloc(corpus->lengths, corpus->alloc * sizeof(int));
+            }
+            corpus->bodies[corpus->count] = reply->body;
+            corpus->lengths[corpus->count] = strlen(reply->body);
+            corpus->bytes += corpus->lengths[corpus->count];
+            corpus->count++;
+        }
+
+        corpusAdd(corpus, reply);
+    }
+}
+
+/*
+ * Checks the char version of every body is the UTF-8 encoding of the wchar_t
+ * version, and that a few known codes come out right
+ */
+static int corpusCheck(Corpus *corpus)
+{
+    static const struct {
+        const char    *text;
+        const wchar_t *wide;
+    } known[] = {
+        { "a &amp; b &lt;3",          L"a & b <3" },
+        { "\\t\\/\\\\\\\"",          L"\t/\\\"" },
+        { "\\ud83d\\ude00 &#x1F600;", L"\U0001F600 \U0001F600" },
+        { "caf\xc3\xa9 caf\\u00e9",     L"caf\u00e9 caf\u00e9" },
+        { "&amp;lt; &bogus; \\udc00",   L"&lt; &bogus; \uFFFD" },
+    };
+    char *narrow;
+    wchar_t *wide, *check;
+    size_t i;
+    int bad = 0;
+
+    for (i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+        wide = redditParseEscCodesWide(known[i].text, strlen(known[i].text));
+        if (wcscmp(wide, known[i].wide) != 0) {
+            if (bad++ == 0)
+                printf("esc: '%s' parsed to '%ls'\n", known[i].text, wide);
+        }
+        free(wide);
+    }
+
+    for (i = 0; i < (size_t)corpus->count; i++) {
+        redditParseEscCodesBoth(corpus->bodies[i], corpus->lengths[i], &narrow, &wide, NULL);
+
+        check = rmalloc((corpus->lengths[i] + 1) * sizeof(wchar_t));
+        if (mbstowcs(check, narrow, corpus->lengths[i] + 1) == (size_t)-1 || wcscmp(check, wide) != 0) {
+            if (bad++ == 0)
+                printf("esc: Body %d parsed differently: %s\n", (int)i, corpus->bodies[i]);
+        }
+
+        free(check);
+        free(narrow);
+        free(wide);
+    }
+
+    return bad;
+}
+
+enum { RUN_BEFORE, RUN_NARROW, RUN_WIDE, RUN_BOTH, RUN_MEMCPY };
+
+static double corpusRun(Corpus *corpus, int which, int iterations)
+{
+    double start = benchNow();
+    char *narrow;
+    wchar_t *wide;
+    int i, k;
+
+    for (k = 0; k < iterations; k++) {
+        for (i = 0; i < corpus->count; i++) {
+            narrow = NULL;
+            wide = NULL;
+
+            switch (which) {
+            case RUN_BEFORE:
+                narrow = parseEscCodesBefore(corpus->bodies[i], corpus->lengths[i], 0);
+                wide   = parseEscCodesBefore(corpus->bodies[i], corpus->lengths[i], 1);
+                break;
+            case RUN_NARROW:
+                redditParseEscCodesBoth(corpus->bodies[i], corpus->lengths[i], &narrow, NULL, NULL);
+                break;
+            case RUN_WIDE:
+                redditParseEscCodesBoth(corpus->bodies[i], corpus->lengths[i], NULL, &wide, NULL);
+                break;
+            case RUN_BOTH:
+                redditParseEscCodesBoth(corpus->bodies[i], corpus->lengths[i], &narrow, &wide, NULL);
+                break;
+            case RUN_MEMCPY:
+                narrow = rmalloc(corpus->lengths[i] + 1);
+                memcpy(narrow, corpus->bodies[i], corpus->lengths[i] + 1);
+                break;
+            }
+
+            free(narrow);
+            free(wide);
+        }
+    }
+
+    return (benchNow() - start) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    int topLevel = (argc > 1) ? atoi(argv[1]) : 330;
+    int iterations = (argc > 2) ? atoi(argv[2]) : 20;
+    static const char *names[] = { "before (both)", "narrow", "wide", "both", "memcpy" };
+    RedditCommentList *list;
+    TokenParser *parser;
+    BenchBuffer json;
+    Corpus corpus = {0};
+    double seconds;
+    int which;
+
+    setlocale(LC_ALL, "C.UTF-8");
+
+    benchBufferInit(&json);
+    benchGenerateThread(&json, topLevel, 4);
+
+    parser = tokenParserNew();
+    memoryBlockAppend(parser->block, json.memory, json.size);
+    if (tokenParserCreateTokens(parser) != JSMN_SUCCESS) {
+        printf("esc: Generated JSON didn't tokenize\n");
+        return 1;
+    }
+
+    list = redditCommentListNew();
+    redditParseCommentList(parser, list);
+    corpusAdd(&corpus, list->baseComment);
+
+    if (corpusCheck(&corpus) != 0)
+        return 1;
+
+    printf("esc: %d bodies, %.1f KB\n", corpus.count, corpus.bytes / 1024.0);
+    for (which = RUN_BEFORE; which <= RUN_MEMCPY; which++) {
+        seconds = corpusRun(&corpus, which, iterations);
+        printf("  %-20s %.3f ms/iter, %.0f MB/s\n", names[which], seconds * 1000, corpus.bytes / seconds / (1024 * 1024));
+    }
+
+    free(corpus.bodies);
+    free(corpus.lengths);
+    redditCommentListFree(list);
+    tokenParserFree(parser);
+    benchBufferFree(&json);
+    return 0;
+}
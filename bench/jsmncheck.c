@@ -0,0 +1,219 @@
+/*
+ * Checks the indexed tokenizer (jsmn_parse_indexed) against plain jsmn_parse,
+ * without any timing. Run it with 'make check'.
+ *
+ * Both are run over the generated thread and listing, all at once, fed in
+ * random sized chunks, and in counting mode, and over a list of small valid
+ * and invalid snippets. Every token has to match. A TokenParser is run over
+ * the thread both ways too, since that's how libreddit actually uses them.
+ *
+ * The one place they're allowed to differ is a quote in the middle of a
+ * primitive: jsmn_parse lets it through as part of the primitive, while
+ * jsmn_parse_indexed has to take it as the start of a string and turns it
+ * down. Those snippets are checked to make sure that's the only thing that
+ * happens.
+ *
+ * Usage: jsmncheck [top-level comments]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "token.h"
+#include "bench.h"
+
+static int checks;
+
+/*
+ * Returns the number of tokens in 'a' and 'b' that aren't the same
+ */
+static int compareTokens(const char *name, jsmntok_t *a, jsmntok_t *b, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (a[i].type != b[i].type || a[i].start != b[i].start
+         || a[i].end != b[i].end || a[i].size != b[i].size
+         || a[i].is_key != b[i].is_key || a[i].full_size != b[i].full_size) {
+            printf("jsmncheck: %s: Token %d is different\n", name, i);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Checks jsmn_parse_indexed gives back exactly what jsmn_parse does for
+ * 'js'. Returns the number of differences.
+ */
+static int checkIndexed(const char *name, const char *js, size_t len, size_t chunk)
+{
+    jsmntok_t *plain, *indexed;
+    int plainAlloc = 16, indexedAlloc = 16;
+    int plainResult, indexedResult, count, bad = 0;
+    jsmn_parser jsmnParser;
+
+    plain = rmalloc(plainAlloc * sizeof(jsmntok_t));
+    indexed = rmalloc(indexedAlloc * sizeof(jsmntok_t));
+
+    plainResult = benchTokenize(js, len, false, 0, &plain, &plainAlloc);
+    indexedResult = benchTokenize(js, len, true, chunk, &indexed, &indexedAlloc);
+    checks++;
+
+    if (plainResult != indexedResult) {
+        printf("jsmncheck: %s: jsmn_parse returned %d, jsmn_parse_indexed returned %d\n", name, plainResult, indexedResult);
+        bad++;
+    }
+
+    if (bad == 0 && plainResult > 0)
+        bad += compareTokens(name, plain, indexed, plainResult);
+
+    if (plainResult > 0) {
+        jsmn_init(&jsmnParser);
+        count = jsmn_parse_indexed(&jsmnParser, js, len, NULL, 0);
+        if (count != plainResult) {
+            printf("jsmncheck: %s: Counted %d tokens, not %d\n", name, count, plainResult);
+            bad++;
+        }
+    }
+
+    free(plain);
+    free(indexed);
+    return bad;
+}
+
+/*
+ * Checks 'js' is one of the known differences: jsmn_parse takes it, and
+ * jsmn_parse_indexed says it's invalid
+ */
+static int checkDifference(const char *name, const char *js)
+{
+    jsmntok_t *tokens = rmalloc(16 * sizeof(jsmntok_t));
+    int alloc = 16, plainResult, indexedResult;
+
+    plainResult = benchTokenize(js, strlen(js), false, 0, &tokens, &alloc);
+    indexedResult = benchTokenize(js, strlen(js), true, 0, &tokens, &alloc);
+    checks++;
+
+    free(tokens);
+
+    if (plainResult < 0 || indexedResult != JSMN_ERROR_INVAL) {
+        printf("jsmncheck: %s: jsmn_parse returned %d, jsmn_parse_indexed returned %d\n", name, plainResult, indexedResult);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Tokenizes 'json' with a TokenParser, either counted all at once or fed
+ * 16KB at a time like a download
+ */
+static TokenParser *checkParser(BenchBuffer *json, bool indexed, bool streamed)
+{
+    const size_t chunk = 16 * 1024;
+    TokenParser *parser = tokenParserNew();
+    size_t len, off;
+
+    parser->indexed = indexed;
+
+    if (!streamed) {
+        memoryBlockAppend(parser->block, json->memory, json->size);
+        tokenParserCreateTokens(parser);
+        return parser;
+    }
+
+    for (off = 0; off < json->size; off += len) {
+        len = (json->size - off < chunk) ? json->size - off : chunk;
+        memoryBlockAppend(parser->block, json->memory + off, len);
+        tokenParserFeed(parser);
+    }
+
+    return parser;
+}
+
+/*
+ * Checks a TokenParser gives back the same tokens with and without 'indexed'
+ */
+static int checkTokenParser(const char *name, BenchBuffer *json, bool streamed)
+{
+    TokenParser *plain = checkParser(json, false, streamed);
+    TokenParser *indexed = checkParser(json, true, streamed);
+    int bad = 0;
+
+    checks++;
+
+    if (plain->jsmnResult != JSMN_SUCCESS || indexed->jsmnResult != JSMN_SUCCESS
+     || plain->tokenCount != indexed->tokenCount) {
+        printf("jsmncheck: %s: TokenParser got %d tokens (%d), indexed got %d (%d)\n", name,
+               plain->tokenCount, plain->jsmnResult, indexed->tokenCount, indexed->jsmnResult);
+        bad++;
+    } else {
+        bad += compareTokens(name, plain->tokens, indexed->tokens, plain->tokenCount);
+    }
+
+    tokenParserFree(plain);
+    tokenParserFree(indexed);
+    return bad;
+}
+
+int main(int argc, char **argv)
+{
+    /* Snippets picked to hit the edges of the indexer: Escapes at the end of
+     * a 64 byte block, primitives split across blocks, and text jsmn would
+     * reject */
+    static const char *snippets[] = {
+        "{\"a\": 1, \"b\": [true, false, null, -2.5e3], \"c\": {}}",
+        "[\"\\\\\", \"\\\"\", \"\\u00e9\\/\\n\", \"\"]",
+        "{\"long\": \"......................................................\\\"......\"}",
+        "{\"long\": \".....................................................\\\\\", \"x\": 1}",
+        "[1234567890123456789012345678901234567890123456789012345678901234567890]",
+        "[\"\xc3\xa9\", \"\xf0\x9f\x98\x80\"]",
+        "{\"a\": [1, {\"b\": [2, [3]]}]}\n",
+        "{\"a\": }", "[1, 2", "{\"a\": \"b", "[tru", "{\"a\": \"\\", "[\"\\q\"]",
+        "]", "{]", "[}", "[abc]", "[\x01]", "{\"a\": 1}}", "\"key\"",
+    };
+    static const char *differences[] = {
+        "[tru\"e]", "{\"a\": 1\"2\"}", "[null\"\", 1]",
+    };
+    int topLevel = (argc > 1) ? atoi(argv[1]) : 150;
+    BenchBuffer thread, listing;
+    char name[32];
+    size_t i;
+    int bad = 0;
+
+    benchBufferInit(&thread);
+    benchGenerateThread(&thread, topLevel, 4);
+    bad += checkIndexed("thread", thread.memory, thread.size, 0);
+    bad += checkIndexed("thread, streamed", thread.memory, thread.size, 5000);
+    bad += checkTokenParser("thread, TokenParser", &thread, false);
+    bad += checkTokenParser("thread, TokenParser streamed", &thread, true);
+    benchBufferFree(&thread);
+
+    benchBufferInit(&listing);
+    benchGenerateListing(&listing, 100);
+    bad += checkIndexed("listing", listing.memory, listing.size, 0);
+    bad += checkIndexed("listing, streamed", listing.memory, listing.size, 300);
+    benchBufferFree(&listing);
+
+    for (i = 0; i < sizeof(snippets) / sizeof(snippets[0]); i++) {
+        snprintf(name, sizeof(name), "snippet %d", (int)i);
+        bad += checkIndexed(name, snippets[i], strlen(snippets[i]), 0);
+        bad += checkIndexed(name, snippets[i], strlen(snippets[i]), 3);
+    }
+
+    for (i = 0; i < sizeof(differences) / sizeof(differences[0]); i++) {
+        snprintf(name, sizeof(name), "difference %d", (int)i);
+        bad += checkDifference(name, differences[i]);
+    }
+
+    if (bad != 0) {
+        printf("jsmncheck: %d of %d checks failed\n", bad, checks);
+        return 1;
+    }
+
+    printf("jsmncheck: All %d checks passed\n", checks);
+    return 0;
+}
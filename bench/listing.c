@@ -0,0 +1,62 @@
+/*
+ * Benchmark for parsing a subreddit listing.
+ *
+ * Reports how many of the listing's tokens vparseTokens actually looked at.
+ * Before unknown keys were skipped it walked through every one of them, so
+ * the old share is always 100%.
+ *
+ * Usage: listing [links] [iterations]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "token.h"
+#include "link.h"
+#include "bench.h"
+
+int main(int argc, char **argv)
+{
+    int links = (argc > 1) ? atoi(argv[1]) : 100;
+    int iterations = (argc > 2) ? atoi(argv[2]) : 200;
+    RedditLinkList *list;
+    TokenParser *parser;
+    BenchBuffer json;
+    double start, parseTime = 0;
+    int i;
+
+    benchBufferInit(&json);
+    benchGenerateListing(&json, links);
+
+    parser = tokenParserNew();
+    memoryBlockAppend(parser->block, json.memory, json.size);
+    if (tokenParserCreateTokens(parser) != JSMN_SUCCESS) {
+        printf("listing: Generated JSON didn't tokenize\n");
+        return 1;
+    }
+
+    for (i = 0; i < iterations; i++) {
+        list = redditLinkListNew();
+        parser->currentToken = 0;
+        parser->tokensVisited = 0;
+
+        start = benchNow();
+        redditParseListing(parser, list);
+        parseTime += benchNow() - start;
+
+        if (list->linkCount != links) {
+            printf("listing: Parsed %d links, expected %d\n", list->linkCount, links);
+            return 1;
+        }
+        redditLinkListFree(list);
+    }
+
+    printf("listing: %d links, %.1f KB, %d tokens\n", links, json.size / 1024.0, parser->tokenCount);
+    printf("  tokens visited       %d (%.1f%%, was 100%%)\n", parser->tokensVisited, 100.0 * parser->tokensVisited / parser->tokenCount);
+    printf("  parse                %.3f ms/iter\n", parseTime / iterations * 1000);
+
+    tokenParserFree(parser);
+    benchBufferFree(&json);
+    return 0;
+}
@@ -0,0 +1,376 @@
+/*
+ * The parser benchmark suite: Runs every stage of turning a response into
+ * links or comments over a corpus of saved responses, and reports the speed
+ * of each stage in a form that can be compared between versions.
+ *
+ * The corpus is every '.json' file in bench/corpus (Or the files given on the
+ * command line). A file starting with '[' is a comment thread, anything else
+ * is a listing. The checked-in files are what benchGenerateThread and
+ * benchGenerateListing made when they were added, so the results stay
+ * comparable even if the generators change.
+ *
+ * The stages are:
+ *   tokenize  tokenParserCreateTokens on a fresh parser
+ *   parse     redditParseListing or redditParseCommentList over the tokens,
+ *             which runs the link or comment schema over every object
+ *   esc       redditParseEscCodesBoth on every title, selftext and body
+ *   file      redditParseListingFile or redditParseCommentListFile, which is
+ *             all of the above (Minus 'esc') starting from the file on disk
+ *
+ * Each stage is run 'iterations' times and the fastest run is reported, since
+ * that's the one the least noise got into. 'objects' is the number of links
+ * and comments (Or strings, for 'esc'), and 'allocs/object' is how many
+ * times malloc, calloc or realloc were called in one run per object.
+ *
+ * With '-j' the results are written as JSON instead, always with the same
+ * keys in the same order, so two runs can be diffed.
+ *
+ * Usage: suite [-j] [-n iterations] [corpus files...]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glob.h>
+#include <unistd.h>
+
+#include "global.h"
+#include "token.h"
+#include "link.h"
+#include "comment.h"
+#include "esc.h"
+#include "bench.h"
+
+#define SUITE_CORPUS_GLOB "bench/corpus/*.json"
+
+/*
+ * Allocations are counted by putting a counter in front of glibc's malloc.
+ * Everything in the process goes through these, libreddit included.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t count, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static unsigned long suiteAllocs;
+
+void *malloc (size_t size)
+{
+    __atomic_add_fetch(&suiteAllocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc (size_t count, size_t size)
+{
+    __atomic_add_fetch(&suiteAllocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void *realloc (void *ptr, size_t size)
+{
+    __atomic_add_fetch(&suiteAllocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+# define SUITE_ALLOCS() (__atomic_load_n(&suiteAllocs, __ATOMIC_RELAXED))
+#else
+# define SUITE_ALLOCS() 0UL
+#endif
+
+/*
+ * One file of the corpus, along with what parsing it gave back. 'strings' are
+ * the texts the 'esc' stage decodes.
+ */
+typedef struct SuiteCorpus {
+    const char  *path;
+    const char  *name;
+    BenchBuffer  json;
+    bool         thread;
+    int          objects;
+
+    const char **strings;
+    int         *lengths;
+    int          stringCount;
+    size_t       stringBytes;
+} SuiteCorpus;
+
+/* The result of running one stage over one file */
+typedef struct SuiteResult {
+    const char   *stage;
+    size_t        bytes;
+    int           objects;
+    double        seconds;
+    unsigned long allocs;
+} SuiteResult;
+
+static bool suiteLoad (SuiteCorpus *corpus, const char *path)
+{
+    char chunk[64 * 1024];
+    FILE *file = fopen(path, "rb");
+    size_t len;
+
+    if (file == NULL)
+        return false;
+
+    benchBufferInit(&corpus->json);
+    while ((len = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        benchBufferPrintf(&corpus->json, "%.*s", (int)len, chunk);
+    fclose(file);
+
+    corpus->path = path;
+    corpus->name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    corpus->thread = (corpus->json.size > 0 && corpus->json.memory[0] == '[');
+    return true;
+}
+
+static void suiteAddString (SuiteCorpus *corpus, const char *text)
+{
+    if (text == NULL || text[0] == '\0')
+        return ;
+
+    corpus->strings = realloc(corpus->strings, (corpus->stringCount + 1) * sizeof(char*));
+    corpus->lengths = realloc(corpus->lengths, (corpus->stringCount + 1) * sizeof(int));
+    corpus->strings[corpus->stringCount] = text;
+    corpus->lengths[corpus->stringCount] = strlen(text);
+    corpus->stringBytes += corpus->lengths[corpus->stringCount];
+    corpus->stringCount++;
+}
+
+static void suiteAddLink (SuiteCorpus *corpus, RedditLink *link)
+{
+    suiteAddString(corpus, link->title);
+    suiteAddString(corpus, link->selftext);
+    corpus->objects++;
+}
+
+static void suiteAddComments (SuiteCorpus *corpus, RedditComment *comment)
+{
+    int i;
+
+    for (i = 0; i < comment->replyCount; i++) {
+        suiteAddString(corpus, comment->replies[i]->body);
+        corpus->objects++;
+        suiteAddComments(corpus, comment->replies[i]);
+    }
+}
+
+/*
+ * Parses the file once with the tokens in 'parser', either into a new list
+ * that's freed right away, or (If 'corpus' is set) into 'lists' to collect the
+ * objects and strings of the corpus from.
+ */
+static void suiteParse (TokenParser *parser, bool thread, SuiteCorpus *corpus, void **lists)
+{
+    RedditCommentList *comments;
+    RedditLinkList *links;
+    int i;
+
+    parser->currentToken = 0;
+
+    if (thread) {
+        comments = redditCommentListNew();
+        redditParseCommentList(parser, comments);
+
+        if (corpus == NULL) {
+            redditCommentListFree(comments);
+            return ;
+        }
+
+        if (comments->post != NULL)
+            suiteAddLink(corpus, comments->post);
+        suiteAddComments(corpus, comments->baseComment);
+        *lists = comments;
+    } else {
+        links = redditLinkListNew();
+        redditParseListing(parser, links);
+
+        if (corpus == NULL) {
+            redditLinkListFree(links);
+            return ;
+        }
+
+        for (i = 0; i < links->linkCount; i++)
+            suiteAddLink(corpus, links->links[i]);
+        *lists = links;
+    }
+}
+
+enum { SUITE_TOKENIZE, SUITE_PARSE, SUITE_ESC, SUITE_FILE, SUITE_STAGE_COUNT };
+
+static const char *suiteStages[] = { "tokenize", "parse", "esc", "file" };
+
+/*
+ * Runs 'stage' over 'corpus' once, and returns how long it took
+ */
+static double suiteRunOnce (SuiteCorpus *corpus, int stage, TokenParser *tokens)
+{
+    double start = benchNow();
+    RedditCommentList *comments;
+    RedditLinkList *links;
+    TokenParser *parser;
+    char *narrow;
+    wchar_t *wide;
+    int i;
+
+    switch (stage) {
+    case SUITE_TOKENIZE:
+        parser = tokenParserNew();
+        memoryBlockAppend(parser->block, corpus->json.memory, corpus->json.size);
+        tokenParserCreateTokens(parser);
+        tokenParserFree(parser);
+        break;
+
+    case SUITE_PARSE:
+        suiteParse(tokens, corpus->thread, NULL, NULL);
+        break;
+
+    case SUITE_ESC:
+        for (i = 0; i < corpus->stringCount; i++) {
+            redditParseEscCodesBoth(corpus->strings[i], corpus->lengths[i], &narrow, &wide, NULL);
+            free(narrow);
+            free(wide);
+        }
+        break;
+
+    case SUITE_FILE:
+        if (corpus->thread) {
+            comments = redditCommentListNew();
+            redditParseCommentListFile(comments, corpus->path);
+            redditCommentListFree(comments);
+        } else {
+            links = redditLinkListNew();
+            redditParseListingFile(links, corpus->path);
+            redditLinkListFree(links);
+        }
+        break;
+    }
+
+    return benchNow() - start;
+}
+
+static void suiteRun (SuiteCorpus *corpus, int stage, TokenParser *tokens, int iterations, SuiteResult *result)
+{
+    unsigned long allocs;
+    double seconds;
+    int i;
+
+    result->stage = suiteStages[stage];
+    result->bytes = (stage == SUITE_ESC) ? corpus->stringBytes : corpus->json.size;
+    result->objects = (stage == SUITE_ESC) ? corpus->stringCount : corpus->objects;
+
+    allocs = SUITE_ALLOCS();
+    result->seconds = suiteRunOnce(corpus, stage, tokens);
+    result->allocs = SUITE_ALLOCS() - allocs;
+
+    for (i = 1; i < iterations; i++) {
+        seconds = suiteRunOnce(corpus, stage, tokens);
+        if (seconds < result->seconds)
+            result->seconds = seconds;
+    }
+}
+
+static void suitePrint (SuiteCorpus *corpus, SuiteResult *result, bool json, bool last)
+{
+    double mbPerSecond = result->bytes / result->seconds / (1024 * 1024);
+    double objectsPerSecond = result->objects / result->seconds;
+    double allocsPerObject = result->objects ? (double)result->allocs / result->objects : 0;
+
+    if (json) {
+        printf("    {\"corpus\": \"%s\", \"stage\": \"%s\", \"bytes\": %zu, \"objects\": %d, "
+               "\"ms\": %.3f, \"mb_per_s\": %.1f, \"objects_per_s\": %.0f, \"allocs_per_object\": %.2f}%s\n",
+               corpus->name, result->stage, result->bytes, result->objects,
+               result->seconds * 1000, mbPerSecond, objectsPerSecond, allocsPerObject, last ? "" : ",");
+    } else {
+        printf("  %-10s %9.3f ms %9.1f MB/s %11.0f objects/s %8.2f allocs/object\n",
+               result->stage, result->seconds * 1000, mbPerSecond, objectsPerSecond, allocsPerObject);
+    }
+}
+
+int main (int argc, char **argv)
+{
+    int iterations = 20, fileCount, i, k, opt;
+    SuiteResult result;
+    SuiteCorpus *corpus;
+    TokenParser *tokens;
+    void *lists = NULL;
+    bool json = false;
+    char **files;
+    glob_t found;
+
+    while ((opt = getopt(argc, argv, "jn:")) != -1) {
+        switch (opt) {
+        case 'j':
+            json = true;
+            break;
+        case 'n':
+            iterations = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j] [-n iterations] [corpus files...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    memset(&found, 0, sizeof(found));
+    if (optind < argc) {
+        files = argv + optind;
+        fileCount = argc - optind;
+    } else {
+        glob(SUITE_CORPUS_GLOB, 0, NULL, &found);
+        files = found.gl_pathv;
+        fileCount = found.gl_pathc;
+    }
+
+    if (fileCount == 0) {
+        fprintf(stderr, "suite: No corpus files found (Run it from the top of the tree)\n");
+        return 1;
+    }
+
+    corpus = calloc(fileCount, sizeof(SuiteCorpus));
+    for (i = 0; i < fileCount; i++) {
+        if (!suiteLoad(corpus + i, files[i])) {
+            fprintf(stderr, "suite: Couldn't read %s\n", files[i]);
+            return 1;
+        }
+    }
+
+    if (json)
+        printf("{\n  \"suite\": \"libreddit-parse\",\n  \"iterations\": %d,\n  \"results\": [\n", iterations);
+
+    for (i = 0; i < fileCount; i++) {
+        tokens = tokenParserNew();
+        memoryBlockAppend(tokens->block, corpus[i].json.memory, corpus[i].json.size);
+        if (tokenParserCreateTokens(tokens) != JSMN_SUCCESS) {
+            fprintf(stderr, "suite: %s isn't valid JSON\n", corpus[i].name);
+            return 1;
+        }
+
+        /* The list is kept until the end, the strings point into it */
+        suiteParse(tokens, corpus[i].thread, corpus + i, &lists);
+
+        if (!json)
+            printf("suite: %s (%s, %.1f KB, %d objects, %d tokens)\n", corpus[i].name, corpus[i].thread ? "thread" : "listing",
+                   corpus[i].json.size / 1024.0, corpus[i].objects, tokens->tokenCount);
+
+        for (k = 0; k < SUITE_STAGE_COUNT; k++) {
+            suiteRun(corpus + i, k, tokens, iterations, &result);
+            suitePrint(corpus + i, &result, json, i == fileCount - 1 && k == SUITE_STAGE_COUNT - 1);
+        }
+
+        if (corpus[i].thread)
+            redditCommentListFree(lists);
+        else
+            redditLinkListFree(lists);
+
+        tokenParserFree(tokens);
+        free(corpus[i].strings);
+        free(corpus[i].lengths);
+        benchBufferFree(&corpus[i].json);
+    }
+
+    if (json)
+        printf("  ]\n}\n");
+
+    free(corpus);
+    globfree(&found);
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Benchmark for parsing a large comment thread into a RedditCommentList.
+ *
+ * 'parse' is the time it takes to turn the tokens into comments, and
+ * 'resident' is how much the process grew holding on to the finished list.
+ * The bodies are only parsed for Esc codes once they're asked for, 'decode'
+ * is how long it takes to ask for every one of them, and how much more memory
+ * that takes.
+ *
+ * 'tokenize + parse' is the whole job of turning the text into a list, which
+ * shows how much the size of the token array (Which both halves stream
+ * through) costs.
+ *
+ * 'parse, N threads' is 'parse' with the top-level comments split over N
+ * threads (See 'parseThreads'), which only helps with as many cores. With
+ * fewer cores than that, it's parsed on as many threads as there are cores
+ * (So on one core, it's the same as 'parse').
+ *
+ * 'flatten' is turning the list into a RedditCommentTree, and the 'walk'
+ * lines are a pass over every comment (Adding up their depth and score, like
+ * laying out the comment screen does), first over the RedditComment's and then
+ * over the tree's arrays.
+ *
+ * 'splice' is adding one new reply to a comment in the middle of a tree that
+ * was already made, with redditCommentTreeUpdate (Which is what the comment
+ * screen does when hidden replies come in), compared to 'flatten'.
+ *
+ * Usage: thread [top-level comments] [iterations]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "token.h"
+#include "comment.h"
+#include "bench.h"
+
+static int countComments(RedditComment *comment)
+{
+    int count = 1, i;
+
+    for (i = 0; i < comment->replyCount; i++)
+        count += countComments(comment->replies[i]);
+
+    return count;
+}
+
+static void decodeComments(RedditComment *comment)
+{
+    int i;
+
+    for (i = 0; i < comment->replyCount; i++) {
+        redditCommentBodyWide(comment->replies[i]);
+        decodeComments(comment->replies[i]);
+    }
+}
+
+static long walkComments(RedditComment *comment, int depth)
+{
+    long sum = 0;
+    int i;
+
+    for (i = 0; i < comment->replyCount; i++) {
+        sum += depth + comment->replies[i]->ups;
+        sum += walkComments(comment->replies[i], depth + 1);
+    }
+
+    return sum;
+}
+
+static long walkTree(RedditCommentTree *tree)
+{
+    long sum = 0;
+    int i;
+
+    for (i = 0; i < tree->count; i++)
+        sum += tree->depth[i] + tree->ups[i];
+
+    return sum;
+}
+
+static RedditCommentList *parseThread(TokenParser *parser, int threads)
+{
+    RedditCommentList *list = redditCommentListNew();
+
+    list->parseThreads = threads;
+    parser->currentToken = 0;
+    redditParseCommentList(parser, list);
+    return list;
+}
+
+int main(int argc, char **argv)
+{
+    int topLevel = (argc > 1) ? atoi(argv[1]) : 330;
+    int iterations = (argc > 2) ? atoi(argv[2]) : 20;
+    RedditCommentList *list;
+    TokenParser *parser;
+    BenchBuffer json;
+    double start, parseTime = 0, decodeTime, fullTime = 0;
+    long rssBefore, rssAfter, rssDecoded;
+    static const int threadCounts[] = { 2, 4 };
+    double threadTime[2] = { 0 };
+    double flattenTime = 0, walkListTime = 0, walkTreeTime = 0, spliceTime = 0;
+    RedditCommentTree *tree;
+    RedditComment *reply;
+    long walked = 0;
+    int comments, i, k;
+
+    redditStateSet(redditStateNew());
+
+    benchBufferInit(&json);
+    benchGenerateThread(&json, topLevel, 4);
+
+    parser = tokenParserNew();
+    memoryBlockAppend(parser->block, json.memory, json.size);
+    if (tokenParserCreateTokens(parser) != JSMN_SUCCESS) {
+        printf("thread: Generated JSON didn't tokenize\n");
+        return 1;
+    }
+
+    /* The first list is kept until the end, so the memory it holds shows up */
+    rssBefore = benchRss();
+    list = parseThread(parser, 1);
+    rssAfter = benchRss();
+
+    comments = countComments(list->baseComment) - 1;
+
+    start = benchNow();
+    decodeComments(list->baseComment);
+    decodeTime = benchNow() - start;
+    rssDecoded = benchRss();
+
+    for (i = 0; i < iterations; i++) {
+        RedditCommentList *tmp;
+
+        start = benchNow();
+        tmp = parseThread(parser, 1);
+        parseTime += benchNow() - start;
+
+        redditCommentListFree(tmp);
+    }
+
+    for (k = 0; k < 2; k++) {
+        for (i = 0; i < iterations; i++) {
+            RedditCommentList *tmp;
+
+            start = benchNow();
+            tmp = parseThread(parser, threadCounts[k]);
+            threadTime[k] += benchNow() - start;
+
+            if (countComments(tmp->baseComment) - 1 != comments) {
+                printf("thread: Parsed %d comments on %d threads, expected %d\n",
+                       countComments(tmp->baseComment) - 1, threadCounts[k], comments);
+                return 1;
+            }
+            redditCommentListFree(tmp);
+        }
+    }
+
+    for (i = 0; i < iterations; i++) {
+        start = benchNow();
+        tree = redditCommentTreeNew(list);
+        flattenTime += benchNow() - start;
+
+        start = benchNow();
+        walked += walkComments(list->baseComment, 0);
+        walkListTime += benchNow() - start;
+
+        start = benchNow();
+        walked -= walkTree(tree);
+        walkTreeTime += benchNow() - start;
+
+        reply = redditCommentNew();
+        reply->id = redditCopyString("splice");
+        reply->body = redditCopyString("A reply that just came in");
+        redditCommentAddReply(tree->comments[tree->count / 2], reply);
+
+        start = benchNow();
+        redditCommentTreeUpdate(tree, list, tree->count / 2);
+        spliceTime += benchNow() - start;
+
+        redditCommentTreeFree(tree);
+    }
+
+    if (walked != 0) {
+        printf("thread: Walking the tree didn't match walking the comments\n");
+        return 1;
+    }
+
+    for (i = 0; i < iterations; i++) {
+        RedditCommentList *tmp;
+
+        start = benchNow();
+        tokenParserCreateTokens(parser);
+        tmp = parseThread(parser, 1);
+        fullTime += benchNow() - start;
+
+        redditCommentListFree(tmp);
+    }
+
+    printf("thread: %d comments, %.1f KB, %d tokens of %d bytes (%.1f KB)\n", comments, json.size / 1024.0,
+           parser->tokenCount, (int)sizeof(jsmntok_t), parser->tokenCount * sizeof(jsmntok_t) / 1024.0);
+    printf("  parse                %.3f ms/iter\n", parseTime / iterations * 1000);
+    for (k = 0; k < 2; k++)
+        printf("  parse, %d threads     %.3f ms/iter\n", threadCounts[k], threadTime[k] / iterations * 1000);
+    printf("  tokenize + parse     %.3f ms/iter\n", fullTime / iterations * 1000);
+    printf("  flatten              %.3f ms/iter\n", flattenTime / iterations * 1000);
+    printf("  splice, one reply    %.3f ms/iter\n", spliceTime / iterations * 1000);
+    printf("  walk, comments       %.3f ms/iter\n", walkListTime / iterations * 1000);
+    printf("  walk, tree           %.3f ms/iter\n", walkTreeTime / iterations * 1000);
+    printf("  resident             %ld KB\n", rssAfter - rssBefore);
+    printf("  decode every body    %.3f ms, +%ld KB\n", decodeTime * 1000, rssDecoded - rssAfter);
+
+    redditCommentListFree(list);
+    tokenParserFree(parser);
+    benchBufferFree(&json);
+    redditStateFree(redditStateGet());
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Benchmark for tokenizing a large comment thread.
+ *
+ * 'before' is how responses used to be handled: The text was collected with a
+ * realloc for every chunk curl handed over, and once it was all there the
+ * token array was grown 100 tokens (And a realloc and memset) at a time. It's
+ * kept here so there's something to compare the current version against.
+ *
+ * 'plain jsmn' and 'indexed jsmn' are the whole buffer tokenized into the
+ * same token array over and over, so the only difference between the two is
+ * the tokenizer. 'whole buffer' is a fresh TokenParser handed a finished
+ * download, the way tokenParserNewFromBlock is used for every response read
+ * from a buffer or a file. 'whole buffer, indexed' is the same with
+ * 'indexed' turned on. That the two give back the same tokens is checked by
+ * jsmncheck, See 'make check'.
+ *
+ * Usage: tokenize [top-level comments] [iterations]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "token.h"
+#include "bench.h"
+
+static int tokenizeBefore(BenchBuffer *json)
+{
+    const size_t download_chunk = 16 * 1024;
+    const int chunk_size = 100;
+    jsmn_parser jsmnParser;
+    jsmntok_t *tokens;
+    int tokenCount = chunk_size, result;
+    char *memory = rmalloc(1);
+    size_t size = 0, len, off;
+
+    for (off = 0; off < json->size; off += len) {
+        len = (json->size - off < download_chunk) ? json->size - off : download_chunk;
+        memory = rrealloc(memory, size + len + 1);
+        memcpy(memory + size, json->memory + off, len);
+        size += len;
+        memory[size] = 0;
+    }
+
+    tokens = rmalloc(chunk_size * sizeof(jsmntok_t));
+    memset(tokens, 0, tokenCount * sizeof(jsmntok_t));
+    jsmn_init(&jsmnParser);
+
+    while ((result = jsmn_parse(&jsmnParser, memory, tokens, tokenCount)) == JSMN_ERROR_NOMEM) {
+        tokenCount += chunk_size;
+        tokens = rrealloc(tokens, tokenCount * sizeof(jsmntok_t));
+        memset(tokens + tokenCount - chunk_size, 0, chunk_size * sizeof(jsmntok_t));
+    }
+
+    free(tokens);
+    free(memory);
+    return result;
+}
+
+/*
+ * Feeds 'json' to the parser 16KB at a time, the same way request.c does as
+ * the response comes in from curl.
+ */
+static void streamParser(TokenParser *parser, BenchBuffer *json)
+{
+    const size_t chunk = 16 * 1024;
+    size_t len, off;
+
+    for (off = 0; off < json->size; off += len) {
+        len = (json->size - off < chunk) ? json->size - off : chunk;
+        memoryBlockAppend(parser->block, json->memory + off, len);
+        tokenParserFeed(parser);
+    }
+}
+
+/*
+ * Puts a copy of 'json' into the parser's MemoryBlock, like a finished download
+ */
+static void fillParser(TokenParser *parser, BenchBuffer *json)
+{
+    parser->block->size = 0;
+    memoryBlockAppend(parser->block, json->memory, json->size);
+}
+
+static void report(const char *name, double seconds, int iterations, size_t bytes)
+{
+    double per = seconds / iterations;
+    printf("  %-30s %9.3f ms/iter %8.1f MB/s\n", name, per * 1000, bytes / per / (1024 * 1024));
+}
+
+int main(int argc, char **argv)
+{
+    int topLevel = (argc > 1) ? atoi(argv[1]) : 150;
+    int iterations = (argc > 2) ? atoi(argv[2]) : 20;
+    RedditState *state = redditStateNew();
+    BenchBuffer json;
+    TokenParser *parser;
+    jsmntok_t *plainTokens;
+    double start;
+    int i, tokens;
+
+    benchBufferInit(&json);
+    benchGenerateThread(&json, topLevel, 4);
+
+    parser = tokenParserNew();
+    fillParser(parser, &json);
+    tokenParserCreateTokens(parser);
+    tokens = parser->tokenCount;
+    tokenParserFree(parser);
+
+    printf("tokenize: %.2f MB thread, %d tokens, %d iterations\n", json.size / (1024.0 * 1024.0), tokens, iterations);
+
+    start = benchNow();
+    for (i = 0; i < iterations; i++)
+        tokenizeBefore(&json);
+    report("before", benchNow() - start, iterations, json.size);
+
+    start = benchNow();
+    for (i = 0; i < iterations; i++) {
+        parser = tokenParserNew();
+        streamParser(parser, &json);
+        tokenParserFree(parser);
+    }
+    report("streamed, 16KB chunks", benchNow() - start, iterations, json.size);
+
+    start = benchNow();
+    for (i = 0; i < iterations; i++) {
+        parser = tokenParserGet(state);
+        streamParser(parser, &json);
+        tokenParserRelease(state, parser);
+    }
+    report("streamed, reused parser", benchNow() - start, iterations, json.size);
+
+    start = benchNow();
+    for (i = 0; i < iterations; i++) {
+        parser = tokenParserNew();
+        fillParser(parser, &json);
+        tokenParserCreateTokens(parser);
+        tokenParserFree(parser);
+    }
+    report("whole buffer", benchNow() - start, iterations, json.size);
+
+    start = benchNow();
+    for (i = 0; i < iterations; i++) {
+        parser = tokenParserNew();
+        parser->indexed = true;
+        fillParser(parser, &json);
+        tokenParserCreateTokens(parser);
+        tokenParserFree(parser);
+    }
+    report("whole buffer, indexed", benchNow() - start, iterations, json.size);
+
+    tokens = 16;
+    plainTokens = rmalloc(tokens * sizeof(jsmntok_t));
+    start = benchNow();
+    for (i = 0; i < iterations; i++)
+        benchTokenize(json.memory, json.size, false, 0, &plainTokens, &tokens);
+    report("plain jsmn", benchNow() - start, iterations, json.size);
+
+    start = benchNow();
+    for (i = 0; i < iterations; i++)
+        benchTokenize(json.memory, json.size, true, 0, &plainTokens, &tokens);
+    report("indexed jsmn", benchNow() - start, iterations, json.size);
+    free(plainTokens);
+
+
+    redditStateFree(state);
+    benchBufferFree(&json);
+    return 0;
+}
@@ -9,6 +9,7 @@ extern "C" {
 #include <stdbool.h>
 #include <wchar.h>
 #include <time.h>
+#include <sys/select.h>
 #ifdef REDDIT_DEBUG
 # include <stdio.h>
 #endif
@@ -59,11 +60,26 @@ typedef struct RedditCookieLink {
  * This structure represents the current state of the library, or more specifically
  * of the Reddit Session.
  *
- * Currently, all it does is contain a linked-list of cookies being used in the session
+ * It contains a linked-list of cookies being used in the session, as well as
+ * a pool of connections to Reddit which are kept open between requests, and
+ * the parser of the last finished request so its tokens can be reused, and
+ * the threads used to parse big responses (See 'parseThreads' in
+ * RedditLinkList).
+ *
+ * 'connectionsNew' and 'connectionsReused' count how many requests made with
+ * this state had to open a fresh connection, and how many were able to reuse
+ * an already open one.
  */
 typedef struct RedditState {
     RedditCookieLink *base;
     char *userAgent;
+
+    struct RedditConnectionPool *connections; /* Internal to libreddit */
+    struct TokenParser *spareParser; /* Internal to libreddit */
+    struct RedditWorkerPool *workers; /* Internal to libreddit */
+
+    unsigned long connectionsNew;
+    unsigned long connectionsReused;
 } RedditState;
 
 /*
@@ -85,8 +101,8 @@ typedef struct RedditUser {
 
     char *id; /* The user's unique Base-36 ID */
 
-    int commentKarma; /* User's current comment karma count */
-    int linkKarma; /* User's current link karma count */
+    long long commentKarma; /* User's current comment karma count */
+    long long linkKarma; /* User's current link karma count */
 
     unsigned int flags; /* used as a bitfield for the define's below */
 } RedditUser;
@@ -137,7 +153,11 @@ typedef struct RedditLink {
     /* These members are versions of the strings in different formats.
      * The normal versions are unparsed.
      * The 'Esc' versions are parsed for Reddit Esc codes.
-     * The 'w' versions are parsed for Esc codes as well as support unicode characters */
+     * The 'w' versions are parsed for Esc codes as well as support unicode characters
+     *
+     * The 'Esc' and 'w' versions are only parsed once they're asked for, so
+     * get them through redditLinkTitleEsc() and friends instead of reading
+     * them straight out of here. */
     char *title;
     char *selftext;
 
@@ -154,10 +174,12 @@ typedef struct RedditLink {
     int numComments;
     int numReports;
 
-    char *created_utc; // Date that this comment was created in UTC
+    time_t created_utc; // Date that this comment was created, in seconds since the epoch
 
     unsigned int flags;
     unsigned int advance;
+
+    struct RedditArena *arena; /* Internal to libreddit */
 } RedditLink;
 
 #define REDDIT_LINK_IS_SELF       1
@@ -168,6 +190,12 @@ typedef struct RedditLink {
 #define REDDIT_LINK_HIDDEN        32
 #define REDDIT_LINK_DISTINGUISHED 64
 
+/* Set by libreddit on links from a 'zeroCopy' list. 'id', 'permalink',
+ * 'author', 'url', 'title' and 'selftext' point into a response kept by the
+ * list, so they're only valid as long as the list is, and aren't freed by
+ * redditLinkFree */
+#define REDDIT_LINK_STRING_VIEWS  128
+
 /*
  * This enum represents the sorting to be requested when getting a list
  * of links from Reddit.
@@ -186,6 +214,24 @@ typedef enum RedditListType {
  * more then once on the same list to get more Links.
  *
  * 'subreddit' should be a string with the name of the subreddit, Ex. '/','/r/linux',etc.
+ *
+ * If 'zeroCopy' is set before getting links, the list keeps every response
+ * from Reddit around and the strings in the links point right into them
+ * instead of being copies (See REDDIT_LINK_STRING_VIEWS). That saves a lot of
+ * allocations when getting a lot of links, but the links can't outlive the
+ * list.
+ *
+ * If 'useArena' is set before getting links, the links and all of their
+ * strings are allocated out of one big arena owned by the list, and freeing
+ * the list just frees the arena. redditLinkFree does nothing on those links,
+ * so they can't outlive the list either. It can be combined with 'zeroCopy'.
+ *
+ * If 'parseThreads' is more than 1, the links in each response are parsed on
+ * up to that many threads at once (Counting the calling one), using a pool of
+ * threads kept in the current RedditState. The links still end up in the
+ * same order. It's only worth it for big pages, and needs a current state.
+ * It's capped at the number of cores, and small responses are still parsed
+ * on just the calling thread.
  */
 typedef struct RedditLinkList {
     char *subreddit;
@@ -195,6 +241,14 @@ typedef struct RedditLinkList {
     int linkCount;
     RedditLink **links;
     char *afterId;
+
+    bool zeroCopy;
+    struct MemoryBlock *responses; /* Internal to libreddit */
+
+    bool useArena;
+    struct RedditArena *arena; /* Internal to libreddit */
+
+    int parseThreads;
 } RedditLinkList;
 
 /*
@@ -246,10 +300,12 @@ typedef struct RedditComment {
     char *childrenId;
     char **directChildrenIds;
 
-    char *created_utc; // Date that this comment was created in UTC
+    time_t created_utc; // Date that this comment was created, in seconds since the epoch
 
     unsigned int flags;
     int advance;
+
+    struct RedditArena *arena; /* Internal to libreddit */
 } RedditComment;
 
 #define REDDIT_COMMENT_SCORE_HIDDEN  1
@@ -257,6 +313,11 @@ typedef struct RedditComment {
 #define REDDIT_COMMENT_EDITED        4
 #define REDDIT_COMMENT_NEED_TO_GET   8
 
+/* Same as REDDIT_LINK_STRING_VIEWS, for comments from a 'zeroCopy'
+ * RedditCommentList. Applies to 'id', 'author', 'parentId', 'linkId',
+ * 'childrenId' and 'body' */
+#define REDDIT_COMMENT_STRING_VIEWS  16
+
 /*
  * The type of sorting that should be used when getting the list of comments
  */
@@ -274,6 +335,18 @@ typedef enum RedditCommentSortType {
  *
  * The 'baseComment' is a RedditComment structure that has no data except replies.
  * The replies to baseComment are the top-level comments to the link/post.
+ *
+ * 'zeroCopy' and 'useArena' work the same as in a RedditLinkList, for the
+ * comments and the post. With 'useArena' the reply arrays come out of the
+ * arena too, so freeing even a huge thread is just a few calls to free().
+ * Either has to be set before the list is first filled in.
+ *
+ * 'parseThreads' works the same as in a RedditLinkList, for the top-level
+ * comments (Each one is parsed along with all of it's replies).
+ *
+ * 'index' is made the first time redditGetCommentChildren is called, and
+ * is used to find comments by their id. It only knows about the comments
+ * libreddit added to the list, not ones added with redditCommentAddReply.
  */
 typedef struct RedditCommentList {
     RedditComment *baseComment;
@@ -281,8 +354,85 @@ typedef struct RedditCommentList {
     RedditLink *post;
     char *permalink;
     char *id;
+
+    bool zeroCopy;
+    struct MemoryBlock *responses; /* Internal to libreddit */
+
+    bool useArena;
+    struct RedditArena *arena; /* Internal to libreddit */
+
+    int parseThreads;
+
+    struct RedditCommentIndex *index; /* Internal to libreddit */
 } RedditCommentList;
 
+/*
+ * A RedditCommentList flattened out into arrays, with one entry per comment
+ * (Not counting the 'baseComment') in pre-order: Every comment is followed by
+ * all of it's replies, then by it's next sibling. Going over the whole thread
+ * is a loop from 0 to 'count', with no pointers to chase.
+ *
+ * 'depth' is 0 for the top-level comments, and 'parent' is the index of the
+ * comment a comment is a reply to (-1 for the top-level ones). 'subtreeSize'
+ * is the number of comments under a comment, so it's replies are the entries
+ * after it up to 'i + subtreeSize[i]', and it's next sibling is at
+ * 'i + subtreeSize[i] + 1'. Folding a comment is skipping that many entries.
+ *
+ * 'id', 'author', 'parentId', 'linkId', 'body' and 'childrenId' are offsets
+ * into 'strings', which holds a copy of every one of them, Ex.
+ * 'tree->strings + tree->body[i]', and is 'stringsSize' bytes long (A NULL
+ * string is held as ""). 'directChildrenIds' is the offset of a comment's
+ * 'more' ids, held as one string with a ',' between each of them, and
+ * 'directChildrenCount' is how many there are. The rest of the arrays are the
+ * same as the members of RedditComment.
+ *
+ * 'comments' holds the RedditComment each entry was made from, which still
+ * belongs to the list, so it's only valid as long as the list is.
+ */
+typedef struct RedditCommentTree {
+    int count;
+
+    int *depth;
+    int *parent;
+    int *subtreeSize;
+
+    int *ups;
+    int *downs;
+    int *numReports;
+    int *totalReplyCount;
+    int *directChildrenCount;
+    unsigned int *flags;
+    time_t *created_utc;
+
+    char *strings;
+    size_t stringsSize;
+    int *id;
+    int *author;
+    int *parentId;
+    int *linkId;
+    int *body;
+    int *childrenId;
+    int *directChildrenIds;
+
+    RedditComment **comments;
+} RedditCommentTree;
+
+
+/*
+ * A request to Reddit running in the background. These are returned by the
+ * 'Async' versions of the API calls, and are driven by the redditAsync*
+ * functions below from the caller's own event loop. A request is freed by the
+ * library right after its callback is called.
+ */
+typedef struct RedditRequest RedditRequest;
+
+/*
+ * Callbacks called when an asynchronous request finishes. 'err' is
+ * REDDIT_SUCCESS if the list was filled in, and 'data' is the pointer that was
+ * passed along when the request was started.
+ */
+typedef void (*RedditLinkListCallback)    (RedditLinkList    *list, RedditErrno err, void *data);
+typedef void (*RedditCommentListCallback) (RedditCommentList *list, RedditErrno err, void *data);
 
 /*
  * calls to create and free a cookie
@@ -322,6 +472,13 @@ extern RedditErrno redditUserLoggedUpdate (RedditUserLogged *user);
 extern RedditLink *redditLinkNew  ();
 extern void        redditLinkFree (RedditLink *link);
 
+/* Return the Esc code parsed title and selftext of a link, parsing them the
+ * first time they're asked for. The strings belong to the link. */
+extern char    *redditLinkTitleEsc     (RedditLink *link);
+extern wchar_t *redditLinkTitleWide    (RedditLink *link);
+extern char    *redditLinkSelftextEsc  (RedditLink *link);
+extern wchar_t *redditLinkSelftextWide (RedditLink *link);
+
 /* Functions to Create a new list of Links, free that list, and just free the
  * links creating the list */
 extern RedditLinkList *redditLinkListNew       ();
@@ -329,7 +486,13 @@ extern void            redditLinkListFree      (RedditLinkList *list);
 extern void            redditLinkListFreeLinks (RedditLinkList *list);
 
 /* Returns a list of Links for a subreddit, using the settings in 'list' */
-extern RedditErrno redditGetListing (RedditLinkList *list);
+extern RedditErrno    redditGetListing      (RedditLinkList *list);
+extern RedditRequest *redditGetListingAsync (RedditLinkList *list, RedditLinkListCallback callback, void *data);
+
+/* Parse a listing that's already been downloaded, out of memory or a file,
+ * without going to Reddit */
+extern RedditErrno redditParseListingBuffer (RedditLinkList *list, const char *json, size_t len);
+extern RedditErrno redditParseListingFile   (RedditLinkList *list, const char *path);
 
 /* Create a new blank comment, free a comment, and add a comment structure as a
  * reply to a comment: NOTE: redditCommentAddReply doesn't add the comment as a reply
@@ -338,21 +501,80 @@ extern RedditComment *redditCommentNew      ();
 extern void           redditCommentFree     (RedditComment *comment);
 extern void           redditCommentAddReply (RedditComment *comment, RedditComment *reply);
 
+/* Same as redditLinkTitleEsc, for the body of a comment */
+extern char    *redditCommentBodyEsc  (RedditComment *comment);
+extern wchar_t *redditCommentBodyWide (RedditComment *comment);
+
 /* Create and free a list of comments */
 extern RedditCommentList *redditCommentListNew  ();
 extern void               redditCommentListFree (RedditCommentList *list);
 
 /* Call Reddit to get a list of comments */
-extern RedditErrno redditGetCommentList (RedditCommentList *list);
+extern RedditErrno    redditGetCommentList      (RedditCommentList *list);
+extern RedditRequest *redditGetCommentListAsync (RedditCommentList *list, RedditCommentListCallback callback, void *data);
+
+/* Parse a thread that's already been downloaded, out of memory or a file,
+ * without going to Reddit */
+extern RedditErrno redditParseCommentListBuffer (RedditCommentList *list, const char *json, size_t len);
+extern RedditErrno redditParseCommentListFile   (RedditCommentList *list, const char *path);
+
+/* Call the morechildren API to get children of 'parent', or every hidden
+ * comment in the list with up to 'maxRequests' calls running at once (A
+ * default if it's 0). If a call for the children of 'parent' fails or is
+ * cancelled, the ids it asked for are put back on 'parent'. */
+extern RedditErrno    redditGetCommentChildren      (RedditCommentList *list, RedditComment *parent);
+extern RedditRequest *redditGetCommentChildrenAsync (RedditCommentList *list, RedditComment *parent, RedditCommentListCallback callback, void *data);
+extern RedditErrno    redditGetAllCommentChildren   (RedditCommentList *list, int maxRequests);
+
+/* Flatten a list of comments into a RedditCommentTree, and free a tree */
+extern RedditCommentTree *redditCommentTreeNew  (RedditCommentList *list);
+extern void               redditCommentTreeFree (RedditCommentTree *tree);
+
+/* Add the comments under the one at 'index' in a tree (Or anywhere in the
+ * tree, if it's -1) that were added to the list after the tree was made,
+ * Ex. by redditGetCommentChildren. Returns how many comments were added. */
+extern int redditCommentTreeUpdate (RedditCommentTree *tree, RedditCommentList *list, int index);
+
+/* Reorder the comments in a tree, keeping every comment's replies under it.
+ * Replies are sorted among themselves, the same way Reddit sorts them. */
+extern void redditCommentTreeSort (RedditCommentTree *tree, RedditCommentSortType sort);
+
+/* Turn a tree back into a new blank RedditComment, with copies of the comments
+ * in the tree as it's replies (The same as a 'baseComment'). The copies keep
+ * their 'more' ids, so their hidden replies can still be expanded. */
+extern RedditComment *redditCommentTreeToComment (RedditCommentTree *tree);
 
-/* Call the morechildren API to get children of 'parent' */
-extern RedditErrno redditGetCommentChildren (RedditCommentList *list, RedditComment *parent);
+/*
+ * These functions run the requests started by the 'Async' calls. The
+ * requests only make progress while redditAsyncPerform is being called.
+ *
+ * redditAsyncFdset adds the file descriptors the running requests are waiting
+ * on to the sets (For use with select()), and redditAsyncTimeout returns the
+ * longest time in milliseconds to wait before calling redditAsyncPerform
+ * anyway (-1 if there's no limit).
+ *
+ * redditAsyncPerform does any work that can be done without blocking, calls
+ * the callbacks of finished requests, and returns how many are still running.
+ * Callbacks are only ever called from in here: The blocking API calls keep
+ * the running requests going while they wait, but any that finish are left
+ * for the next redditAsyncPerform.
+ *
+ * redditAsyncWait waits at most 'timeoutMs' for activity on the running
+ * requests, for callers that don't have an event loop of their own.
+ *
+ * redditRequestCancel stops a running request without calling its callback.
+ */
+extern RedditErrno redditAsyncFdset    (fd_set *readSet, fd_set *writeSet, fd_set *exceptSet, int *maxfd);
+extern long        redditAsyncTimeout  ();
+extern int         redditAsyncPerform  ();
+extern void        redditAsyncWait     (int timeoutMs);
+extern void        redditRequestCancel (RedditRequest *request);
 
 /* simply returns an allocated copy of a string. */
 extern char *redditCopyString (const char *string);
 
 /* These functions will returned a copy of 'text' parsed for Reddit's esc codes,
- * Ex. '\n', '\uxxxx', etc... */
+ * Ex. '\n', '\uxxxx', '&amp;', etc... The char version is UTF-8 */
 extern char    *redditParseEscCodes     (const char *text, int len);
 extern wchar_t *redditParseEscCodesWide (const char *text, int len);
 
@@ -369,6 +591,10 @@ extern void redditSetDebugFile(FILE *file);
 #define CREATE_DATE_FORMAT "\%F-\%T"
 #define CREATE_DATE_FORMAT_BYTE_COUNT 32
 
+/* Formats 'date' (Ex. a 'created_utc') as local time in 'buf', using the
+ * above format. Returns the length written, or 0 if 'size' was too small */
+extern size_t redditFormatDate (char *buf, size_t size, time_t date);
+
 #ifdef __cplusplus
 }
 #endif
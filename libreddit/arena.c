@@ -0,0 +1,117 @@
+#ifndef _REDDIT_ARENA_C_
+#define _REDDIT_ARENA_C_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "arena.h"
+
+/* Every allocation is rounded up to a multiple of this, which is enough for
+ * anything libreddit keeps in an arena (Structures of pointers and ints) */
+#define REDDIT_ARENA_ALIGN sizeof(void*)
+
+/*
+ * Allocates an empty arena. No chunks are allocated until something is
+ * allocated out of it.
+ */
+RedditArena *redditArenaNew()
+{
+    RedditArena *arena = rmalloc(sizeof(RedditArena));
+    arena->chunks = NULL;
+    arena->children = NULL;
+    arena->next = NULL;
+    return arena;
+}
+
+RedditArena *redditArenaNewChild(RedditArena *parent)
+{
+    RedditArena *arena = redditArenaNew();
+
+    arena->next = parent->children;
+    parent->children = arena;
+    return arena;
+}
+
+/*
+ * Frees an arena along with everything that was allocated from it, and all of
+ * it's children
+ */
+void redditArenaFree(RedditArena *arena)
+{
+    RedditArenaChunk *chunk, *next;
+    RedditArena *child, *nextChild;
+
+    if (arena == NULL)
+        return ;
+
+    for (child = arena->children; child != NULL; child = nextChild) {
+        nextChild = child->next;
+        redditArenaFree(child);
+    }
+
+    for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    free(arena);
+}
+
+/*
+ * Adds a new chunk with at least 'bytes' free. Big allocations go in a chunk
+ * of their own behind the current one, so the space left in the current chunk
+ * can still be used.
+ */
+static RedditArenaChunk *redditArenaAddChunk(RedditArena *arena, size_t bytes)
+{
+    RedditArenaChunk *chunk;
+    size_t size = REDDIT_ARENA_CHUNK_SIZE;
+
+    if (bytes > REDDIT_ARENA_CHUNK_SIZE / 4)
+        size = bytes;
+
+    chunk = rmalloc(sizeof(RedditArenaChunk) + size);
+    chunk->size = size;
+    chunk->used = 0;
+
+    if (size != REDDIT_ARENA_CHUNK_SIZE && arena->chunks != NULL) {
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+    } else {
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    return chunk;
+}
+
+void *redditArenaAlloc(RedditArena *arena, size_t bytes)
+{
+    RedditArenaChunk *chunk;
+    void *mem;
+
+    if (arena == NULL)
+        return rmalloc(bytes);
+
+    bytes = (bytes + REDDIT_ARENA_ALIGN - 1) & ~(REDDIT_ARENA_ALIGN - 1);
+
+    chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < bytes)
+        chunk = redditArenaAddChunk(arena, bytes);
+
+    mem = chunk->memory + chunk->used;
+    chunk->used += bytes;
+    return mem;
+}
+
+char *redditArenaCopy(RedditArena *arena, const char *str, size_t len)
+{
+    char *copy = redditArenaAlloc(arena, len + 1);
+
+    memcpy(copy, str, len);
+    copy[len] = 0;
+    return copy;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef _REDDIT_ARENA_H_
+#define _REDDIT_ARENA_H_
+
+#include <stddef.h>
+
+#include "reddit.h"
+
+/*
+ * The size of each chunk of memory an arena grabs at once. Anything bigger
+ * than a quarter of this gets a chunk of it's own, so big strings don't waste
+ * the rest of a normal chunk.
+ */
+#define REDDIT_ARENA_CHUNK_SIZE (64 * 1024)
+
+/*
+ * One chunk of memory in an arena. 'used' bytes of 'memory' have already been
+ * handed out.
+ */
+typedef struct RedditArenaChunk {
+    struct RedditArenaChunk *next;
+    size_t size;
+    size_t used;
+    char   memory[];
+} RedditArenaChunk;
+
+/*
+ * A bump allocator owned by a RedditLinkList or RedditCommentList (See
+ * 'useArena'). Everything allocated out of it is freed all at once by
+ * redditArenaFree, nothing is ever freed on it's own.
+ *
+ * 'chunks' is the chunk currently being allocated from, with the older chunks
+ * chained after it.
+ *
+ * An arena isn't safe to allocate from on more than one thread, so each
+ * thread parsing into the same list gets an arena of it's own, chained onto
+ * the list's through 'children' and 'next' (See redditArenaNewChild).
+ */
+typedef struct RedditArena {
+    RedditArenaChunk *chunks;
+
+    struct RedditArena *children;
+    struct RedditArena *next;
+} RedditArena;
+
+RedditArena *redditArenaNew  ();
+void         redditArenaFree (RedditArena *arena);
+
+/*
+ * Returns a new arena that's freed along with 'parent'
+ */
+RedditArena *redditArenaNewChild (RedditArena *parent);
+
+/*
+ * Returns 'bytes' of memory from 'arena', aligned for pointers. If 'arena' is
+ * NULL this is just rmalloc, so code that works either way can call it
+ * without checking.
+ */
+void *redditArenaAlloc (RedditArena *arena, size_t bytes);
+
+/*
+ * Returns a nul-terminated copy of the first 'len' bytes of 'str', allocated
+ * with redditArenaAlloc.
+ */
+char *redditArenaCopy  (RedditArena *arena, const char *str, size_t len);
+
+#endif
@@ -8,6 +8,9 @@
 #include "global.h"
 #include "comment.h"
 #include "token.h"
+#include "request.h"
+#include "arena.h"
+#include "esc.h"
 
 /*
  * Creates a new redditComment
@@ -20,13 +23,34 @@ EXPORT_SYMBOL RedditComment *redditCommentNew ()
     return comment;
 }
 
+/*
+ * Allocates an empty RedditComment out of 'arena', or with redditCommentNew
+ * if it's NULL
+ */
+static RedditComment *redditCommentNewIn (RedditArena *arena)
+{
+    RedditComment *comment;
+
+    if (arena == NULL)
+        return redditCommentNew();
+
+    comment = redditArenaAlloc(arena, sizeof(RedditComment));
+    memset(comment, 0, sizeof(RedditComment));
+    comment->arena = arena;
+
+    return comment;
+}
+
 /*
  * Recursively free's all replys on a RedditComment
+ *
+ * Comments allocated from a list's arena are left alone, they're freed along
+ * with the list.
  */
 EXPORT_SYMBOL void redditCommentFreeReplies (RedditComment *comment)
 {
     int i;
-    if (comment == NULL)
+    if (comment == NULL || comment->arena != NULL)
         return ;
     for (i = 0; i < comment->replyCount; i++)
         redditCommentFree(comment->replies[i]);
@@ -40,6 +64,11 @@ static void redditCommentFreeChildren (RedditComment *comment)
     if (comment == NULL || comment->directChildrenIds == NULL)
         return ;
 
+    if (comment->arena != NULL) {
+        comment->directChildrenIds = NULL;
+        return ;
+    }
+
     for (i = 0; i < comment->directChildrenCount; i++)
         free(comment->directChildrenIds[i]);
 
@@ -49,91 +78,234 @@ static void redditCommentFreeChildren (RedditComment *comment)
 
 /*
  * Frees all of a RedditComment as well as all of it's replies
+ *
+ * Like redditCommentFreeReplies, this does nothing on a comment from an arena
  */
 EXPORT_SYMBOL void redditCommentFree (RedditComment *comment)
 {
-    if (comment == NULL)
+    if (comment == NULL || comment->arena != NULL)
         return ;
 
-    free(comment->body);
+    if (!(comment->flags & REDDIT_COMMENT_STRING_VIEWS)) {
+        free(comment->body);
+        free(comment->id);
+        free(comment->author);
+        free(comment->parentId);
+        free(comment->linkId);
+        free(comment->childrenId);
+    }
     free(comment->bodyEsc);
     free(comment->wbodyEsc);
-    free(comment->id);
-    free(comment->author);
-    free(comment->parentId);
-    free(comment->linkId);
     redditCommentFreeChildren(comment);
-    free(comment->childrenId);
     redditCommentFreeReplies(comment);
     free(comment);
 }
 
 /*
- * Chains a RedditComment as a reply on another RedditComment.
+ * Accessors for the Esc code parsed versions of a comment's body. Like
+ * redditLinkTitleEsc, it's parsed the first time it's asked for.
  */
-EXPORT_SYMBOL void redditCommentAddReply (RedditComment *comment, RedditComment *reply)
+EXPORT_SYMBOL char *redditCommentBodyEsc (RedditComment *comment)
+{
+    return redditParseEscCodesCached(&comment->bodyEsc, comment->body, comment->arena);
+}
+
+EXPORT_SYMBOL wchar_t *redditCommentBodyWide (RedditComment *comment)
 {
+    return redditParseEscCodesCachedWide(&comment->wbodyEsc, comment->body, comment->arena);
+}
+
+/*
+ * Puts 'reply' at the end of the replies of 'comment', without touching any
+ * of the totalReplyCount's.
+ *
+ * The replies array holds room for 4 replies, then 8, 16 and so on, so adding
+ * n replies only grows it about log(n) times. A comment in an arena can't
+ * realloc it's array, so it's copied into a new one twice the size instead.
+ */
+void redditCommentAttachReply (RedditComment *comment, RedditComment *reply)
+{
+    RedditComment **replies;
+    int count = comment->replyCount;
+
+    if (count == 0 || (count >= 4 && (count & (count - 1)) == 0)) {
+        if (comment->arena == NULL) {
+            comment->replies = rrealloc(comment->replies, (count ? count * 2 : 4) * sizeof(RedditComment*));
+        } else {
+            replies = redditArenaAlloc(comment->arena, (count ? count * 2 : 4) * sizeof(RedditComment*));
+            if (count > 0)
+                memcpy(replies, comment->replies, count * sizeof(RedditComment*));
+            comment->replies = replies;
+        }
+    }
+
+    comment->replies[count] = reply;
     comment->replyCount++;
-    RedditComment* ptr = comment;
-    while (ptr != NULL) {
+    reply->parent = comment;
+}
+
+/*
+ * Chains a RedditComment as a reply on another RedditComment, and adds it
+ * (Along with all of it's replies) to the totalReplyCount of every comment
+ * above it.
+ */
+EXPORT_SYMBOL void redditCommentAddReply (RedditComment *comment, RedditComment *reply)
+{
+    RedditComment *ptr;
+
+    for (ptr = comment; ptr != NULL; ptr = ptr->parent)
         ptr->totalReplyCount += reply->totalReplyCount + 1;
-        ptr = ptr->parent;
+
+    redditCommentAttachReply(comment, reply);
+}
+
+/*
+ * Works out the totalReplyCount of 'comment' and everything under it, for a
+ * tree that was built with redditCommentAttachReply. It's done in one pass
+ * from the bottom up once the whole thread is parsed, instead of walking up
+ * the tree for every comment as it's added.
+ *
+ * A comment with a 'more' object (Which Reddit always sends after the
+ * replies) or hidden replies keeps the count that came with them, the same as
+ * it gets when the replies are added one at a time.
+ */
+static int redditCommentCountReplies (RedditComment *comment)
+{
+    int total = 0, i;
+
+    for (i = 0; i < comment->replyCount; i++)
+        total += redditCommentCountReplies(comment->replies[i]) + 1;
+
+    if (comment->childrenId == NULL && comment->directChildrenCount == 0)
+        comment->totalReplyCount = total;
+
+    return comment->totalReplyCount;
+}
+
+/*
+ * Strips the type off of a fullname, Ex. 't1_idvalu' gives 'idvalu'. Ids
+ * without one are returned as they are.
+ */
+static const char *redditCommentStripType (const char *id)
+{
+    if (id[0] != '\0' && id[1] != '\0' && id[2] == '_')
+        return id + 3;
+    return id;
+}
+
+/*
+ * FNV-1a hash of a comment id
+ */
+static unsigned int redditCommentIdHash (const char *id)
+{
+    unsigned int hash = 2166136261u;
+
+    for (; *id != '\0'; id++)
+        hash = (hash ^ (unsigned char)*id) * 16777619u;
+
+    return hash;
+}
+
+/*
+ * Returns the slot in 'index' for the comment with id 'id' and hash 'hash',
+ * which is the empty slot it would go in if it's not there.
+ */
+static RedditCommentIndexEntry *redditCommentIndexSlot (RedditCommentIndex *index, const char *id, unsigned int hash)
+{
+    unsigned int mask = index->size - 1;
+    unsigned int i = hash & mask;
+    RedditCommentIndexEntry *entry;
+
+    for (;; i = (i + 1) & mask) {
+        entry = index->entries + i;
+        if (entry->comment == NULL)
+            return entry;
+        if (entry->hash == hash && strcmp(entry->comment->id, id) == 0)
+            return entry;
     }
-    comment->replies = rrealloc(comment->replies, (comment->replyCount) * sizeof(RedditComment*));
-    comment->replies[comment->replyCount - 1] = reply;
-    reply->parent = comment;
 }
 
 /*
- * Finds a comment in the list of comments who's id matches the parentId we're looking for
- * Note: Only checks linear parents from directParent. Could be improved to check every reply in the true
- * But that could be heavy for larger trees.
+ * Doubles the number of slots in 'index' (Or gives it it's first ones)
  */
-static RedditComment *redditCommentFindParent (RedditComment *base, char *parentId)
+static void redditCommentIndexGrow (RedditCommentIndex *index)
 {
-    char pid[8];
-    RedditComment *current;
+    RedditCommentIndexEntry *old = index->entries;
+    unsigned int oldSize = index->size, i;
 
-    int stackSize = 100;
-    RedditComment **stack = rmalloc(sizeof(RedditComment*) * stackSize);;
-    int top = 0;
+    index->size = oldSize ? oldSize * 2 : 64;
+    index->entries = rmalloc(index->size * sizeof(RedditCommentIndexEntry));
+    memset(index->entries, 0, index->size * sizeof(RedditCommentIndexEntry));
 
-    /* We might have, Ex. 't1_idvalu', we just want 'idvalu' from that */
-    if (parentId[2] == '_')
-        strcpy(pid, parentId + 3);
-    else
-        strcpy(pid, parentId);
-
-    stack[0] = base;
-    top = 0;
-    /* Keep looping and decrementing our stack index until it's under zero */
-    for(; top >= 0; top--) {
-
-        /* Grab the RedditComment on the top of the stack */
-        current = stack[top];
-
-        /* If it's the right one, jump to the cleanup code */
-        if (strcmp(pid, current->id) == 0)
-            goto cleanup;
-
-        /* If it's not and it has some replies to it, add all the replies to
-         * the stack and keep going */
-        if (current->replyCount > 0) {
-            if (top + current->replyCount >= stackSize) {
-                stackSize += current->replyCount;
-                stack = realloc(stack, sizeof(RedditComment*) * stackSize);
-            }
-            /* Copy the contents of the replies array right onto the stack. */
-            memcpy(stack + top, current->replies, current->replyCount * sizeof(RedditComment*));
-            top += current->replyCount;
+    for (i = 0; i < oldSize; i++)
+        if (old[i].comment != NULL)
+            *redditCommentIndexSlot(index, old[i].comment->id, old[i].hash) = old[i];
+
+    free(old);
+}
+
+/*
+ * Finds the comment with the id or fullname 'id' in 'index', or NULL if it
+ * isn't there
+ */
+static RedditComment *redditCommentIndexFind (RedditCommentIndex *index, const char *id)
+{
+    if (index == NULL || index->count == 0 || id == NULL)
+        return NULL;
+
+    id = redditCommentStripType(id);
+    return redditCommentIndexSlot(index, id, redditCommentIdHash(id))->comment;
+}
+
+/*
+ * Adds 'comment' along with all of it's replies to 'index'. A comment with
+ * the same id as one already in there is skipped.
+ */
+static void redditCommentIndexAdd (RedditCommentIndex *index, RedditComment *comment)
+{
+    RedditCommentIndexEntry *entry;
+    unsigned int hash;
+    int i;
+
+    if (comment->id != NULL) {
+        if ((index->count + 1) * 2 > index->size)
+            redditCommentIndexGrow(index);
+
+        hash = redditCommentIdHash(comment->id);
+        entry = redditCommentIndexSlot(index, comment->id, hash);
+        if (entry->comment == NULL) {
+            entry->hash = hash;
+            entry->comment = comment;
+            index->count++;
         }
     }
 
-    current = NULL;
+    for (i = 0; i < comment->replyCount; i++)
+        redditCommentIndexAdd(index, comment->replies[i]);
+}
+
+static void redditCommentIndexFree (RedditCommentIndex *index)
+{
+    if (index == NULL)
+        return ;
 
-cleanup:;
-    free(stack);
-    return current;
+    free(index->entries);
+    free(index);
+}
+
+/*
+ * Returns the index of 'list', making it out of every comment in the list if
+ * there isn't one yet
+ */
+static RedditCommentIndex *redditCommentListIndex (RedditCommentList *list)
+{
+    if (list->index == NULL) {
+        list->index = rmalloc(sizeof(RedditCommentIndex));
+        memset(list->index, 0, sizeof(RedditCommentIndex));
+        redditCommentIndexAdd(list->index, list->baseComment);
+    }
+
+    return list->index;
 }
 
 /*
@@ -157,9 +329,53 @@ EXPORT_SYMBOL void redditCommentListFree (RedditCommentList *list)
     redditLinkFree(list->post);
     free(list->permalink);
     free(list->id);
+    memoryBlockFreeChain(list->responses);
+    redditArenaFree(list->arena);
+    redditCommentIndexFree(list->index);
     free(list);
 }
 
+/*
+ * Gets 'list' ready to have comments added to it, creating it's arena if it's
+ * using one and the base comment if there isn't one yet
+ */
+static void redditCommentListSetup (RedditCommentList *list)
+{
+    if (list->useArena && list->arena == NULL)
+        list->arena = redditArenaNew();
+
+    if (list->baseComment == NULL) {
+        list->baseComment = redditCommentNewIn(list->arena);
+        if (list->zeroCopy)
+            list->baseComment->flags |= REDDIT_COMMENT_STRING_VIEWS;
+    }
+}
+
+/*
+ * Runs 'ids' over the tokens in 'parser', with 'list' and 'data' as the
+ * arguments ('data' is the comment being parsed into, or the
+ * RedditCommentExpand for a 'morechildren' response). The parser is set up
+ * to allocate out of the list's arena and point into the JSON text, if the
+ * list wants it to.
+ *
+ * For a 'zeroCopy' list the JSON text is taken from the parser afterwards,
+ * since the comments point into it.
+ */
+static void redditCommentListParse (TokenParser *parser, RedditCommentList *list, TokenIdent *ids, void *data)
+{
+    redditCommentListSetup(list);
+
+    parser->stringViews = list->zeroCopy;
+    parser->arena = list->arena;
+    parseTokens(parser, ids, list, data);
+
+    if (list->zeroCopy) {
+        MemoryBlock *block = tokenParserTakeBlock(parser);
+        block->next = list->responses;
+        list->responses = block;
+    }
+}
+
 /* Simple macro which expands to to the definitions of the varidic arguments
  * set to parseTokens */
 #define ARG_COMMENT_LISTING \
@@ -173,11 +389,12 @@ static void redditCommentAddMore (TokenParser *parser, RedditComment *parent)
     redditCommentFreeChildren(parent);
 
     parent->directChildrenCount = parser->tokens[parser->currentToken].full_size;
-    parent->directChildrenIds = rmalloc(parent->directChildrenCount * sizeof(char*));
+    parent->directChildrenIds = redditArenaAlloc(parent->arena, parent->directChildrenCount * sizeof(char*));
 
     for (i = 0; i < parent->directChildrenCount; i++) {
         parser->currentToken++;
-        parent->directChildrenIds[i] = getCopyOfToken(parser->block->memory, parser->tokens[parser->currentToken]);
+        parent->directChildrenIds[i] = redditArenaCopy(parent->arena, parser->block->memory + parser->tokens[parser->currentToken].start,
+                                                       parser->tokens[parser->currentToken].end - parser->tokens[parser->currentToken].start);
     }
 }
 
@@ -198,25 +415,29 @@ DEF_TOKEN_CALLBACK(getCommentRepliesMore)
     redditCommentAddMore(parser, comment);
 }
 
+/*
+ * Maps the members of a RedditComment to the keys of a 'more' object, which
+ * is a list of replies to it that weren't sent, See TOKEN_SCHEMA
+ */
+#define MORE_FIELDS(X, type)                                                \
+    X(type, INT,     "count",    totalReplyCount)                           \
+    X(type, STRVIEW, "id",       childrenId)                                \
+    X(type, FUNC,    "children", getCommentRepliesMore)
+
+TOKEN_SCHEMA(moreSchema, RedditComment, MORE_FIELDS);
+
 /*
  * This callback is sort of a 'dispatch' which simply delegates what to do to the relevant functions
  *
  * In the event of a 't3' datatype, we have a RedditLink and call redditGetLink to parse it
- * A 't1' is a comment, so we use redditGetComment, and then redditCommentAddReply
+ * A 't1' is a comment, so we use redditGetComment, and then redditCommentAttachReply
+ * (The totalReplyCount's are all worked out at the end, See redditCommentCountReplies)
  * A 'more' type means that it's list of comment 'stubs' for a morechildren API call.
  */
 DEF_TOKEN_CALLBACK(getCommentListHelper)
 {
     ARG_COMMENT_LISTING
     RedditComment *reply = NULL;
-
-    TokenIdent more_ids[] = {
-        ADD_TOKEN_IDENT_INT   ("count",    comment->totalReplyCount),
-        ADD_TOKEN_IDENT_STRING("id",       comment->childrenId),
-        ADD_TOKEN_IDENT_FUNC  ("children", getCommentRepliesMore),
-        {0}
-    };
-
     int i;
     for (i = 0; idents[i].name != NULL; i++) {
         if (strcmp(idents[i].name, "kind") == 0) {
@@ -230,9 +451,9 @@ DEF_TOKEN_CALLBACK(getCommentListHelper)
                     /* A reply to 'comment' -- Send the 'data' field along to be parsed
                      * and add the result as a reply to the current comment */
                     reply = redditGetComment(parser, list);
-                    redditCommentAddReply(comment, reply);
+                    redditCommentAttachReply(comment, reply);
                 } else if (strcmp(*((char**)idents[i].value), "more") == 0) {
-                    parseTokens(parser, more_ids, list, comment);
+                    parseTokensSchema(parser, &moreSchema, comment, list, comment);
                 }
             } else {
                 break;
@@ -252,8 +473,9 @@ DEF_TOKEN_CALLBACK(getCommentReplies)
     char *kindStr = NULL;
 
     TokenIdent ids[] = {
-        ADD_TOKEN_IDENT_STRING("kind", kindStr),
-        ADD_TOKEN_IDENT_FUNC  ("data", getCommentListHelper),
+        ADD_TOKEN_IDENT_STRING ("kind", kindStr),
+        ADD_TOKEN_IDENT_FUNC   ("data", getCommentListHelper),
+        ADD_TOKEN_IDENT_DESCEND("children"),
         {0}
     };
 
@@ -262,39 +484,210 @@ DEF_TOKEN_CALLBACK(getCommentReplies)
 }
 
 /*
- * This code parses a JSON object to pull out a RedditComment. The 'getCommentReplies'
- * callback makes this all work, as it handles the case where 'replies' contains a
- * number of more RedditComment structures. That callback calls redditGetComment on
- * those objects in a recursive fashion to parse them.
- *
- * Beyond that, the list of TokenIdent's is fairly self-explainatory, it simply maps
- * the variables of a RedditComment to it's key in the JSON.
+ * Maps the members of a RedditComment to their key strings, See TOKEN_SCHEMA.
+ * The 'getCommentReplies' callback makes this all work, as it handles the case
+ * where 'replies' contains a number of more RedditComment structures. That
+ * callback calls redditGetComment on those objects in a recursive fashion to
+ * parse them.
+ */
+#define COMMENT_FIELDS(X, type)                                             \
+    X(type, FUNC,    "replies",       getCommentReplies)                    \
+    X(type, STRVIEW, "author",        author)                               \
+    X(type, STRVIEW, "body",          body)                                 \
+    X(type, STRVIEW, "contentText",   body)                                 \
+    X(type, STRVIEW, "id",            id)                                   \
+    X(type, STRVIEW, "link_id",       linkId)                               \
+    X(type, STRVIEW, "parent_id",     parentId)                             \
+    X(type, INT,     "ups",           ups)                                  \
+    X(type, INT,     "downs",         downs)                                \
+    X(type, INT,     "num_reports",   numReports)                           \
+    X(type, BOOL,    "edited",        flags, REDDIT_COMMENT_EDITED)         \
+    X(type, BOOL,    "score_hidden",  flags, REDDIT_COMMENT_SCORE_HIDDEN)   \
+    X(type, BOOL,    "distinguished", flags, REDDIT_COMMENT_DISTINGUISHED)  \
+    X(type, DATE,    "created_utc",   created_utc)
+
+TOKEN_SCHEMA(commentSchema, RedditComment, COMMENT_FIELDS);
+
+/*
+ * This code parses a JSON object to pull out a RedditComment, using
+ * commentSchema.
  */
 RedditComment *redditGetComment(TokenParser *parser, RedditCommentList *list)
 {
-    RedditComment *comment = redditCommentNew();
+    RedditComment *comment = redditCommentNewIn(parser->arena);
+
+    if (parser->stringViews)
+        comment->flags |= REDDIT_COMMENT_STRING_VIEWS;
+
+    parseTokensSchema(parser, &commentSchema, comment, list, comment);
+
+    return comment;
+}
+
+/*
+ * Parses the 'data' of one 't1' at the top of a thread, along with all of it's
+ * replies, See tokenParseObjects
+ */
+static void *getCommentListComment (TokenParser *parser, void *data)
+{
+    return redditGetComment(parser, data);
+}
+
+/*
+ * Called on the 'children' arrays at the top of a thread, which hold the post
+ * and the top-level comments. The 't1' comments are parsed first (On more
+ * then one thread if the list asks for it), and then everything is handled in
+ * order the same way getCommentListHelper does it.
+ */
+DEF_TOKEN_CALLBACK(getCommentListChildren)
+{
+    ARG_COMMENT_LISTING
+    int count = parser->tokens[parser->currentToken].size;
+    int replyCount = 0, end, i;
+    TokenThing *things;
+    int *objects;
+    void **replies;
+
+    if (count == 0)
+        return ;
+
+    things = rmalloc(count * sizeof(TokenThing));
+    objects = rmalloc(count * sizeof(int));
+    replies = rmalloc(count * sizeof(void*));
+
+    count = tokenFindThings(parser, things);
+    end = parser->currentToken;
+
+    for (i = 0; i < count; i++)
+        if (things[i].kind != -1 && things[i].data != -1 && tokenEquals(parser, things[i].kind, "t1"))
+            objects[replyCount++] = things[i].data;
+
+    tokenParseObjects(parser, replyCount, objects, list->parseThreads, getCommentListComment, list, replies);
+
+    replyCount = 0;
+    for (i = 0; i < count; i++) {
+        if (things[i].kind == -1 || things[i].data == -1)
+            continue;
+
+        parser->currentToken = things[i].data;
+        if (tokenEquals(parser, things[i].kind, "t3")) {
+            redditLinkFree(list->post);
+            list->post = redditGetLink(parser);
+        } else if (tokenEquals(parser, things[i].kind, "t1")) {
+            redditCommentAttachReply(comment, replies[replyCount++]);
+        } else if (tokenEquals(parser, things[i].kind, "more")) {
+            parseTokensSchema(parser, &moreSchema, comment, list, comment);
+        }
+    }
+
+    parser->currentToken = end;
+
+    free(replies);
+    free(objects);
+    free(things);
+}
+
+/*
+ * Creates the request for the comments on the link at 'list->permalink'
+ */
+static RedditRequest *redditCommentListRequest (RedditCommentList *list)
+{
+    char fullLink[2048];
+
+    strcpy(fullLink, REDDIT_URL);
+    strcat(fullLink, list->permalink);
+    strcat(fullLink, REDDIT_JSON);
+
+    return redditRequestNew(fullLink, NULL);
+}
+
+/*
+ * Parses the tokens of a comment listing into 'list'
+ */
+void redditParseCommentList (TokenParser *parser, RedditCommentList *list)
+{
+    char *kindStr = NULL;
 
     TokenIdent ids[] = {
-        ADD_TOKEN_IDENT_FUNC    ("replies",       getCommentReplies),
-        ADD_TOKEN_IDENT_STRING  ("author",        comment->author),
-        ADD_TOKEN_IDENT_STRPARSE("body",          comment->body, comment->bodyEsc, comment->wbodyEsc),
-        ADD_TOKEN_IDENT_STRPARSE("contentText",   comment->body, comment->bodyEsc, comment->wbodyEsc),
-        ADD_TOKEN_IDENT_STRING  ("id",            comment->id),
-        ADD_TOKEN_IDENT_STRING  ("link_id",       comment->linkId),
-        ADD_TOKEN_IDENT_STRING  ("parent_id",     comment->parentId),
-        ADD_TOKEN_IDENT_INT     ("ups",           comment->ups),
-        ADD_TOKEN_IDENT_INT     ("downs",         comment->downs),
-        ADD_TOKEN_IDENT_INT     ("num_reports",   comment->numReports),
-        ADD_TOKEN_IDENT_BOOL    ("edited",        comment->flags, REDDIT_COMMENT_EDITED),
-        ADD_TOKEN_IDENT_BOOL    ("score_hidden",  comment->flags, REDDIT_COMMENT_SCORE_HIDDEN),
-        ADD_TOKEN_IDENT_BOOL    ("distinguished", comment->flags, REDDIT_COMMENT_DISTINGUISHED),
-        ADD_TOKEN_IDENT_DATE    ("created_utc",   comment->created_utc),
+        ADD_TOKEN_IDENT_STRING ("id",       list->id),
+        ADD_TOKEN_IDENT_STRING ("kind",     kindStr),
+        ADD_TOKEN_IDENT_FUNC   ("data",     getCommentListHelper),
+        ADD_TOKEN_IDENT_FUNC   ("children", getCommentListChildren),
         {0}
     };
 
-    parseTokens(parser, ids, list, comment);
+    redditCommentListSetup(list);
+    redditCommentListParse(parser, list, ids, list->baseComment);
+    redditCommentCountReplies(list->baseComment);
 
-    return comment;
+    /* The comments that were just added aren't in the index, so it's made
+     * over the next time it's needed */
+    redditCommentIndexFree(list->index);
+    list->index = NULL;
+
+    free(kindStr);
+}
+
+/*
+ * Parses the comments in 'block' (Which is freed, or kept by 'list' if it's
+ * 'zeroCopy') into 'list'. A NULL 'block' means the text couldn't be read.
+ */
+static RedditErrno redditParseCommentListBlock (RedditCommentList *list, MemoryBlock *block)
+{
+    RedditErrno err = REDDIT_ERROR_RESPONSE;
+    TokenParser *parser;
+
+    if (block == NULL)
+        return REDDIT_ERROR;
+
+    parser = tokenParserNewFromBlock(block);
+    if (parser->jsmnResult == JSMN_SUCCESS) {
+        redditParseCommentList(parser, list);
+        err = REDDIT_SUCCESS;
+    }
+
+    tokenParserFree(parser);
+    return err;
+}
+
+/*
+ * Parses the comments of a thread that's already been downloaded (What
+ * '/comments/<id>.json' returns), instead of asking Reddit for them. 'json'
+ * is copied, so it doesn't have to stay around.
+ */
+EXPORT_SYMBOL RedditErrno redditParseCommentListBuffer (RedditCommentList *list, const char *json, size_t len)
+{
+    MemoryBlock *block = memoryBlockNew();
+
+    memoryBlockAppend(block, json, len);
+    return redditParseCommentListBlock(list, block);
+}
+
+/*
+ * Same as redditParseCommentListBuffer, but for a thread saved in the file at
+ * 'path'. The file is mapped into memory instead of being read, so nothing is
+ * copied. Returns REDDIT_ERROR if the file can't be opened.
+ */
+EXPORT_SYMBOL RedditErrno redditParseCommentListFile (RedditCommentList *list, const char *path)
+{
+    return redditParseCommentListBlock(list, memoryBlockMapFile(path));
+}
+
+/*
+ * Handler for redditGetCommentListAsync
+ */
+static void getCommentListDone (RedditRequest *request, TokenParserResult res)
+{
+    RedditCommentList *list = request->object;
+    RedditErrno err = REDDIT_ERROR_RESPONSE;
+
+    if (res == TOKEN_PARSER_SUCCESS) {
+        redditParseCommentList(request->parser, list);
+        err = REDDIT_SUCCESS;
+    }
+
+    if (request->callback != NULL)
+        ((RedditCommentListCallback)request->callback)(list, err, request->data);
 }
 
 /*
@@ -306,26 +699,16 @@ RedditComment *redditGetComment(TokenParser *parser, RedditCommentList *list)
  */
 EXPORT_SYMBOL RedditErrno redditGetCommentList (RedditCommentList *list)
 {
-    char fullLink[2048], *kindStr = NULL;
+    RedditRequest *request = redditCommentListRequest(list);
     TokenParserResult res;
 
-    TokenIdent ids[] = {
-        ADD_TOKEN_IDENT_STRING("id",   list->id),
-        ADD_TOKEN_IDENT_STRING("kind", kindStr),
-        ADD_TOKEN_IDENT_FUNC  ("data", getCommentListHelper),
-        {0}
-    };
-
-    strcpy(fullLink, REDDIT_URL);
-    strcat(fullLink, list->permalink);
-    strcat(fullLink, REDDIT_JSON);
+    redditCommentListSetup(list);
 
-    if (list->baseComment == NULL)
-        list->baseComment = redditCommentNew();
-
-    res = redditRunParser(fullLink, NULL, ids, list, list->baseComment);
+    res = redditRequestWait(request);
+    if (res == TOKEN_PARSER_SUCCESS)
+        redditParseCommentList(request->parser, list);
 
-    free(kindStr);
+    redditRequestFree(request);
 
     if (res == TOKEN_PARSER_SUCCESS)
         return REDDIT_SUCCESS;
@@ -333,34 +716,346 @@ EXPORT_SYMBOL RedditErrno redditGetCommentList (RedditCommentList *list)
         return REDDIT_ERROR_RESPONSE;
 }
 
+/*
+ * Same as redditGetCommentList, but returns right away. 'callback' is called
+ * with 'data' once the comments have been stored in 'list'.
+ *
+ * 'list' has to stay valid until the callback is called.
+ */
+EXPORT_SYMBOL RedditRequest *redditGetCommentListAsync (RedditCommentList *list, RedditCommentListCallback callback, void *data)
+{
+    RedditRequest *request = redditCommentListRequest(list);
+
+    redditCommentListSetup(list);
+
+    request->handler  = getCommentListDone;
+    request->object   = list;
+    request->callback = (RedditRequestCallback)callback;
+    request->data     = data;
+
+    redditRequestSubmit(request);
+
+    return request;
+}
+
 /* Small structure for holding data on a 'more' object from the morechildren call */
 struct MoreChildren {
     char *parent;
     int  count;
 };
 
-DEF_TOKEN_CALLBACK(readMore)
+/*
+ * A request made by redditGetAllCommentChildren, for the 'count' ids in it's
+ * RedditCommentExpand starting at 'first'
+ */
+typedef struct RedditCommentExpandRequest {
+    RedditRequest *request;
+    int first;
+    int count;
+} RedditCommentExpandRequest;
+
+/*
+ * The state of a redditGetAllCommentChildren call. 'ids' is every hidden
+ * comment that's been found so far, the ones before 'next' have already been
+ * asked for. 'parentIds' has the fullname of the comment each one was taken
+ * from, so they can be put back if the request for them fails. 'requests'
+ * holds the 'running' requests that haven't come back yet.
+ *
+ * 'orphans' are replies that came back before their parent did. Since the
+ * ids of a 'more' can be spread over a few requests that all run at once, a
+ * reply can easily show up before the one it's a reply to, so it's held onto
+ * until it's parent comes in.
+ */
+typedef struct RedditCommentExpand {
+    RedditCommentList *list;
+
+    char **ids;
+    char **parentIds;
+    int idCount;
+    int idAlloc;
+    int next;
+
+    RedditComment **orphans;
+    int orphanCount;
+    int orphanAlloc;
+
+    RedditCommentExpandRequest *requests;
+    int running;
+    RedditErrno err;
+} RedditCommentExpand;
+
+/*
+ * Takes the first 'count' ids off of the hidden replies of 'comment'
+ */
+static void redditCommentTakeChildren (RedditComment *comment, int count)
+{
+    int i;
+
+    if (count >= comment->directChildrenCount) {
+        redditCommentFreeChildren(comment);
+        comment->directChildrenCount = 0;
+        return ;
+    }
+
+    if (comment->arena == NULL)
+        for (i = 0; i < count; i++)
+            free(comment->directChildrenIds[i]);
+
+    comment->directChildrenCount -= count;
+    memmove(comment->directChildrenIds, comment->directChildrenIds + count, comment->directChildrenCount * sizeof(char*));
+}
+
+/*
+ * Makes the POST text for a 'morechildren' call asking for 'count' of 'ids',
+ * which are comments on the link 'linkId'
+ */
+static char *redditMoreChildrenPost (const char *linkId, char **ids, int count)
 {
-    RedditComment *base        = va_arg(args, RedditComment*);
-    struct MoreChildren *child = va_arg(args, struct MoreChildren*);
+    size_t len = strlen("api_type=json&link_id=t3_&children=") + strlen(linkId) + 1;
+    char *post, *end;
+    int i;
+
+    for (i = 0; i < count; i++)
+        len += strlen(ids[i]) + 1;
+
+    post = rmalloc(len);
+    end = post + sprintf(post, "api_type=json&link_id=t3_%s&children=", linkId);
+
+    for (i = 0; i < count; i++)
+        end += sprintf(end, (i == 0) ? "%s" : ",%s", ids[i]);
+
+    return post;
+}
+
+/*
+ * Makes room in 'expand' for 'count' more ids
+ */
+static void redditCommentExpandReserve (RedditCommentExpand *expand, int count)
+{
+    if (expand->idCount + count <= expand->idAlloc)
+        return ;
+
+    expand->idAlloc = (expand->idCount + count) * 2;
+    expand->ids = rrealloc(expand->ids, expand->idAlloc * sizeof(char*));
+    expand->parentIds = rrealloc(expand->parentIds, expand->idAlloc * sizeof(char*));
+}
+
+/*
+ * Moves the hidden replies of 'comment' onto the list of ids 'expand' still
+ * has to ask for. Since it's count will be worked out again once they're
+ * all in, the count it got from it's 'more' object is dropped too.
+ */
+static void redditCommentExpandAdd (RedditCommentExpand *expand, RedditComment *comment)
+{
+    char parentId[256];
+    int i;
+
+    if (comment->directChildrenCount == 0)
+        return ;
+
+    if (comment == expand->list->baseComment)
+        snprintf(parentId, sizeof(parentId), "t3_%s", expand->list->post->id);
+    else
+        snprintf(parentId, sizeof(parentId), "t1_%s", comment->id);
+
+    redditCommentExpandReserve(expand, comment->directChildrenCount);
+
+    for (i = 0; i < comment->directChildrenCount; i++) {
+        expand->ids[expand->idCount] = redditCopyString(comment->directChildrenIds[i]);
+        expand->parentIds[expand->idCount] = redditCopyString(parentId);
+        expand->idCount++;
+    }
+
+    redditCommentTakeChildren(comment, comment->directChildrenCount);
+
+    if (!(comment->flags & REDDIT_COMMENT_STRING_VIEWS) && comment->arena == NULL)
+        free(comment->childrenId);
+    comment->childrenId = NULL;
+}
+
+/*
+ * Adds the hidden replies of 'comment' and everything under it to 'expand'
+ */
+static void redditCommentExpandCollect (RedditCommentExpand *expand, RedditComment *comment)
+{
+    int i;
+
+    redditCommentExpandAdd(expand, comment);
+
+    for (i = 0; i < comment->replyCount; i++)
+        redditCommentExpandCollect(expand, comment->replies[i]);
+}
+
+/*
+ * Finds the comment with the fullname 'parentId' in 'list'. A 't3_' is the
+ * link itself, which the top-level comments are replies to.
+ */
+static RedditComment *redditCommentListFindParent (RedditCommentList *list, const char *parentId)
+{
+    if (parentId != NULL && strncmp(parentId, "t3_", 3) == 0)
+        return list->baseComment;
+
+    return redditCommentIndexFind(redditCommentListIndex(list), parentId);
+}
+
+/*
+ * Adds 'comment', which came back from 'morechildren', as a reply to 'parent'
+ */
+static void redditCommentListAttach (RedditCommentList *list, RedditComment *parent, RedditComment *comment, RedditCommentExpand *expand)
+{
+    redditCommentCountReplies(comment);
+    redditCommentAddReply(parent, comment);
+    redditCommentIndexAdd(redditCommentListIndex(list), comment);
+
+    if (expand != NULL)
+        redditCommentExpandCollect(expand, comment);
+}
+
+/*
+ * Holds onto 'comment' until it's parent comes in, See RedditCommentExpand
+ */
+static void redditCommentExpandPark (RedditCommentExpand *expand, RedditComment *comment)
+{
+    if (expand->orphanCount == expand->orphanAlloc) {
+        expand->orphanAlloc = expand->orphanAlloc * 2 + 16;
+        expand->orphans = rrealloc(expand->orphans, expand->orphanAlloc * sizeof(RedditComment*));
+    }
+
+    expand->orphans[expand->orphanCount++] = comment;
+}
+
+/*
+ * Adds every orphan who's parent is in the list now. An orphan that's added
+ * can be the parent of another one, so it keeps going until a pass over them
+ * doesn't add anything. The ones left over keep their order.
+ */
+static void redditCommentExpandAdopt (RedditCommentExpand *expand)
+{
+    RedditComment *orphan, *parent;
+    int i, kept, added;
+
+    do {
+        added = 0;
+        kept = 0;
 
+        for (i = 0; i < expand->orphanCount; i++) {
+            orphan = expand->orphans[i];
 
-    RedditComment *parent = redditCommentFindParent(base, child->parent);
+            if (redditCommentIndexFind(redditCommentListIndex(expand->list), orphan->id) != NULL) {
+                redditCommentFree(orphan);
+                continue;
+            }
+
+            parent = redditCommentListFindParent(expand->list, orphan->parentId);
+            if (parent == NULL) {
+                expand->orphans[kept++] = orphan;
+                continue;
+            }
+
+            redditCommentListAttach(expand->list, parent, orphan, expand);
+            added = 1;
+        }
+
+        expand->orphanCount = kept;
+    } while (added && expand->orphanCount > 0);
+}
+
+/*
+ * Finds the comment with the fullname 'parentId' in the list, or among the
+ * orphans of 'expand'
+ */
+static RedditComment *redditCommentExpandFindParent (RedditCommentExpand *expand, const char *parentId)
+{
+    RedditComment *parent = redditCommentListFindParent(expand->list, parentId);
+    int i;
+
+    if (parent != NULL || parentId == NULL || strncmp(parentId, "t1_", 3) != 0)
+        return parent;
+
+    for (i = 0; i < expand->orphanCount; i++)
+        if (strcmp(expand->orphans[i]->id, parentId + 3) == 0)
+            return expand->orphans[i];
+
+    return NULL;
+}
 
-    if (parent == NULL) {
+/*
+ * Adds the ids in the 'children' array the parser is on straight onto the
+ * ids 'expand' still has to ask for, as hidden replies of 'parentId'
+ */
+static void redditCommentExpandAddTokens (RedditCommentExpand *expand, TokenParser *parser, const char *parentId)
+{
+    int count = parser->tokens[parser->currentToken].full_size;
+    jsmntok_t *token;
+    int i;
+
+    redditCommentExpandReserve(expand, count);
+
+    for (i = 0; i < count; i++) {
+        parser->currentToken++;
+        token = parser->tokens + parser->currentToken;
+
+        expand->ids[expand->idCount] = redditArenaCopy(NULL, parser->block->memory + token->start, token->end - token->start);
+        expand->parentIds[expand->idCount] = redditCopyString(parentId);
+        expand->idCount++;
+    }
+}
+
+/*
+ * Called on the 'children' of a 'more' object in a 'morechildren' response,
+ * which are more hidden replies to the comment with the id 'parent_id'. When
+ * it's part of a redditGetAllCommentChildren, they're asked for too, even if
+ * the parent isn't in the list yet.
+ */
+DEF_TOKEN_CALLBACK(readMore)
+{
+    RedditCommentList *list         = va_arg(args, RedditCommentList*);
+    struct MoreChildren *child      = va_arg(args, struct MoreChildren*);
+    RedditCommentExpand *expand     = va_arg(args, RedditCommentExpand*);
+
+    RedditComment *parent = redditCommentListFindParent(list, child->parent);
+
+    if (parent == NULL && expand != NULL && child->parent != NULL) {
+        /* The parent hasn't been added yet. If it's parked the ids go on it,
+         * and are asked for when it's adopted. Otherwise it's still to come,
+         * so they're asked for now and their replies wait for it. */
+        parent = redditCommentExpandFindParent(expand, child->parent);
+
+        if (parent != NULL) {
+            redditCommentAddMore(parser, parent);
+            parent->totalReplyCount = child->count;
+        } else {
+            redditCommentExpandAddTokens(expand, parser, child->parent);
+        }
+    } else if (parent == NULL) {
         /* If we didn't find parent, we just advance past the array */
         parser->currentToken += parser->tokens[parser->currentToken].full_size;
     } else {
         redditCommentAddMore(parser, parent);
         parent->totalReplyCount = child->count;
+
+        if (expand != NULL)
+            redditCommentExpandAdd(expand, parent);
     }
 
 }
 
 #define ARG_MORECHILDREN \
     RedditCommentList *list = va_arg(args, RedditCommentList*); \
-    RedditComment *parent = va_arg(args, RedditComment*);
+    RedditCommentExpand *expand = va_arg(args, RedditCommentExpand*);
 
+/*
+ * Handles one of the things sent back by 'morechildren'. A comment is added
+ * as a reply to the comment who's id is it's 'parent_id', which is looked up
+ * in the list's index (Or to the 'baseComment', if it's a top-level one). A
+ * comment that's already in the list is dropped. So is one who's parent
+ * isn't, unless it's part of a redditGetAllCommentChildren, in which case
+ * it's parked until the parent comes in.
+ *
+ * The index is always gotten through redditCommentListIndex, since the list
+ * could have been parsed again (Which throws it out) while the request was
+ * running.
+ */
 DEF_TOKEN_CALLBACK(readChild)
 {
     ARG_MORECHILDREN
@@ -377,16 +1072,19 @@ DEF_TOKEN_CALLBACK(readChild)
 
     /* Note: Requires 'kind' to be the first key in the ids array */
     if (strcmp(*((char**)idents[0].value), "more") == 0) {
-        parseTokens(parser, ids, parent, &child);
+        parseTokens(parser, ids, list, &child, expand);
         free(child.parent);
     } else {
         comment = redditGetComment(parser, list);
 
-        foundParent = redditCommentFindParent(parent, comment->parentId);
-        if (foundParent == NULL)
-            free(foundParent);
+        if (comment->id == NULL || redditCommentIndexFind(redditCommentListIndex(list), comment->id) != NULL)
+            redditCommentFree(comment);
+        else if ((foundParent = redditCommentListFindParent(list, comment->parentId)) != NULL)
+            redditCommentListAttach(list, foundParent, comment, expand);
+        else if (expand != NULL)
+            redditCommentExpandPark(expand, comment);
         else
-            redditCommentAddReply(foundParent, comment);
+            redditCommentFree(comment);
     }
 }
 
@@ -408,7 +1106,7 @@ DEF_TOKEN_CALLBACK(getMoreChildren)
     parser->currentToken++;
     for (; i < arry_size; i++) {
         int nextObj = parser->currentToken + parser->tokens[parser->currentToken].full_size + 1;
-        parseTokens(parser, ids, list, parent);
+        parseTokens(parser, ids, list, expand);
         free(kind);
         kind = NULL;
         parser->currentToken = nextObj;
@@ -416,56 +1114,391 @@ DEF_TOKEN_CALLBACK(getMoreChildren)
 }
 
 /*
- * This function makes a 'morechildren' API call and retrieves all the
- * children assosiated with 'parent'
- *
- * FIXME: Doesn't yet work correctly, it needs separate callbacks, the format
- * is slightly different then the getCommentListHelper callback is expecting.
+ * Parses a 'morechildren' response into 'list', See redditCommentListParse
  */
-EXPORT_SYMBOL RedditErrno redditGetCommentChildren (RedditCommentList *list, RedditComment *parent)
+static void redditMoreChildrenParse (TokenParser *parser, RedditCommentList *list, RedditCommentExpand *expand)
 {
-    TokenParserResult res;
-    char postText[4096];
-    int i, endCount, children;
-    int preCheck;
-
     TokenIdent ids[] = {
-        ADD_TOKEN_IDENT_FUNC  ("things", getMoreChildren),
+        ADD_TOKEN_IDENT_FUNC   ("things", getMoreChildren),
+        ADD_TOKEN_IDENT_DESCEND("json"),
+        ADD_TOKEN_IDENT_DESCEND("data"),
         {0}
     };
 
-    sprintf(postText, "api_type=json&link_id=t3_%s&children=", list->post->id);
-    if (parent->directChildrenCount > 20)
-        children = 20;
-    else
-        children = parent->directChildrenCount;
+    redditCommentListParse(parser, list, ids, expand);
+}
 
-    if (children == 0)
-        return REDDIT_ERROR;
+/*
+ * A 'morechildren' request for some of the hidden replies of 'parent'. 'ids'
+ * holds copies of the 'idCount' ids it asked for, which were taken off of
+ * 'parent' when the request was made. If the request doesn't get them, they
+ * go back on 'parent' so they can be asked for again.
+ */
+typedef struct RedditCommentChildren {
+    RedditCommentList *list;
+    RedditComment *parent;
+
+    char **ids;
+    int idCount;
+} RedditCommentChildren;
 
-    strcat(postText, parent->directChildrenIds[0]);
-    for (i = 1; i < children; i++) {
-        strcat(postText, ",");
-        strcat(postText, parent->directChildrenIds[i]);
+/*
+ * Puts copies of 'count' of 'ids' in front of the hidden replies of 'parent'
+ */
+static void redditCommentRestoreChildren (RedditComment *parent, char **ids, int count)
+{
+    char **newIds;
+    int i;
+
+    newIds = redditArenaAlloc(parent->arena, (count + parent->directChildrenCount) * sizeof(char*));
+
+    for (i = 0; i < count; i++)
+        newIds[i] = redditArenaCopy(parent->arena, ids[i], strlen(ids[i]));
+
+    if (parent->directChildrenIds != NULL) {
+        memcpy(newIds + count, parent->directChildrenIds, parent->directChildrenCount * sizeof(char*));
+        if (parent->arena == NULL)
+            free(parent->directChildrenIds);
     }
 
-    preCheck = parent->totalReplyCount;
+    parent->directChildrenIds = newIds;
+    parent->directChildrenCount += count;
+}
+
+/*
+ * Puts the ids 'children' took back on it's parent, and adds them back onto
+ * the parent's totalReplyCount.
+ */
+static void redditCommentChildrenRestore (RedditCommentChildren *children)
+{
+    redditCommentRestoreChildren(children->parent, children->ids, children->idCount);
+    children->parent->totalReplyCount += children->idCount;
+}
+
+/*
+ * Lets go of the ids 'children' took. If 'restore' is set they're put back
+ * on the parent first, See redditCommentChildrenRestore.
+ */
+static void redditCommentChildrenDrop (RedditCommentChildren *children, bool restore)
+{
+    int i;
+
+    if (children->ids == NULL)
+        return ;
+
+    if (restore)
+        redditCommentChildrenRestore(children);
 
-    res = redditRunParser(REDDIT_API_MORECHILDREN, postText, ids, list, parent);
+    for (i = 0; i < children->idCount; i++)
+        free(children->ids[i]);
+    free(children->ids);
 
-    if (preCheck == parent->totalReplyCount)
-        parent->totalReplyCount -= children;
+    children->ids = NULL;
+    children->idCount = 0;
+}
 
-    endCount = parent->directChildrenCount - children;
-    for (i = parent->directChildrenCount - 1; i >= endCount; i--)
-        free(parent->directChildrenIds[i]);
+/*
+ * Release for the 'morechildren' requests. If the ids are still there the
+ * request never got to them (It was cancelled), so they're put back.
+ */
+static void redditCommentChildrenRelease (RedditRequest *request)
+{
+    RedditCommentChildren *children = request->object;
 
-    parent->directChildrenCount = endCount;
+    redditCommentChildrenDrop(children, true);
+    free(children);
+}
 
-    if (res == TOKEN_PARSER_SUCCESS)
-        return REDDIT_SUCCESS;
+/*
+ * Creates the 'morechildren' request for the first REDDIT_MORECHILDREN_MAX
+ * hidden replies of 'parent', or returns NULL if it doesn't have any.
+ *
+ * The ids are taken off of 'parent' right away, since the response can
+ * replace the rest of them, and so the same ones aren't asked for twice while
+ * the request is running. They're taken off of it's totalReplyCount too,
+ * they're added back as the replies come in (Or it's set by the 'more' that
+ * comes back with the rest of them). The request holds onto a copy of them,
+ * and puts them back if it fails or is cancelled.
+ */
+static RedditRequest *redditCommentChildrenRequest (RedditCommentList *list, RedditComment *parent)
+{
+    RedditCommentChildren *children;
+    RedditRequest *request;
+    char *postText;
+    int count, i;
+
+    if (list->post == NULL || list->post->id == NULL)
+        return NULL;
+
+    if (parent->directChildrenCount > REDDIT_MORECHILDREN_MAX)
+        count = REDDIT_MORECHILDREN_MAX;
     else
+        count = parent->directChildrenCount;
+
+    if (count == 0)
+        return NULL;
+
+    children = rmalloc(sizeof(RedditCommentChildren));
+    children->list = list;
+    children->parent = parent;
+    children->idCount = count;
+    children->ids = rmalloc(count * sizeof(char*));
+
+    for (i = 0; i < count; i++)
+        children->ids[i] = redditCopyString(parent->directChildrenIds[i]);
+
+    postText = redditMoreChildrenPost(list->post->id, parent->directChildrenIds, count);
+    redditCommentTakeChildren(parent, count);
+    parent->totalReplyCount -= count;
+
+    redditCommentListIndex(list);
+
+    request = redditRequestNew(REDDIT_API_MORECHILDREN, postText);
+    request->object  = children;
+    request->release = redditCommentChildrenRelease;
+    free(postText);
+
+    return request;
+}
+
+/*
+ * Parses the response to a 'morechildren' request made by
+ * redditCommentChildrenRequest into it's list, or puts the ids it asked for
+ * back if 'res' says there isn't one.
+ */
+static RedditErrno redditCommentChildrenFinish (RedditRequest *request, TokenParserResult res)
+{
+    RedditCommentChildren *children = request->object;
+
+    if (res != TOKEN_PARSER_SUCCESS) {
+        redditCommentChildrenDrop(children, true);
         return REDDIT_ERROR_RESPONSE;
+    }
+
+    redditCommentChildrenDrop(children, false);
+    redditMoreChildrenParse(request->parser, children->list, NULL);
+    return REDDIT_SUCCESS;
+}
+
+/*
+ * This function makes a 'morechildren' API call and retrieves the first
+ * REDDIT_MORECHILDREN_MAX hidden replies of 'parent'. If it fails, 'parent'
+ * is left with the same hidden replies it had.
+ */
+EXPORT_SYMBOL RedditErrno redditGetCommentChildren (RedditCommentList *list, RedditComment *parent)
+{
+    RedditRequest *request = redditCommentChildrenRequest(list, parent);
+    RedditErrno err;
+
+    if (request == NULL)
+        return REDDIT_ERROR;
+
+    err = redditCommentChildrenFinish(request, redditRequestWait(request));
+
+    redditRequestFree(request);
+
+    return err;
+}
+
+/*
+ * Handler for redditGetCommentChildrenAsync
+ */
+static void getCommentChildrenDone (RedditRequest *request, TokenParserResult res)
+{
+    RedditCommentChildren *children = request->object;
+    RedditErrno err = redditCommentChildrenFinish(request, res);
+
+    if (request->callback != NULL)
+        ((RedditCommentListCallback)request->callback)(children->list, err, request->data);
+}
+
+/*
+ * The same as redditGetCommentChildren, but the request is run in the
+ * background, See redditGetCommentListAsync. The replies are added to 'list'
+ * right before 'callback' is called. Returns NULL if 'parent' doesn't have
+ * any hidden replies, in which case 'callback' is never called.
+ *
+ * If the request fails or is cancelled, the hidden replies it asked for are
+ * put back on 'parent', so 'list' has to outlive the request.
+ */
+EXPORT_SYMBOL RedditRequest *redditGetCommentChildrenAsync (RedditCommentList *list, RedditComment *parent, RedditCommentListCallback callback, void *data)
+{
+    RedditRequest *request = redditCommentChildrenRequest(list, parent);
+
+    if (request == NULL)
+        return NULL;
+
+    request->handler  = getCommentChildrenDone;
+    request->callback = (RedditRequestCallback)callback;
+    request->data     = data;
+
+    redditRequestSubmit(request);
+
+    return request;
+}
+
+/*
+ * Puts the ids asked for by a request that failed back on the comments they
+ * were taken from, so they can still be gotten later. The parents are looked
+ * up again by id, since an orphan can be freed while the request is running.
+ * The ids of a parent that isn't there anymore are dropped.
+ *
+ * The totalReplyCount's aren't touched, since taking the ids didn't change
+ * them, See redditCommentExpandAdd.
+ */
+static void redditCommentExpandRestore (RedditCommentExpand *expand, int first, int count)
+{
+    RedditComment *parent;
+    int i, run;
+
+    for (i = first; i < first + count; i += run) {
+        for (run = 1; i + run < first + count; run++)
+            if (strcmp(expand->parentIds[i], expand->parentIds[i + run]) != 0)
+                break;
+
+        parent = redditCommentExpandFindParent(expand, expand->parentIds[i]);
+        if (parent != NULL)
+            redditCommentRestoreChildren(parent, expand->ids + i, run);
+    }
+}
+
+/*
+ * Handles a finished request made by redditGetAllCommentChildren. Any hidden
+ * replies in the response are added onto the ids still to ask for, and any
+ * orphans who's parent was in it are added to the list. If it failed, the ids
+ * it asked for are put back.
+ */
+static void redditCommentExpandDone (RedditCommentExpand *expand, RedditCommentExpandRequest *req)
+{
+    TokenParserResult res = redditRequestResult(req->request);
+
+    if (res == TOKEN_PARSER_SUCCESS) {
+        redditMoreChildrenParse(req->request->parser, expand->list, expand);
+        redditCommentExpandAdopt(expand);
+    } else {
+        redditCommentExpandRestore(expand, req->first, req->count);
+        expand->err = REDDIT_ERROR_RESPONSE;
+    }
+}
+
+/*
+ * Starts a request for the next REDDIT_MORECHILDREN_MAX ids in 'expand'
+ */
+static void redditCommentExpandSubmit (RedditCommentExpand *expand)
+{
+    RedditRequest *request;
+    char *postText;
+    int count = expand->idCount - expand->next;
+
+    if (count > REDDIT_MORECHILDREN_MAX)
+        count = REDDIT_MORECHILDREN_MAX;
+
+    postText = redditMoreChildrenPost(expand->list->post->id, expand->ids + expand->next, count);
+
+    request = redditRequestNew(REDDIT_API_MORECHILDREN, postText);
+    request->blocking = 1;
+
+    redditRequestSubmit(request);
+    expand->requests[expand->running].request = request;
+    expand->requests[expand->running].first = expand->next;
+    expand->requests[expand->running].count = count;
+    expand->running++;
+    expand->next += count;
+
+    free(postText);
+}
+
+/*
+ * Handles and frees every request in 'expand' that's done. Returns how many
+ * there were.
+ */
+static int redditCommentExpandFinish (RedditCommentExpand *expand)
+{
+    RedditCommentExpandRequest req;
+    int i, finished = 0;
+
+    for (i = 0; i < expand->running; ) {
+        req = expand->requests[i];
+        if (!req.request->done) {
+            i++;
+            continue;
+        }
+
+        expand->requests[i] = expand->requests[--expand->running];
+        redditCommentExpandDone(expand, &req);
+        redditRequestFree(req.request);
+        finished++;
+    }
+
+    return finished;
+}
+
+/*
+ * Gets every hidden comment in 'list', so the whole thread is there at once.
+ *
+ * All the hidden replies in the thread are gathered up and asked for
+ * REDDIT_MORECHILDREN_MAX at a time, with up to 'maxRequests' requests
+ * running at once (REDDIT_MORECHILDREN_REQUESTS if it's zero or less). The
+ * replies that come back go right into the list through it's index, and any
+ * hidden replies they have are asked for as soon as there's room, so the
+ * whole thread takes about as many round trips as it's levels of 'more'.
+ *
+ * Only it's own requests are run in here, like redditRequestWait. Any async
+ * requests that finish in the meantime are left for redditAsyncPerform.
+ *
+ * Once it's done the totalReplyCount's are worked out again from the
+ * comments that are actually there. Returns REDDIT_ERROR_RESPONSE if any of
+ * the requests failed, in which case the replies they asked for are put back
+ * as hidden replies of their comments, so they can be asked for again.
+ */
+EXPORT_SYMBOL RedditErrno redditGetAllCommentChildren (RedditCommentList *list, int maxRequests)
+{
+    RedditCommentExpand expand;
+    int i;
+
+    if (list->baseComment == NULL || list->post == NULL || list->post->id == NULL)
+        return REDDIT_ERROR;
+
+    if (maxRequests <= 0)
+        maxRequests = REDDIT_MORECHILDREN_REQUESTS;
+
+    memset(&expand, 0, sizeof(RedditCommentExpand));
+    expand.list = list;
+    expand.err = REDDIT_SUCCESS;
+    expand.requests = rmalloc(maxRequests * sizeof(RedditCommentExpandRequest));
+
+    redditCommentListIndex(list);
+    redditCommentExpandCollect(&expand, list->baseComment);
+
+    while (expand.next < expand.idCount || expand.running > 0) {
+        while (expand.running < maxRequests && expand.next < expand.idCount)
+            redditCommentExpandSubmit(&expand);
+
+        redditRequestPerform(currentRedditState);
+
+        /* Only wait if nothing finished, which could have given us more to
+         * ask for */
+        if (redditCommentExpandFinish(&expand) == 0 && expand.running > 0)
+            redditRequestPoll(currentRedditState, 1000);
+    }
+
+    free(expand.requests);
+
+    for (i = 0; i < expand.idCount; i++) {
+        free(expand.ids[i]);
+        free(expand.parentIds[i]);
+    }
+    free(expand.ids);
+    free(expand.parentIds);
+
+    /* Anything still parked had a parent that never came back */
+    for (i = 0; i < expand.orphanCount; i++)
+        redditCommentFree(expand.orphans[i]);
+    free(expand.orphans);
+
+    redditCommentCountReplies(list->baseComment);
+
+    return expand.err;
 }
 
 #endif
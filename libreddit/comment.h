@@ -6,6 +6,49 @@
 #include "jsmn.h"
 #include "token.h"
 
+/*
+ * One slot of a RedditCommentIndex. An empty slot has a NULL 'comment'.
+ * 'hash' is kept so most slots that don't match can be skipped without
+ * comparing the ids.
+ */
+typedef struct RedditCommentIndexEntry {
+    unsigned int hash;
+    RedditComment *comment;
+} RedditCommentIndexEntry;
+
+/*
+ * A hash table from the id of a comment (Without the 't1_') to the comment,
+ * for every comment in a RedditCommentList. It's what redditGetCommentChildren
+ * uses to find where each of the comments it gets back goes.
+ *
+ * It's an open-addressed table with 'size' slots (Always a power of two),
+ * 'count' of which are used. It's never more then half full.
+ */
+typedef struct RedditCommentIndex {
+    unsigned int size;
+    unsigned int count;
+    RedditCommentIndexEntry *entries;
+} RedditCommentIndex;
+
+/*
+ * The most hidden comments asked for in one 'morechildren' call, which is
+ * the most Reddit will send back at once
+ */
+#define REDDIT_MORECHILDREN_MAX 100
+
+/*
+ * How many 'morechildren' calls redditGetAllCommentChildren has running at
+ * once, if it isn't told
+ */
+#define REDDIT_MORECHILDREN_REQUESTS 4
+
 RedditComment *redditGetComment(TokenParser *parser, RedditCommentList *list);
 
+/* Adds 'reply' to the replies of 'comment' without updating any
+ * totalReplyCount's, See redditCommentAddReply */
+void redditCommentAttachReply (RedditComment *comment, RedditComment *reply);
+
+/* Parses the tokens of a comment listing into 'list' */
+void redditParseCommentList (TokenParser *parser, RedditCommentList *list);
+
 #endif
@@ -0,0 +1,664 @@
+#ifndef _REDDIT_COMMENTTREE_C_
+#define _REDDIT_COMMENTTREE_C_
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "global.h"
+#include "comment.h"
+#include "arena.h"
+
+/*
+ * The bytes it takes to hold the 'more' ids of 'comment' in a
+ * RedditCommentTree, as one string with a ',' between each of them
+ */
+static size_t redditCommentTreeIdsBytes (RedditComment *comment)
+{
+    size_t bytes = 0;
+    int i;
+
+    for (i = 0; i < comment->directChildrenCount; i++)
+        bytes += strlen(comment->directChildrenIds[i]) + 1;
+
+    return bytes ? bytes : 1;
+}
+
+/*
+ * The bytes it takes to hold the strings of 'comment' in a RedditCommentTree
+ */
+static size_t redditCommentTreeStringBytes (RedditComment *comment)
+{
+    return (comment->id         ? strlen(comment->id)         : 0) + 1
+         + (comment->author     ? strlen(comment->author)     : 0) + 1
+         + (comment->parentId   ? strlen(comment->parentId)   : 0) + 1
+         + (comment->linkId     ? strlen(comment->linkId)     : 0) + 1
+         + (comment->body       ? strlen(comment->body)       : 0) + 1
+         + (comment->childrenId ? strlen(comment->childrenId) : 0) + 1
+         + redditCommentTreeIdsBytes(comment);
+}
+
+/*
+ * Counts the comments under 'comment', and the bytes it takes to hold all of
+ * their strings in a RedditCommentTree
+ */
+static void redditCommentTreeMeasure (RedditComment *comment, int *count, size_t *bytes)
+{
+    int i;
+
+    for (i = 0; i < comment->replyCount; i++) {
+        (*count)++;
+        *bytes += redditCommentTreeStringBytes(comment->replies[i]);
+
+        redditCommentTreeMeasure(comment->replies[i], count, bytes);
+    }
+}
+
+/*
+ * Copies 'str' onto the end of the strings in 'tree', and returns it's offset.
+ * A NULL 'str' is stored as an empty string.
+ */
+static int redditCommentTreeAddString (RedditCommentTree *tree, const char *str)
+{
+    int offset = tree->stringsSize;
+    size_t len = str ? strlen(str) : 0;
+
+    memcpy(tree->strings + offset, str ? str : "", len + 1);
+    tree->stringsSize += len + 1;
+
+    return offset;
+}
+
+/*
+ * Copies the 'more' ids of 'comment' onto the end of the strings in 'tree' as
+ * one string, Ex. "abc,abd,abe", and returns it's offset
+ */
+static int redditCommentTreeAddIds (RedditCommentTree *tree, RedditComment *comment)
+{
+    int offset = tree->stringsSize, i;
+    size_t len;
+
+    tree->strings[offset] = '\0';
+    for (i = 0; i < comment->directChildrenCount; i++) {
+        len = strlen(comment->directChildrenIds[i]);
+
+        memcpy(tree->strings + tree->stringsSize, comment->directChildrenIds[i], len);
+        tree->stringsSize += len;
+        tree->strings[tree->stringsSize++] = (i + 1 < comment->directChildrenCount) ? ',' : '\0';
+    }
+
+    if (comment->directChildrenCount == 0)
+        tree->stringsSize++;
+
+    return offset;
+}
+
+/*
+ * Checks if the 'more' ids at 'offset' in 'tree' are the same as the ones
+ * 'comment' has now
+ */
+static bool redditCommentTreeSameIds (RedditCommentTree *tree, int offset, RedditComment *comment)
+{
+    const char *ids = tree->strings + offset;
+    size_t len;
+    int i;
+
+    for (i = 0; i < comment->directChildrenCount; i++) {
+        len = strlen(comment->directChildrenIds[i]);
+
+        if (strncmp(ids, comment->directChildrenIds[i], len) != 0)
+            return false;
+
+        ids += len;
+        if (*ids != ((i + 1 < comment->directChildrenCount) ? ',' : '\0'))
+            return false;
+        ids++;
+    }
+
+    return comment->directChildrenCount > 0 || *ids == '\0';
+}
+
+/*
+ * Updates the 'more' ids of the comment at 'index' from 'comment', which
+ * changes when they're expanded. The old string is left where it is, and the
+ * new one goes on the end of 'strings', so that's only done if they changed.
+ */
+static void redditCommentTreeUpdateIds (RedditCommentTree *tree, RedditComment *comment, int index)
+{
+    tree->directChildrenCount[index] = comment->directChildrenCount;
+
+    if (redditCommentTreeSameIds(tree, tree->directChildrenIds[index], comment))
+        return ;
+
+    tree->strings = rrealloc(tree->strings, tree->stringsSize + redditCommentTreeIdsBytes(comment));
+    tree->directChildrenIds[index] = redditCommentTreeAddIds(tree, comment);
+}
+
+static void *redditCommentTreeArray (int count, size_t size)
+{
+    return rmalloc((count ? count : 1) * size);
+}
+
+static void redditCommentTreeFill (RedditCommentTree *tree, RedditComment *comment, int parent, int depth);
+
+/*
+ * Adds 'reply' to 'tree' at 'tree->count', followed by every reply under it
+ * in pre-order. 'parent' is the index of the comment it's a reply to.
+ */
+static void redditCommentTreeFillReply (RedditCommentTree *tree, RedditComment *reply, int parent, int depth)
+{
+    int index = tree->count++;
+
+    tree->depth[index]               = depth;
+    tree->parent[index]              = parent;
+    tree->ups[index]                 = reply->ups;
+    tree->downs[index]               = reply->downs;
+    tree->numReports[index]          = reply->numReports;
+    tree->totalReplyCount[index]     = reply->totalReplyCount;
+    tree->directChildrenCount[index] = reply->directChildrenCount;
+    tree->flags[index]               = reply->flags;
+    tree->created_utc[index]         = reply->created_utc;
+    tree->comments[index]            = reply;
+
+    tree->id[index]       = redditCommentTreeAddString(tree, reply->id);
+    tree->author[index]   = redditCommentTreeAddString(tree, reply->author);
+    tree->parentId[index] = redditCommentTreeAddString(tree, reply->parentId);
+    tree->linkId[index]   = redditCommentTreeAddString(tree, reply->linkId);
+    tree->body[index]     = redditCommentTreeAddString(tree, reply->body);
+
+    tree->childrenId[index]        = redditCommentTreeAddString(tree, reply->childrenId);
+    tree->directChildrenIds[index] = redditCommentTreeAddIds(tree, reply);
+
+    redditCommentTreeFill(tree, reply, index, depth + 1);
+    tree->subtreeSize[index] = tree->count - index - 1;
+}
+
+/*
+ * Adds every reply under 'comment' to 'tree' in pre-order, starting at
+ * 'tree->count'. 'parent' is the index of 'comment'.
+ */
+static void redditCommentTreeFill (RedditCommentTree *tree, RedditComment *comment, int parent, int depth)
+{
+    int i;
+
+    for (i = 0; i < comment->replyCount; i++)
+        redditCommentTreeFillReply(tree, comment->replies[i], parent, depth);
+}
+
+/*
+ * Flattens the comments in 'list' into a new RedditCommentTree. The comments
+ * are counted first, so every array is allocated once at the right size.
+ */
+EXPORT_SYMBOL RedditCommentTree *redditCommentTreeNew (RedditCommentList *list)
+{
+    RedditCommentTree *tree = rmalloc(sizeof(RedditCommentTree));
+    size_t bytes = 0;
+    int count = 0;
+
+    if (list->baseComment != NULL)
+        redditCommentTreeMeasure(list->baseComment, &count, &bytes);
+
+    tree->count               = 0;
+    tree->depth               = redditCommentTreeArray(count, sizeof(int));
+    tree->parent              = redditCommentTreeArray(count, sizeof(int));
+    tree->subtreeSize         = redditCommentTreeArray(count, sizeof(int));
+    tree->ups                 = redditCommentTreeArray(count, sizeof(int));
+    tree->downs               = redditCommentTreeArray(count, sizeof(int));
+    tree->numReports          = redditCommentTreeArray(count, sizeof(int));
+    tree->totalReplyCount     = redditCommentTreeArray(count, sizeof(int));
+    tree->directChildrenCount = redditCommentTreeArray(count, sizeof(int));
+    tree->flags               = redditCommentTreeArray(count, sizeof(unsigned int));
+    tree->created_utc         = redditCommentTreeArray(count, sizeof(time_t));
+    tree->id                  = redditCommentTreeArray(count, sizeof(int));
+    tree->author              = redditCommentTreeArray(count, sizeof(int));
+    tree->parentId            = redditCommentTreeArray(count, sizeof(int));
+    tree->linkId              = redditCommentTreeArray(count, sizeof(int));
+    tree->body                = redditCommentTreeArray(count, sizeof(int));
+    tree->childrenId          = redditCommentTreeArray(count, sizeof(int));
+    tree->directChildrenIds   = redditCommentTreeArray(count, sizeof(int));
+    tree->comments            = redditCommentTreeArray(count, sizeof(RedditComment*));
+    tree->strings             = rmalloc(bytes ? bytes : 1);
+    tree->stringsSize         = 0;
+
+    if (list->baseComment != NULL)
+        redditCommentTreeFill(tree, list->baseComment, -1, 0);
+
+    return tree;
+}
+
+EXPORT_SYMBOL void redditCommentTreeFree (RedditCommentTree *tree)
+{
+    if (tree == NULL)
+        return ;
+
+    free(tree->depth);
+    free(tree->parent);
+    free(tree->subtreeSize);
+    free(tree->ups);
+    free(tree->downs);
+    free(tree->numReports);
+    free(tree->totalReplyCount);
+    free(tree->directChildrenCount);
+    free(tree->flags);
+    free(tree->created_utc);
+    free(tree->id);
+    free(tree->author);
+    free(tree->parentId);
+    free(tree->linkId);
+    free(tree->body);
+    free(tree->childrenId);
+    free(tree->directChildrenIds);
+    free(tree->comments);
+    free(tree->strings);
+    free(tree);
+}
+
+/*
+ * Grows 'array' (Which holds 'count' entries) by 'added' entries, and moves
+ * the entries from 'at' on up to make a gap for them
+ */
+static void *redditCommentTreeOpen (void *array, size_t size, int count, int at, int added)
+{
+    char *grown = rrealloc(array, (count + added) * size);
+
+    memmove(grown + (at + added) * size, grown + at * size, (count - at) * size);
+    return grown;
+}
+
+/*
+ * Returns the index right after the last comment under the one at 'index'
+ * (Or the end of the tree, if it's -1 for the top-level comments)
+ */
+static int redditCommentTreeEnd (RedditCommentTree *tree, int index)
+{
+    if (index == -1)
+        return tree->count;
+
+    return index + tree->subtreeSize[index] + 1;
+}
+
+/*
+ * Adds the replies of 'comment', which is at 'index' in 'tree', past the
+ * first 'existing' ones (Which are already in the tree), along with
+ * everything under them. They go right after the last comment under it.
+ *
+ * The arrays are grown once and the entries after that point are moved up,
+ * and the subtreeSize's of 'comment' and all of the comments above it are
+ * updated to match. Returns the number of comments that were added.
+ */
+static int redditCommentTreeSplice (RedditCommentTree *tree, RedditComment *comment, int index, int existing)
+{
+    size_t bytes = 0;
+    int added = 0, at, end, depth, i;
+
+    for (i = existing; i < comment->replyCount; i++) {
+        added++;
+        bytes += redditCommentTreeStringBytes(comment->replies[i]);
+        redditCommentTreeMeasure(comment->replies[i], &added, &bytes);
+    }
+
+    if (added == 0)
+        return 0;
+
+    at = redditCommentTreeEnd(tree, index);
+    depth = (index == -1) ? 0 : tree->depth[index] + 1;
+
+    tree->depth               = redditCommentTreeOpen(tree->depth,               sizeof(int),            tree->count, at, added);
+    tree->parent              = redditCommentTreeOpen(tree->parent,              sizeof(int),            tree->count, at, added);
+    tree->subtreeSize         = redditCommentTreeOpen(tree->subtreeSize,         sizeof(int),            tree->count, at, added);
+    tree->ups                 = redditCommentTreeOpen(tree->ups,                 sizeof(int),            tree->count, at, added);
+    tree->downs               = redditCommentTreeOpen(tree->downs,               sizeof(int),            tree->count, at, added);
+    tree->numReports          = redditCommentTreeOpen(tree->numReports,          sizeof(int),            tree->count, at, added);
+    tree->totalReplyCount     = redditCommentTreeOpen(tree->totalReplyCount,     sizeof(int),            tree->count, at, added);
+    tree->directChildrenCount = redditCommentTreeOpen(tree->directChildrenCount, sizeof(int),            tree->count, at, added);
+    tree->flags               = redditCommentTreeOpen(tree->flags,               sizeof(unsigned int),   tree->count, at, added);
+    tree->created_utc         = redditCommentTreeOpen(tree->created_utc,         sizeof(time_t),         tree->count, at, added);
+    tree->id                  = redditCommentTreeOpen(tree->id,                  sizeof(int),            tree->count, at, added);
+    tree->author              = redditCommentTreeOpen(tree->author,              sizeof(int),            tree->count, at, added);
+    tree->parentId            = redditCommentTreeOpen(tree->parentId,            sizeof(int),            tree->count, at, added);
+    tree->linkId              = redditCommentTreeOpen(tree->linkId,              sizeof(int),            tree->count, at, added);
+    tree->body                = redditCommentTreeOpen(tree->body,                sizeof(int),            tree->count, at, added);
+    tree->childrenId          = redditCommentTreeOpen(tree->childrenId,          sizeof(int),            tree->count, at, added);
+    tree->directChildrenIds   = redditCommentTreeOpen(tree->directChildrenIds,   sizeof(int),            tree->count, at, added);
+    tree->comments            = redditCommentTreeOpen(tree->comments,            sizeof(RedditComment*), tree->count, at, added);
+    tree->strings             = rrealloc(tree->strings, tree->stringsSize + bytes);
+
+    /* The moved entries who's parent was moved too */
+    for (i = at + added; i < tree->count + added; i++)
+        if (tree->parent[i] >= at)
+            tree->parent[i] += added;
+
+    /* The new strings go on the end, so filling them in from 'at'
+     * works the same as when the tree is made */
+    end = tree->count + added;
+    tree->count = at;
+    for (i = existing; i < comment->replyCount; i++)
+        redditCommentTreeFillReply(tree, comment->replies[i], index, depth);
+    tree->count = end;
+
+    for (i = index; i != -1; i = tree->parent[i])
+        tree->subtreeSize[i] += added;
+
+    return added;
+}
+
+/*
+ * Adds everything under 'comment' (At 'index') that isn't in 'tree' yet. The
+ * replies already in the tree are gone through first, since new replies can
+ * be under them too, and then the new replies of 'comment' itself go in
+ * after them. Since that only moves entries that come after the ones being
+ * gone through, their indexes stay the same the whole time.
+ */
+static int redditCommentTreeUpdateReplies (RedditCommentTree *tree, RedditComment *comment, int index)
+{
+    int existing = 0, added = 0, i;
+
+    for (i = index + 1; i < redditCommentTreeEnd(tree, index); i += tree->subtreeSize[i] + 1) {
+        added += redditCommentTreeUpdateReplies(tree, tree->comments[i], i);
+        existing++;
+    }
+
+    added += redditCommentTreeSplice(tree, comment, index, existing);
+
+    if (index != -1) {
+        tree->totalReplyCount[index] = comment->totalReplyCount;
+        redditCommentTreeUpdateIds(tree, comment, index);
+    }
+
+    return added;
+}
+
+/*
+ * Adds every comment under the one at 'index' (Or under the 'baseComment', if
+ * it's -1) that isn't in 'tree' yet, along with everything under them.
+ *
+ * Replies are only ever added onto the end of a comment's replies, so the
+ * ones that are already in the tree are it's first ones, and the new ones go
+ * right after the last comment under it. That's done for every comment under
+ * 'index', since the replies that come back for one comment can be replies to
+ * ones that are already in the tree. The arrays are only grown and moved
+ * where there's something new, which is a lot less work than making the
+ * whole tree over again, and the entries before the first new one don't
+ * change at all (Ex. a display of the tree only has to add the new lines).
+ *
+ * The counts of every comment under 'index' and all of the comments above it
+ * are updated too. Returns the number of comments that were added.
+ */
+EXPORT_SYMBOL int redditCommentTreeUpdate (RedditCommentTree *tree, RedditCommentList *list, int index)
+{
+    RedditComment *comment;
+    int added, i;
+
+    if (index == -1)
+        comment = list->baseComment;
+    else
+        comment = tree->comments[index];
+
+    if (comment == NULL)
+        return 0;
+
+    added = redditCommentTreeUpdateReplies(tree, comment, index);
+
+    if (index != -1) {
+        for (i = tree->parent[index]; i != -1; i = tree->parent[i]) {
+            tree->totalReplyCount[i] = tree->comments[i]->totalReplyCount;
+            redditCommentTreeUpdateIds(tree, tree->comments[i], i);
+        }
+    }
+
+    return added;
+}
+
+/*
+ * Reddit's 'best' order: The lower bound of the Wilson score interval for
+ * the fraction of votes that are ups, at 80% confidence
+ */
+static double redditCommentTreeConfidence (int ups, int downs)
+{
+    const double z = 1.281551565545;
+    double n = ups + downs, phat;
+
+    if (n <= 0)
+        return 0;
+
+    phat = ups / n;
+    return (phat + z * z / (2 * n) - z * sqrt((phat * (1 - phat) + z * z / (4 * n)) / n)) / (1 + z * z / n);
+}
+
+/*
+ * Reddit's 'controversial' order: Lots of votes, split close to evenly
+ */
+static double redditCommentTreeControversy (int ups, int downs)
+{
+    double balance;
+
+    if (ups <= 0 || downs <= 0)
+        return 0;
+
+    balance = (ups > downs) ? (double)downs / ups : (double)ups / downs;
+    return pow(ups + downs, balance);
+}
+
+/* One comment to sort, See redditCommentTreeSort */
+typedef struct RedditCommentTreeKey {
+    int parent;
+    int index;
+    double key;
+} RedditCommentTreeKey;
+
+/*
+ * Sorts comments by their parent, then with the highest key first, and
+ * comments with the same key in the order they were in already
+ */
+static int redditCommentTreeKeyCompare (const void *a, const void *b)
+{
+    const RedditCommentTreeKey *left = a, *right = b;
+
+    if (left->parent != right->parent)
+        return left->parent - right->parent;
+
+    if (left->key != right->key)
+        return (left->key < right->key) ? 1 : -1;
+
+    return left->index - right->index;
+}
+
+static double redditCommentTreeSortKey (RedditCommentTree *tree, int i, RedditCommentSortType sort)
+{
+    switch (sort) {
+    case REDDIT_SORT_BEST:   return redditCommentTreeConfidence(tree->ups[i], tree->downs[i]);
+    case REDDIT_SORT_TOP:    return tree->ups[i] - tree->downs[i];
+    case REDDIT_SORT_NEW:    return tree->created_utc[i];
+    case REDDIT_SORT_CONTR:  return redditCommentTreeControversy(tree->ups[i], tree->downs[i]);
+    case REDDIT_SORT_OLD:    return -(double)tree->created_utc[i];
+    case REDDIT_SORT_RANDOM: return rand();
+    }
+
+    return 0;
+}
+
+/*
+ * Writes the replies of the comment at 'parent' (Which are 'keys[first]' to
+ * 'keys[last - 1]'), each followed by all of it's own replies, onto 'order'
+ */
+static void redditCommentTreeOrder (RedditCommentTreeKey *keys, int *firstReply, int parent, int *order, int *out)
+{
+    int first = firstReply[parent + 1], last = firstReply[parent + 2], i;
+
+    for (i = first; i < last; i++) {
+        order[(*out)++] = keys[i].index;
+        redditCommentTreeOrder(keys, firstReply, keys[i].index, order, out);
+    }
+}
+
+/*
+ * Replaces 'array' with a copy of it in the order given by 'order'
+ */
+static void *redditCommentTreePermute (void *array, size_t size, int *order, int count)
+{
+    char *sorted = rmalloc((count ? count : 1) * size);
+    int i;
+
+    for (i = 0; i < count; i++)
+        memcpy(sorted + i * size, (char *)array + order[i] * size, size);
+
+    free(array);
+    return sorted;
+}
+
+/*
+ * Sorts the comments in 'tree' by 'sort'.
+ *
+ * Every comment is sorted by (parent, key) at once, which puts the replies
+ * of each comment next to each other, in the order they should end up in.
+ * 'firstReply[p + 1]' is where the replies of the comment at 'p' start in
+ * that order (So 'firstReply[0]' is the top-level comments). Going down from
+ * the top-level comments in that order gives the new pre-order, and then
+ * each array is shuffled to match it.
+ */
+EXPORT_SYMBOL void redditCommentTreeSort (RedditCommentTree *tree, RedditCommentSortType sort)
+{
+    RedditCommentTreeKey *keys;
+    int *firstReply, *order, *newIndex;
+    int count = tree->count, out = 0, i;
+
+    if (count < 2)
+        return ;
+
+    keys       = rmalloc(count * sizeof(RedditCommentTreeKey));
+    firstReply = rmalloc((count + 2) * sizeof(int));
+    order      = rmalloc(count * sizeof(int));
+    newIndex   = rmalloc(count * sizeof(int));
+
+    for (i = 0; i < count; i++) {
+        keys[i].parent = tree->parent[i];
+        keys[i].index = i;
+        keys[i].key = redditCommentTreeSortKey(tree, i, sort);
+    }
+
+    qsort(keys, count, sizeof(RedditCommentTreeKey), redditCommentTreeKeyCompare);
+
+    memset(firstReply, 0, (count + 2) * sizeof(int));
+    for (i = 0; i < count; i++)
+        firstReply[keys[i].parent + 2]++;
+    for (i = 1; i < count + 2; i++)
+        firstReply[i] += firstReply[i - 1];
+
+    redditCommentTreeOrder(keys, firstReply, -1, order, &out);
+
+    for (i = 0; i < count; i++)
+        newIndex[order[i]] = i;
+
+    tree->parent = redditCommentTreePermute(tree->parent, sizeof(int), order, count);
+    for (i = 0; i < count; i++)
+        if (tree->parent[i] != -1)
+            tree->parent[i] = newIndex[tree->parent[i]];
+
+    tree->depth               = redditCommentTreePermute(tree->depth,               sizeof(int),            order, count);
+    tree->subtreeSize         = redditCommentTreePermute(tree->subtreeSize,         sizeof(int),            order, count);
+    tree->ups                 = redditCommentTreePermute(tree->ups,                 sizeof(int),            order, count);
+    tree->downs               = redditCommentTreePermute(tree->downs,               sizeof(int),            order, count);
+    tree->numReports          = redditCommentTreePermute(tree->numReports,          sizeof(int),            order, count);
+    tree->totalReplyCount     = redditCommentTreePermute(tree->totalReplyCount,     sizeof(int),            order, count);
+    tree->directChildrenCount = redditCommentTreePermute(tree->directChildrenCount, sizeof(int),            order, count);
+    tree->flags               = redditCommentTreePermute(tree->flags,               sizeof(unsigned int),   order, count);
+    tree->created_utc         = redditCommentTreePermute(tree->created_utc,         sizeof(time_t),         order, count);
+    tree->id                  = redditCommentTreePermute(tree->id,                  sizeof(int),            order, count);
+    tree->author              = redditCommentTreePermute(tree->author,              sizeof(int),            order, count);
+    tree->parentId            = redditCommentTreePermute(tree->parentId,            sizeof(int),            order, count);
+    tree->linkId              = redditCommentTreePermute(tree->linkId,              sizeof(int),            order, count);
+    tree->body                = redditCommentTreePermute(tree->body,                sizeof(int),            order, count);
+    tree->childrenId          = redditCommentTreePermute(tree->childrenId,          sizeof(int),            order, count);
+    tree->directChildrenIds   = redditCommentTreePermute(tree->directChildrenIds,   sizeof(int),            order, count);
+    tree->comments            = redditCommentTreePermute(tree->comments,            sizeof(RedditComment*), order, count);
+
+    free(newIndex);
+    free(order);
+    free(firstReply);
+    free(keys);
+}
+
+/*
+ * Splits the 'more' ids at 'offset' in 'tree' back up into a new array of
+ * 'count' strings
+ */
+static char **redditCommentTreeSplitIds (RedditCommentTree *tree, int offset, int count)
+{
+    char **ids = rmalloc(count * sizeof(char*));
+    const char *id = tree->strings + offset, *end;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        end = strchr(id, ',');
+        if (end == NULL)
+            end = id + strlen(id);
+
+        ids[i] = redditArenaCopy(NULL, id, end - id);
+        id = (*end == ',') ? end + 1 : end;
+    }
+
+    return ids;
+}
+
+/*
+ * Makes a new RedditComment out of entry 'i' of 'tree', with copies of it's
+ * strings, including the 'more' ids, so it's hidden replies can still be
+ * expanded. The strings the tree holds as "" are copied back as "", except
+ * for 'childrenId', which goes back to NULL.
+ */
+static RedditComment *redditCommentTreeNewComment (RedditCommentTree *tree, int i)
+{
+    RedditComment *comment = redditCommentNew();
+
+    comment->id                  = redditCopyString(tree->strings + tree->id[i]);
+    comment->author              = redditCopyString(tree->strings + tree->author[i]);
+    comment->parentId            = redditCopyString(tree->strings + tree->parentId[i]);
+    comment->linkId              = redditCopyString(tree->strings + tree->linkId[i]);
+    comment->body                = redditCopyString(tree->strings + tree->body[i]);
+    comment->ups                 = tree->ups[i];
+    comment->downs               = tree->downs[i];
+    comment->numReports          = tree->numReports[i];
+    comment->totalReplyCount     = tree->totalReplyCount[i];
+    comment->flags               = tree->flags[i] & ~REDDIT_COMMENT_STRING_VIEWS;
+    comment->created_utc         = tree->created_utc[i];
+
+    if (tree->strings[tree->childrenId[i]] != '\0')
+        comment->childrenId = redditCopyString(tree->strings + tree->childrenId[i]);
+
+    if (tree->directChildrenCount[i] > 0) {
+        comment->directChildrenCount = tree->directChildrenCount[i];
+        comment->directChildrenIds   = redditCommentTreeSplitIds(tree, tree->directChildrenIds[i], tree->directChildrenCount[i]);
+    }
+
+    return comment;
+}
+
+/*
+ * Builds the comments back up out of 'tree', in the tree's order. Since every
+ * comment comes after it's parent, they can all be made in one pass, and the
+ * totalReplyCount's are copied over instead of being added up again.
+ */
+EXPORT_SYMBOL RedditComment *redditCommentTreeToComment (RedditCommentTree *tree)
+{
+    RedditComment *base = redditCommentNew();
+    RedditComment **made = rmalloc((tree->count ? tree->count : 1) * sizeof(RedditComment*));
+    int i, total = 0;
+
+    for (i = 0; i < tree->count; i++) {
+        made[i] = redditCommentTreeNewComment(tree, i);
+
+        if (tree->parent[i] == -1) {
+            redditCommentAttachReply(base, made[i]);
+            total += tree->totalReplyCount[i] + 1;
+        } else {
+            redditCommentAttachReply(made[tree->parent[i]], made[i]);
+        }
+    }
+
+    base->totalReplyCount = total;
+
+    free(made);
+    return base;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef _REDDIT_CONNECTION_C_
+#define _REDDIT_CONNECTION_C_
+
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+
+#include "global.h"
+#include "connection.h"
+#include "request.h"
+
+/*
+ * Allocates a new empty pool, along with the curl share that holds its
+ * connection cache
+ */
+RedditConnectionPool *redditConnectionPoolNew()
+{
+    RedditConnectionPool *pool = rmalloc(sizeof(RedditConnectionPool));
+    memset(pool, 0, sizeof(RedditConnectionPool));
+
+    pool->idle = rmalloc(REDDIT_CONNECTION_POOL_MAX * sizeof(CURL*));
+
+    pool->share = curl_share_init();
+    curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+    pool->multi = curl_multi_init();
+
+    return pool;
+}
+
+/*
+ * Frees a pool, closing every handle and connection it's holding
+ *
+ * Note: Any handle currently given out by redditConnectionGet has to be
+ * released before this is called, meaning any running requests need to be
+ * cancelled first. Requests still on the 'finished' list are freed here
+ * without their handlers being called, the same as if they were cancelled.
+ */
+void redditConnectionPoolFree(RedditConnectionPool *pool)
+{
+    int i;
+    if (pool == NULL)
+        return ;
+
+    /* redditRequestFree takes each one off of the list */
+    while (pool->finished != NULL)
+        redditRequestFree(pool->finished);
+
+    curl_multi_cleanup(pool->multi);
+
+    for (i = 0; i < pool->idleCount; i++)
+        curl_easy_cleanup(pool->idle[i]);
+
+    curl_share_cleanup(pool->share);
+    free(pool->idle);
+    free(pool);
+}
+
+/*
+ * Returns a handle ready to be setup for a new transfer. Handles coming from
+ * the pool have been reset, so only the options set here carry over.
+ */
+CURL *redditConnectionGet(RedditState *state)
+{
+    RedditConnectionPool *pool;
+    CURL *handle;
+
+    if (state->connections == NULL)
+        state->connections = redditConnectionPoolNew();
+
+    pool = state->connections;
+
+    if (pool->idleCount > 0)
+        handle = pool->idle[--pool->idleCount];
+    else
+        handle = curl_easy_init();
+
+    curl_easy_setopt(handle, CURLOPT_SHARE, pool->share);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+
+    return handle;
+}
+
+/*
+ * Puts a handle back into the pool after a transfer has finished. curl tells
+ * us how many connections the transfer had to open, if that's none then it
+ * went over a connection that was already open. Transfers that never got a
+ * response aren't counted either way.
+ */
+void redditConnectionRelease(RedditState *state, CURL *handle)
+{
+    RedditConnectionPool *pool = state->connections;
+    long newConnections = 0, responseCode = 0;
+
+    if (handle == NULL)
+        return ;
+
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &responseCode);
+    if (responseCode != 0 && curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &newConnections) == CURLE_OK) {
+        if (newConnections > 0)
+            state->connectionsNew += newConnections;
+        else
+            state->connectionsReused++;
+    }
+
+    if (pool == NULL || pool->idleCount >= REDDIT_CONNECTION_POOL_MAX) {
+        curl_easy_cleanup(handle);
+        return ;
+    }
+
+    curl_easy_reset(handle);
+    pool->idle[pool->idleCount++] = handle;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _REDDIT_CONNECTION_H_
+#define _REDDIT_CONNECTION_H_
+
+#include <curl/curl.h>
+
+#include "reddit.h"
+
+/*
+ * The most curl handles we keep sitting idle in a pool at once. Anything
+ * released past this is cleaned up instead (The connections themselves stay
+ * in the shared cache either way)
+ */
+#define REDDIT_CONNECTION_POOL_MAX 8
+
+/*
+ * A pool of long-lived curl easy handles attached to a RedditState.
+ *
+ * 'share' holds the connection, DNS and TLS session caches, and every handle
+ * handed out from the pool is attached to it. That means a connection opened
+ * by one request stays open (keep-alive) and is picked up by the next one,
+ * regardless of which handle it ends up using.
+ *
+ * 'idle' is a stack of handles not currently in use.
+ *
+ * 'multi' runs every request made with this state (See request.c), and
+ * 'activeCount' is the number of requests currently running on it.
+ *
+ * 'finished' is a list of requests that are done but who's handlers haven't
+ * been called yet. They're handed to their handlers, in the order they
+ * finished, the next time redditAsyncPerform is called.
+ */
+typedef struct RedditConnectionPool {
+    CURLSH *share;
+    CURLM  *multi;
+    int     activeCount;
+
+    RedditRequest *finished;
+
+    CURL **idle;
+    int    idleCount;
+} RedditConnectionPool;
+
+RedditConnectionPool *redditConnectionPoolNew  ();
+void                  redditConnectionPoolFree (RedditConnectionPool *pool);
+
+/*
+ * Get a handle out of the pool of 'state' (Creating one if the pool is empty),
+ * and give it back once the transfer is done. Releasing a handle records if
+ * its transfer opened a new connection or reused an old one in 'state'.
+ */
+CURL *redditConnectionGet     (RedditState *state);
+void  redditConnectionRelease (RedditState *state, CURL *handle);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef _REDDIT_DATE_C_
+#define _REDDIT_DATE_C_
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "global.h"
+
+#define DATE_DAY_SECONDS (24 * 60 * 60)
+
+/*
+ * The timezone offset last looked up, which holds for the whole of the UTC
+ * day starting at 'dayStart'. Comments and links shown together are almost
+ * always from the same few days, so most dates don't need a lookup at all.
+ * Changing the timezone while the program is running isn't noticed.
+ */
+static struct {
+    bool   valid;
+    time_t dayStart;
+    long   offset;
+} dateCache;
+
+/*
+ * Returns the offset of local time from UTC at 'date', in seconds
+ */
+static long dateOffset (time_t date)
+{
+    struct tm local;
+
+    if (localtime_r(&date, &local) == NULL)
+        return 0;
+
+    return local.tm_gmtoff;
+}
+
+/*
+ * Returns the offset of local time from UTC at 'date', only looking it up if
+ * 'date' isn't on the same UTC day as the last lookup.
+ *
+ * The offset is only cached if it's the same at both ends of the day, so a
+ * day with a DST change in it is looked up every time.
+ */
+static long dateCachedOffset (time_t date)
+{
+    time_t dayStart = date - (((date % DATE_DAY_SECONDS) + DATE_DAY_SECONDS) % DATE_DAY_SECONDS);
+    long offset;
+
+    if (dateCache.valid && dateCache.dayStart == dayStart)
+        return dateCache.offset;
+
+    offset = dateOffset(dayStart);
+    if (offset != dateOffset(dayStart + DATE_DAY_SECONDS - 1))
+        return dateOffset(date);
+
+    dateCache.valid = true;
+    dateCache.dayStart = dayStart;
+    dateCache.offset = offset;
+    return offset;
+}
+
+/*
+ * Formats 'date' (Seconds since the epoch, Ex. 'created_utc') into 'buf' as
+ * local time, using CREATE_DATE_FORMAT. Returns the length of the string
+ * written, or 0 if it didn't fit (In which case 'buf' is an empty string).
+ */
+EXPORT_SYMBOL size_t redditFormatDate (char *buf, size_t size, time_t date)
+{
+    time_t local;
+    struct tm tm;
+    size_t len = 0;
+
+    local = date + dateCachedOffset(date);
+
+    if (gmtime_r(&local, &tm) != NULL)
+        len = strftime(buf, size, CREATE_DATE_FORMAT, &tm);
+
+    if (len == 0 && size > 0)
+        buf[0] = '\0';
+
+    return len;
+}
+
+#endif
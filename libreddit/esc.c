@@ -0,0 +1,486 @@
+#ifndef _REDDIT_ESC_C_
+#define _REDDIT_ESC_C_
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <wchar.h>
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+#include "global.h"
+#include "esc.h"
+
+/*
+ * The text Reddit sends is UTF-8, with JSON Esc codes ('\n', '\uxxxx', ...)
+ * and HTML entities ('&amp;', '&#39;', ...) in it. The plain char version of
+ * a parsed string is UTF-8, and the wchar_t version holds one character per
+ * wchar_t.
+ *
+ * Most text has very few Esc codes or entities in it, and is mostly ASCII, so
+ * the parser spends nearly all of it's time on runs of plain characters that
+ * are copied through as they are. These runs are found 16 bytes at a time
+ * with SSE2, or 32 with AVX2 when the compiler is allowed to use it (Ex.
+ * -march=native), and copied in bulk. There is a plain C version for
+ * everything else.
+ */
+
+/* What a character that can't be decoded turns into */
+#define ESC_REPLACEMENT 0xFFFD
+
+/* Used for an Esc code that doesn't stand for any character */
+#define ESC_NONE 0xFFFFFFFFu
+
+/*
+ * Returns how many bytes at the start of 'text' (Up to 'len') are plain
+ * characters. A run ends at a backslash or an '&', or if 'asciiOnly' is set,
+ * at any byte outside of ASCII, since those have to be decoded for the
+ * wchar_t version.
+ */
+static size_t escPlainRun (const char *text, size_t len, bool asciiOnly)
+{
+    size_t i = 0;
+    unsigned int mask;
+
+#if defined(__AVX2__)
+    const __m256i slash32 = _mm256_set1_epi8('\\');
+    const __m256i amp32   = _mm256_set1_epi8('&');
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(text + i));
+
+        mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, slash32),
+                                                    _mm256_cmpeq_epi8(chunk, amp32)));
+        if (asciiOnly)
+            mask |= _mm256_movemask_epi8(chunk);
+
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+
+#if defined(__SSE2__)
+    const __m128i slash16 = _mm_set1_epi8('\\');
+    const __m128i amp16   = _mm_set1_epi8('&');
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, slash16),
+                                              _mm_cmpeq_epi8(chunk, amp16)));
+        if (asciiOnly)
+            mask |= _mm_movemask_epi8(chunk);
+
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; i < len; i++)
+        if (text[i] == '\\' || text[i] == '&' || (asciiOnly && (text[i] & 0x80)))
+            break;
+
+    return i;
+}
+
+/*
+ * Copies a run of 'len' ASCII characters into a wchar_t string
+ */
+static void escWiden (wchar_t *out, const char *text, size_t len)
+{
+    size_t i = 0;
+
+#if defined(__AVX2__) && __SIZEOF_WCHAR_T__ == 4
+    for (; i + 8 <= len; i += 8) {
+        __m128i chunk = _mm_loadl_epi64((const __m128i *)(text + i));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_cvtepu8_epi32(chunk));
+    }
+#elif defined(__SSE2__) && __SIZEOF_WCHAR_T__ == 4
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i lo = _mm_unpacklo_epi8(chunk, zero);
+        __m128i hi = _mm_unpackhi_epi8(chunk, zero);
+
+        _mm_storeu_si128((__m128i *)(out + i),      _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(out + i + 4),  _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(out + i + 8),  _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i *)(out + i + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+#endif
+
+    for (; i < len; i++)
+        out[i] = (unsigned char)text[i];
+}
+
+/*
+ * Table driven UTF-8 decoding. For every possible first byte of a sequence
+ * 'escUtf8Length' is how long the sequence is, or 0 if the byte can't start
+ * one. 'escUtf8Min' is the smallest character a sequence of each length can
+ * hold, anything smaller is an overlong encoding.
+ */
+static const unsigned char escUtf8Length[256] = {
+    [0x00 ... 0x7F] = 1,
+    [0xC2 ... 0xDF] = 2,
+    [0xE0 ... 0xEF] = 3,
+    [0xF0 ... 0xF4] = 4
+};
+
+static const unsigned int escUtf8Min[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+
+/*
+ * Decodes the UTF-8 sequence at the start of 'text' into '*ch', and returns
+ * how many bytes it was. Invalid sequences decode to ESC_REPLACEMENT, one
+ * bad byte at a time.
+ */
+static size_t escUtf8Decode (const unsigned char *text, size_t len, unsigned int *ch)
+{
+    size_t length = escUtf8Length[text[0]], i;
+    unsigned int value;
+
+    *ch = ESC_REPLACEMENT;
+    if (length == 0 || length > len)
+        return 1;
+
+    value = text[0] & (0x7F >> length);
+    for (i = 1; i < length; i++) {
+        if ((text[i] & 0xC0) != 0x80)
+            return i;
+        value = (value << 6) | (text[i] & 0x3F);
+    }
+
+    if (value >= escUtf8Min[length] && value <= 0x10FFFF && (value < 0xD800 || value > 0xDFFF))
+        *ch = value;
+
+    return length;
+}
+
+/*
+ * Writes 'ch' into 'out' as UTF-8, and returns how many bytes that took
+ */
+static size_t escUtf8Encode (char *out, unsigned int ch)
+{
+    if (ch < 0x80) {
+        out[0] = ch;
+        return 1;
+    } else if (ch < 0x800) {
+        out[0] = 0xC0 | (ch >> 6);
+        out[1] = 0x80 | (ch & 0x3F);
+        return 2;
+    } else if (ch < 0x10000) {
+        out[0] = 0xE0 | (ch >> 12);
+        out[1] = 0x80 | ((ch >> 6) & 0x3F);
+        out[2] = 0x80 | (ch & 0x3F);
+        return 3;
+    }
+
+    out[0] = 0xF0 | (ch >> 18);
+    out[1] = 0x80 | ((ch >> 12) & 0x3F);
+    out[2] = 0x80 | ((ch >> 6) & 0x3F);
+    out[3] = 0x80 | (ch & 0x3F);
+    return 4;
+}
+
+/*
+ * Writes 'ch' into 'out', as a surrogate pair if wchar_t is too small to hold
+ * it, and returns how many wchar_t's that took
+ */
+static size_t escWideEncode (wchar_t *out, unsigned int ch)
+{
+#if __SIZEOF_WCHAR_T__ == 2
+    if (ch > 0xFFFF) {
+        ch -= 0x10000;
+        out[0] = 0xD800 | (ch >> 10);
+        out[1] = 0xDC00 | (ch & 0x3FF);
+        return 2;
+    }
+#endif
+
+    out[0] = ch;
+    return 1;
+}
+
+/*
+ * Reads 'count' hex digits from 'text' into '*value'. Returns false if one of
+ * them isn't a hex digit.
+ */
+static bool escHex (const char *text, int count, unsigned int *value)
+{
+    int i;
+
+    *value = 0;
+    for (i = 0; i < count; i++) {
+        if (text[i] >= '0' && text[i] <= '9')
+            *value = (*value << 4) | (text[i] - '0');
+        else if ((text[i] | 0x20) >= 'a' && (text[i] | 0x20) <= 'f')
+            *value = (*value << 4) | ((text[i] | 0x20) - 'a' + 10);
+        else
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Parses the JSON Esc code at the start of 'text' (Which starts with the
+ * backslash) into '*ch', and returns how many bytes it was.
+ *
+ * '\uxxxx' codes for characters outside of the BMP come as a surrogate pair,
+ * two codes in a row, which are put back together into one character. A half
+ * of a pair on it's own becomes ESC_REPLACEMENT.
+ */
+static size_t escParseCode (const char *text, size_t len, unsigned int *ch)
+{
+    unsigned int low;
+
+    /* A backslash at the very end doesn't stand for anything */
+    if (len < 2) {
+        *ch = ESC_NONE;
+        return len;
+    }
+
+    switch (text[1]) {
+    case 'n': *ch = '\n'; return 2;
+    case 't': *ch = '\t'; return 2;
+    case 'r': *ch = '\r'; return 2;
+    case 'b': *ch = '\b'; return 2;
+    case 'f': *ch = '\f'; return 2;
+
+    case 'u':
+        if (len < 6 || !escHex(text + 2, 4, ch)) {
+            /* A broken code is dropped, whatever came after the 'u' is left
+             * to be parsed as normal text */
+            *ch = ESC_NONE;
+            return 2;
+        }
+
+        if (*ch >= 0xD800 && *ch <= 0xDBFF) {
+            if (len >= 12 && text[6] == '\\' && text[7] == 'u' && escHex(text + 8, 4, &low)
+             && low >= 0xDC00 && low <= 0xDFFF) {
+                *ch = 0x10000 + ((*ch - 0xD800) << 10) + (low - 0xDC00);
+                return 12;
+            }
+            *ch = ESC_REPLACEMENT;
+        } else if (*ch >= 0xDC00 && *ch <= 0xDFFF) {
+            *ch = ESC_REPLACEMENT;
+        }
+        return 6;
+
+    default:
+        /* '\"', '\\', '\/' and anything else just stand for themselves. A
+         * backslash before a UTF-8 sequence is dropped, leaving the sequence
+         * to be decoded on it's own. */
+        if ((unsigned char)text[1] >= 0x80) {
+            *ch = ESC_NONE;
+            return 1;
+        }
+        *ch = (unsigned char)text[1];
+        return 2;
+    }
+}
+
+/*
+ * The named HTML entities that are decoded. Reddit itself only escapes '&',
+ * '<' and '>', the others show up in text that came from elsewhere.
+ */
+static const struct {
+    const char *name;
+    size_t      len;
+    char        ch;
+} escEntities[] = {
+    { "&amp;",  5, '&'  },
+    { "&lt;",   4, '<'  },
+    { "&gt;",   4, '>'  },
+    { "&quot;", 6, '\"' },
+    { "&apos;", 6, '\'' },
+    { "&nbsp;", 6, ' '  },
+};
+
+#define ESC_ENTITY_COUNT (sizeof(escEntities) / sizeof(escEntities[0]))
+
+/*
+ * Parses the HTML entity at the start of 'text' (Which starts with the '&')
+ * into '*ch', and returns how many bytes it was. Numeric entities ('&#39;' and
+ * '&#x27;') work for any character. An '&' that doesn't start an entity is
+ * just an '&'.
+ */
+static size_t escParseEntity (const char *text, size_t len, unsigned int *ch)
+{
+    size_t i, digits;
+    unsigned int value = 0;
+    bool hex;
+
+    for (i = 0; i < ESC_ENTITY_COUNT; i++) {
+        if (len >= escEntities[i].len && memcmp(text, escEntities[i].name, escEntities[i].len) == 0) {
+            *ch = (unsigned char)escEntities[i].ch;
+            return escEntities[i].len;
+        }
+    }
+
+    *ch = '&';
+    if (len < 4 || text[1] != '#')
+        return 1;
+
+    hex = (text[2] == 'x' || text[2] == 'X');
+    i = hex ? 3 : 2;
+
+    /* Anything over 7 digits can't be a character anyway */
+    for (digits = 0; i < len && digits < 8; i++, digits++) {
+        if (text[i] >= '0' && text[i] <= '9')
+            value = value * (hex ? 16 : 10) + (text[i] - '0');
+        else if (hex && (text[i] | 0x20) >= 'a' && (text[i] | 0x20) <= 'f')
+            value = value * 16 + ((text[i] | 0x20) - 'a' + 10);
+        else
+            break;
+    }
+
+    if (digits == 0 || digits == 8 || i >= len || text[i] != ';')
+        return 1;
+
+    if (value == 0 || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF))
+        value = ESC_REPLACEMENT;
+
+    *ch = value;
+    return i + 1;
+}
+
+/*
+ * Does the actual parsing of 'len' bytes of 'text' into 'narrow' and 'wide',
+ * which have room for at least 'len + 1' characters each (Nothing the parser
+ * decodes takes more room than the text it came from). Either one can be
+ * NULL.
+ *
+ * Plain runs are copied straight through. Esc codes and entities are decoded
+ * into a character, which is encoded as UTF-8 for 'narrow'. Anything else
+ * outside of ASCII is UTF-8 already, so it's decoded for 'wide' and copied
+ * as-is into 'narrow'.
+ */
+static void escDecode (const char *text, size_t len, char *narrow, wchar_t *wide)
+{
+    size_t cur = 0, n = 0, w = 0, run, used;
+    unsigned int ch;
+    bool raw;
+
+    while (cur < len) {
+        run = escPlainRun(text + cur, len - cur, wide != NULL);
+        if (run > 0) {
+            if (narrow)
+                memcpy(narrow + n, text + cur, run);
+            if (wide)
+                escWiden(wide + w, text + cur, run);
+
+            n += run;
+            w += run;
+            cur += run;
+            continue;
+        }
+
+        raw = false;
+        if (text[cur] == '\\') {
+            used = escParseCode(text + cur, len - cur, &ch);
+        } else if (text[cur] == '&') {
+            used = escParseEntity(text + cur, len - cur, &ch);
+        } else {
+            used = escUtf8Decode((const unsigned char *)text + cur, len - cur, &ch);
+            raw = true;
+        }
+
+        cur += used;
+        if (ch == ESC_NONE)
+            continue;
+
+        if (narrow) {
+            if (raw) {
+                memcpy(narrow + n, text + cur - used, used);
+                n += used;
+            } else {
+                n += escUtf8Encode(narrow + n, ch);
+            }
+        }
+
+        if (wide)
+            w += escWideEncode(wide + w, ch);
+    }
+
+    if (narrow)
+        narrow[n] = '\0';
+    if (wide)
+        wide[w] = L'\0';
+}
+
+void redditParseEscCodesBoth (const char *text, int len, char **narrow, wchar_t **wide, RedditArena *arena)
+{
+    char *narrowText = NULL;
+    wchar_t *wideText = NULL;
+
+    if (len > 0) {
+        if (narrow)
+            narrowText = redditArenaAlloc(arena, (len + 1) * sizeof(char));
+        if (wide)
+            wideText = redditArenaAlloc(arena, (len + 1) * sizeof(wchar_t));
+
+        escDecode(text, len, narrowText, wideText);
+    }
+
+    if (narrow)
+        *narrow = narrowText;
+    if (wide)
+        *wide = wideText;
+}
+
+/*
+ * Takes a string of json and the token containing the string data, and
+ * parses out any '\' escape characters, such as '\n' and '\u', along with
+ * HTML entities like '&amp;'. This version returns a straight char* version,
+ * which is UTF-8.
+ */
+EXPORT_SYMBOL char *redditParseEscCodes (const char *text, int len)
+{
+    char *narrow;
+    redditParseEscCodesBoth(text, len, &narrow, NULL, NULL);
+    return narrow;
+}
+
+/*
+ * This is another version of the above redditParseEscCodes. The difference is
+ * that this returns a whcar_t, with one character in each no matter what the
+ * current locale is
+ */
+EXPORT_SYMBOL wchar_t *redditParseEscCodesWide (const char *text, int len)
+{
+    wchar_t *wide;
+    redditParseEscCodesBoth(text, len, NULL, &wide, NULL);
+    return wide;
+}
+
+/*
+ * Parsing every string for Esc codes up front is a waste, since most of them
+ * are never displayed. These are used by the accessors for the 'Esc' members
+ * of links and comments (Ex. redditLinkTitleEsc) to parse a string the first
+ * time it's asked for.
+ *
+ * An empty string parses to NULL, so it's parsed again every time. That's
+ * cheap enough that it isn't worth keeping track of.
+ */
+char *redditParseEscCodesCached (char **cache, const char *text, RedditArena *arena)
+{
+    if (*cache == NULL && text != NULL)
+        redditParseEscCodesBoth(text, strlen(text), cache, NULL, arena);
+
+    return *cache;
+}
+
+wchar_t *redditParseEscCodesCachedWide (wchar_t **cache, const char *text, RedditArena *arena)
+{
+    if (*cache == NULL && text != NULL)
+        redditParseEscCodesBoth(text, strlen(text), NULL, cache, arena);
+
+    return *cache;
+}
+
+#endif
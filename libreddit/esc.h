@@ -0,0 +1,26 @@
+#ifndef _REDDIT_ESC_H_
+#define _REDDIT_ESC_H_
+
+#include <wchar.h>
+
+#include "reddit.h"
+#include "arena.h"
+
+/*
+ * Parses the first 'len' bytes of 'text' for Esc codes in a single pass,
+ * writing a plain char version to '*narrow' and a wchar_t version to '*wide'.
+ * Either one can be NULL if that version isn't wanted. The results are
+ * allocated from 'arena' (Or with rmalloc if it's NULL), and an empty 'text'
+ * gives back NULL for both.
+ */
+void redditParseEscCodesBoth (const char *text, int len, char **narrow, wchar_t **wide, RedditArena *arena);
+
+/*
+ * Return the Esc code parsed version of 'text', which is kept in '*cache'.
+ * 'text' is only parsed the first time, when '*cache' is still NULL, and the
+ * result is allocated from 'arena' (Or with rmalloc if it's NULL).
+ */
+char    *redditParseEscCodesCached     (char    **cache, const char *text, RedditArena *arena);
+wchar_t *redditParseEscCodesCachedWide (wchar_t **cache, const char *text, RedditArena *arena);
+
+#endif
@@ -1,7 +1,17 @@
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
 #include "jsmn.h"
 
+_Static_assert(sizeof(jsmntok_t) == 16, "jsmntok_t should pack into 16 bytes");
+
 /**
  * Allocates a fresh unused token from the token pull.
  */
@@ -16,7 +26,6 @@ static jsmntok_t *jsmn_alloc_token(jsmn_parser *parser,
 	tok->size = 0;
 	tok->is_key = 0;
 #ifdef JSMN_PARENT_LINKS
-	tok->parent = -1;
 	tok->full_size = 0;
 #endif
 	return tok;
@@ -34,6 +43,17 @@ static void jsmn_fill_token(jsmntok_t *token, jsmntype_t type,
 	token->is_key = on_key;
 }
 
+/**
+ * If the innermost open token is an object, in which case a ',' is followed
+ * by a key. The strings in an array are values, and aren't marked as keys.
+ */
+static int jsmn_in_object(jsmn_parser *parser, jsmntok_t *tokens) {
+	if (tokens == NULL || parser->toksuper == -1) {
+		return 1;
+	}
+	return tokens[parser->toksuper].type == JSMN_OBJECT;
+}
+
 /**
  * Fills next available token with JSON primitive.
  */
@@ -66,15 +86,17 @@ static jsmnerr_t jsmn_parse_primitive(jsmn_parser *parser, const char *js,
 #endif
 
 found:
+	if (tokens == NULL) {
+		parser->toknext++;
+		parser->pos--;
+		return JSMN_SUCCESS;
+	}
 	token = jsmn_alloc_token(parser, tokens, num_tokens);
 	if (token == NULL) {
 		parser->pos = start;
 		return JSMN_ERROR_NOMEM;
 	}
 	jsmn_fill_token(token, JSMN_PRIMITIVE, start, parser->pos, on_key);
-#ifdef JSMN_PARENT_LINKS
-	token->parent = parser->toksuper;
-#endif
 	parser->pos--;
 	return JSMN_SUCCESS;
 }
@@ -96,21 +118,26 @@ static jsmnerr_t jsmn_parse_string(jsmn_parser *parser, const char *js,
 
 		/* Quote: end of string */
 		if (c == '\"') {
+			if (tokens == NULL) {
+				parser->toknext++;
+				return JSMN_SUCCESS;
+			}
 			token = jsmn_alloc_token(parser, tokens, num_tokens);
 			if (token == NULL) {
 				parser->pos = start;
 				return JSMN_ERROR_NOMEM;
 			}
 			jsmn_fill_token(token, JSMN_STRING, start+1, parser->pos, on_key);
-#ifdef JSMN_PARENT_LINKS
-			token->parent = parser->toksuper;
-#endif
 			return JSMN_SUCCESS;
 		}
 
 		/* Backslash: Quoted symbol expected */
 		if (c == '\\') {
 			parser->pos++;
+			/* The string was cut off right after the backslash */
+			if (js[parser->pos] == '\0') {
+				break;
+			}
 			switch (js[parser->pos]) {
 				/* Allowed escaped symbols */
 				case '\"': case '/' : case '\\' : case 'b' :
@@ -134,14 +161,10 @@ static jsmnerr_t jsmn_parse_string(jsmn_parser *parser, const char *js,
 /**
  * Parse JSON string and fill tokens.
  */
-jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, jsmntok_t *tokens,
+int jsmn_parse(jsmn_parser *parser, const char *js, jsmntok_t *tokens,
 		unsigned int num_tokens) {
 	jsmnerr_t r;
 	int i;
-#ifdef JSMN_PARENT_LINKS
-	int k;
-#endif
-	int on_key = 1;
 	jsmntok_t *token;
 
 	for (; js[parser->pos] != '\0'; parser->pos++) {
@@ -151,46 +174,51 @@ jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, jsmntok_t *tokens,
 		c = js[parser->pos];
 		switch (c) {
 			case '{': case '[':
+				if (tokens == NULL) {
+					parser->toknext++;
+					break;
+				}
 				token = jsmn_alloc_token(parser, tokens, num_tokens);
 				if (token == NULL)
 					return JSMN_ERROR_NOMEM;
 				token->is_key = 0; /* Objects can't be keys */
 				if (parser->toksuper != -1) {
 					tokens[parser->toksuper].size++;
+				}
 #ifdef JSMN_PARENT_LINKS
-					token->parent = parser->toksuper;
+				/* Kept in 'full_size' until this is closed */
+				token->full_size = parser->toksuper;
 #endif
-				}
 				token->type = (c == '{' ? JSMN_OBJECT : JSMN_ARRAY);
 				token->start = parser->pos;
 				parser->toksuper = parser->toknext - 1;
 				/*
-				 * The start of a new object or array means we'll encounter a key next
-				 * We reset this to show that
+				 * The start of a new object means we'll encounter a key next,
+				 * An array only ever holds values
 				 */
-				on_key = 1;
+				parser->on_key = (c == '{');
 				break;
 			case '}': case ']':
+				if (tokens == NULL) {
+					parser->on_key = 1;
+					break;
+				}
 				type = (c == '}' ? JSMN_OBJECT : JSMN_ARRAY);
 #ifdef JSMN_PARENT_LINKS
-				if (parser->toknext < 1) {
+				/* 'toksuper' is always the innermost open object or array,
+				 * which is the one being closed */
+				if (parser->toksuper == -1) {
 					return JSMN_ERROR_INVAL;
 				}
-				token = &tokens[parser->toknext - 1];
-				for (;;) {
-					if (token->start != -1 && token->end == -1) {
-						if (token->type != type) {
-							return JSMN_ERROR_INVAL;
-						}
-						token->end = parser->pos + 1;
-						parser->toksuper = token->parent;
-						break;
-					}
-					if (token->parent == -1) {
-						break;
-					}
-					token = &tokens[token->parent];
+				token = &tokens[parser->toksuper];
+				if (token->type != type) {
+					return JSMN_ERROR_INVAL;
 				}
+				token->end = parser->pos + 1;
+				parser->toksuper = token->full_size;
+				/* Everything allocated since this token was opened is
+				 * inside of it */
+				token->full_size = parser->toknext - (token - tokens) - 1;
 #else
 				for (i = parser->toknext - 1; i >= 0; i--) {
 					token = &tokens[i];
@@ -220,12 +248,12 @@ jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, jsmntok_t *tokens,
 				 * Technically this shouldn't be nessisary (Since a comma should be soon)
 				 * But better to have it then not.
 				 */
-				on_key = 1;
+				parser->on_key = 1;
 				break;
 			case '\"':
-				r = jsmn_parse_string(parser, js, tokens, on_key, num_tokens);
+				r = jsmn_parse_string(parser, js, tokens, parser->on_key, num_tokens);
 				if (r < 0) return r;
-				if (parser->toksuper != -1)
+				if (parser->toksuper != -1 && tokens != NULL)
 					tokens[parser->toksuper].size++;
 				break;
 
@@ -234,10 +262,10 @@ jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, jsmntok_t *tokens,
 			 * is a key
 			 */
 			case ':':
-				on_key = 0;
+				parser->on_key = 0;
 				break;
 			case ',':
-				on_key = 1;
+				parser->on_key = jsmn_in_object(parser, tokens);
 				break;
 			case '\t' : case '\r' : case '\n' : case ' ':
 				break;
@@ -250,9 +278,9 @@ jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, jsmntok_t *tokens,
 			/* In non-strict mode every unquoted value is a primitive */
 			default:
 #endif
-				r = jsmn_parse_primitive(parser, js, tokens, on_key, num_tokens);
+				r = jsmn_parse_primitive(parser, js, tokens, parser->on_key, num_tokens);
 				if (r < 0) return r;
-				if (parser->toksuper != -1)
+				if (parser->toksuper != -1 && tokens != NULL)
 					tokens[parser->toksuper].size++;
 				break;
 
@@ -265,22 +293,24 @@ jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, jsmntok_t *tokens,
 		}
 	}
 
+	/* Counting mode doesn't keep track of the structure, only the count */
+	if (tokens == NULL) {
+		return parser->toknext;
+	}
+
+	/* Still inside of an object or array, more of the string is expected */
+	if (parser->toksuper != -1) {
+		return JSMN_ERROR_PART;
+	}
+
 	for (i = parser->toknext - 1; i >= 0; i--) {
 		/* Unmatched opened object or array */
 		if (tokens[i].start != -1 && tokens[i].end == -1) {
 			return JSMN_ERROR_PART;
 		}
-#ifdef JSMN_PARENT_LINKS
-		if (tokens[i].type == JSMN_OBJECT || tokens[i].type == JSMN_ARRAY) {
-			tokens[i].full_size += tokens[i].size;
-			for (k = tokens[i].parent; k != -1; k = tokens[k].parent) {
-				tokens[k].full_size += tokens[i].size;
-			}
-		}
-#endif
 	}
 
-	return JSMN_SUCCESS;
+	return parser->toknext;
 }
 
 /**
@@ -291,5 +321,371 @@ void jsmn_init(jsmn_parser *parser) {
 	parser->pos = 0;
 	parser->toknext = 0;
 	parser->toksuper = -1;
+	parser->on_key = 1;
+}
+
+
+/*
+ * Everything below is the two stage version of the parser, jsmn_parse_indexed
+ * -- Not in standard jsmn
+ *
+ * Stage one looks at 64 bytes of text at a time, and makes a bit mask for
+ * each kind of character the parser cares about. From those it works out
+ * which quotes are escaped, and from the quotes that are left which bytes are
+ * inside of a string. Stage two only looks at the bytes stage one picked out:
+ * Structural characters outside of strings, quotes, backslashes inside of
+ * strings (To check the Esc code), and the first byte of every primitive.
+ * Everything else, which is mostly the text of strings, is never looked at
+ * one byte at a time.
+ */
+typedef struct {
+	uint64_t quote;      /* '"' */
+	uint64_t backslash;  /* '\\' */
+	uint64_t structural; /* '{', '}', '[', ']', ':' and ',' */
+	uint64_t space;      /* ' ', '\t', '\r' and '\n' */
+} jsmn_block;
+
+#define JSMN_BLOCK 64
+
+#if defined(__AVX2__)
+static uint64_t jsmn_mask32(__m256i chunk, char c) {
+	return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(c)));
+}
+
+static void jsmn_classify(const char *js, jsmn_block *block) {
+	int i;
+	memset(block, 0, sizeof(*block));
+	for (i = 0; i < JSMN_BLOCK; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)(js + i));
+		/* '[' and ']' are '{' and '}' with the 0x20 bit cleared */
+		__m256i folded = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+
+		block->quote      |= jsmn_mask32(chunk, '\"') << i;
+		block->backslash  |= jsmn_mask32(chunk, '\\') << i;
+		block->structural |= (jsmn_mask32(folded, '{') | jsmn_mask32(folded, '}')
+				| jsmn_mask32(chunk, ':') | jsmn_mask32(chunk, ',')) << i;
+		block->space      |= (jsmn_mask32(chunk, ' ') | jsmn_mask32(chunk, '\t')
+				| jsmn_mask32(chunk, '\r') | jsmn_mask32(chunk, '\n')) << i;
+	}
+}
+#elif defined(__SSE2__)
+static uint64_t jsmn_mask16(__m128i chunk, char c) {
+	return (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)));
+}
+
+static void jsmn_classify(const char *js, jsmn_block *block) {
+	int i;
+	memset(block, 0, sizeof(*block));
+	for (i = 0; i < JSMN_BLOCK; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(js + i));
+		/* '[' and ']' are '{' and '}' with the 0x20 bit cleared */
+		__m128i folded = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+
+		block->quote      |= jsmn_mask16(chunk, '\"') << i;
+		block->backslash  |= jsmn_mask16(chunk, '\\') << i;
+		block->structural |= (jsmn_mask16(folded, '{') | jsmn_mask16(folded, '}')
+				| jsmn_mask16(chunk, ':') | jsmn_mask16(chunk, ',')) << i;
+		block->space      |= (jsmn_mask16(chunk, ' ') | jsmn_mask16(chunk, '\t')
+				| jsmn_mask16(chunk, '\r') | jsmn_mask16(chunk, '\n')) << i;
+	}
+}
+#else
+/* Which of the masks in a jsmn_block each character goes in */
+enum { JSMN_C_QUOTE = 1, JSMN_C_BACKSLASH = 2, JSMN_C_STRUCTURAL = 4, JSMN_C_SPACE = 8 };
+
+static const unsigned char jsmn_class[256] = {
+	['\"'] = JSMN_C_QUOTE, ['\\'] = JSMN_C_BACKSLASH,
+	['{'] = JSMN_C_STRUCTURAL, ['}'] = JSMN_C_STRUCTURAL,
+	['['] = JSMN_C_STRUCTURAL, [']'] = JSMN_C_STRUCTURAL,
+	[':'] = JSMN_C_STRUCTURAL, [','] = JSMN_C_STRUCTURAL,
+	[' '] = JSMN_C_SPACE, ['\t'] = JSMN_C_SPACE,
+	['\r'] = JSMN_C_SPACE, ['\n'] = JSMN_C_SPACE
+};
+
+static void jsmn_classify(const char *js, jsmn_block *block) {
+	int i;
+	memset(block, 0, sizeof(*block));
+	for (i = 0; i < JSMN_BLOCK; i++) {
+		unsigned char c = jsmn_class[(unsigned char)js[i]];
+		uint64_t bit = 1ULL << i;
+
+		if (c == 0)
+			continue;
+		if (c & JSMN_C_QUOTE)      block->quote      |= bit;
+		if (c & JSMN_C_BACKSLASH)  block->backslash  |= bit;
+		if (c & JSMN_C_STRUCTURAL) block->structural |= bit;
+		if (c & JSMN_C_SPACE)      block->space      |= bit;
+	}
 }
+#endif
+
+/**
+ * Returns a mask of the bytes escaped by a backslash. '*carry' is set if the
+ * last byte of the block is a backslash that escapes the first byte of the
+ * next one. Backslashes are rare enough to just go through one at a time.
+ */
+static uint64_t jsmn_escaped(uint64_t backslash, uint64_t *carry) {
+	uint64_t escaped = *carry;
+	int i;
+
+	*carry = 0;
+	while (backslash != 0) {
+		i = __builtin_ctzll(backslash);
+		backslash &= backslash - 1;
+
+		/* An escaped backslash doesn't escape anything itself */
+		if (escaped & (1ULL << i))
+			continue;
+
+		if (i == JSMN_BLOCK - 1)
+			*carry = 1;
+		else
+			escaped |= 1ULL << (i + 1);
+	}
+	return escaped;
+}
+
+/**
+ * Each bit of the result is the XOR of that bit and every one below it. For
+ * a mask of quotes, that's every byte from an opening quote up to (But not
+ * including) the closing one.
+ */
+static uint64_t jsmn_prefix_xor(uint64_t x) {
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+/**
+ * Stage two for a primitive starting at 'start'. Finds the end of it the same
+ * way jsmn_parse_primitive does, and returns it (Or a negative error). A
+ * quote in the middle of a primitive is always an error, since stage one
+ * took it as the start of a string.
+ */
+static int jsmn_indexed_primitive(const char *js, size_t len, size_t start) {
+	size_t pos;
 
+	switch (js[start]) {
+		case '-': case '0': case '1' : case '2': case '3' : case '4':
+		case '5': case '6': case '7' : case '8': case '9':
+		case 't': case 'f': case 'n' :
+			break;
+		default:
+			return JSMN_ERROR_INVAL;
+	}
+
+	for (pos = start; pos < len; pos++) {
+		switch (js[pos]) {
+			case '\t' : case '\r' : case '\n' : case ' ' :
+			case ','  : case ']'  : case '}' :
+				return pos;
+			case '\"':
+				return JSMN_ERROR_INVAL;
+		}
+		if (js[pos] < 32 || js[pos] >= 127) {
+			return JSMN_ERROR_INVAL;
+		}
+	}
+	return JSMN_ERROR_PART;
+}
+
+int jsmn_parse_indexed(jsmn_parser *parser, const char *js, size_t len,
+		jsmntok_t *tokens, unsigned int num_tokens) {
+	char tail[JSMN_BLOCK];
+	jsmn_block block;
+	uint64_t escape_carry = 0, string_carry = 0, other_carry = 0;
+	uint64_t escaped, quote, inside, other, bits;
+	size_t base, pos, skip = 0;
+	size_t string_start = 0;
+	int in_string = 0;
+	int i, end;
+	jsmntok_t *token;
+	jsmntype_t type;
+
+	for (base = parser->pos; base < len; base += JSMN_BLOCK) {
+		if (len - base >= JSMN_BLOCK) {
+			jsmn_classify(js + base, &block);
+		} else {
+			/* Spaces after the end of the text don't change anything */
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, js + base, len - base);
+			jsmn_classify(tail, &block);
+		}
+
+		escaped = jsmn_escaped(block.backslash, &escape_carry);
+		quote = block.quote & ~escaped;
+		inside = jsmn_prefix_xor(quote) ^ string_carry;
+		string_carry = (uint64_t)((int64_t)inside >> 63);
+
+		/* Bytes outside of strings that aren't anything else are part of a
+		 * primitive, only the first byte of one is needed */
+		other = ~(block.structural | block.space | quote) & ~inside;
+
+		bits = (block.structural & ~inside) | quote
+			| (block.backslash & inside & ~escaped)
+			| (other & ~((other << 1) | other_carry));
+		other_carry = other >> 63;
+
+		for (; bits != 0; bits &= bits - 1) {
+			pos = base + __builtin_ctzll(bits);
+			if (pos < skip)
+				continue;
+
+			switch (js[pos]) {
+				case '{': case '[':
+					if (tokens == NULL) {
+						parser->toknext++;
+						break;
+					}
+					token = jsmn_alloc_token(parser, tokens, num_tokens);
+					if (token == NULL) {
+						parser->pos = pos;
+						return JSMN_ERROR_NOMEM;
+					}
+					token->is_key = 0;
+					if (parser->toksuper != -1) {
+						tokens[parser->toksuper].size++;
+					}
+#ifdef JSMN_PARENT_LINKS
+					token->full_size = parser->toksuper;
+#endif
+					token->type = (js[pos] == '{' ? JSMN_OBJECT : JSMN_ARRAY);
+					token->start = pos;
+					parser->toksuper = parser->toknext - 1;
+					parser->on_key = (js[pos] == '{');
+					break;
+
+				case '}': case ']':
+					parser->on_key = 1;
+					if (tokens == NULL) {
+						break;
+					}
+					type = (js[pos] == '}' ? JSMN_OBJECT : JSMN_ARRAY);
+					if (parser->toksuper == -1) {
+						parser->pos = pos;
+						return JSMN_ERROR_INVAL;
+					}
+					token = &tokens[parser->toksuper];
+					if (token->type != type) {
+						parser->pos = pos;
+						return JSMN_ERROR_INVAL;
+					}
+					token->end = pos + 1;
+#ifdef JSMN_PARENT_LINKS
+					parser->toksuper = token->full_size;
+					token->full_size = parser->toknext - (token - tokens) - 1;
+#else
+					parser->toksuper = -1;
+					for (i = token - tokens - 1; i >= 0; i--) {
+						if (tokens[i].start != -1 && tokens[i].end == -1) {
+							parser->toksuper = i;
+							break;
+						}
+					}
+#endif
+					break;
+
+				case ':':
+					parser->on_key = 0;
+					break;
+				case ',':
+					parser->on_key = jsmn_in_object(parser, tokens);
+					break;
+
+				case '\"':
+					/* The opening quote is the first byte inside of a string */
+					if (!in_string) {
+						in_string = 1;
+						string_start = pos;
+						break;
+					}
+					in_string = 0;
+					if (tokens == NULL) {
+						parser->toknext++;
+						break;
+					}
+					token = jsmn_alloc_token(parser, tokens, num_tokens);
+					if (token == NULL) {
+						parser->pos = string_start;
+						return JSMN_ERROR_NOMEM;
+					}
+					jsmn_fill_token(token, JSMN_STRING, string_start + 1, pos, parser->on_key);
+					if (parser->toksuper != -1) {
+						tokens[parser->toksuper].size++;
+					}
+					break;
+
+				case '\\':
+					/* Outside of a string a backslash can only be the
+					 * start of a primitive, which it isn't allowed to be */
+					if (!in_string) {
+						parser->pos = pos;
+						return JSMN_ERROR_INVAL;
+					}
+					/* The end of the text is handled below, as a string that
+					 * never got closed */
+					if (pos + 1 >= len) {
+						break;
+					}
+					switch (js[pos + 1]) {
+						case '\"': case '/' : case '\\' : case 'b' :
+						case 'f' : case 'r' : case 'n'  : case 't' :
+						case 'u':
+							break;
+						default:
+							parser->pos = string_start;
+							return JSMN_ERROR_INVAL;
+					}
+					break;
+
+				default:
+					end = jsmn_indexed_primitive(js, len, pos);
+					if (end < 0) {
+						parser->pos = pos;
+						return end;
+					}
+					skip = end;
+					if (tokens == NULL) {
+						parser->toknext++;
+						break;
+					}
+					token = jsmn_alloc_token(parser, tokens, num_tokens);
+					if (token == NULL) {
+						parser->pos = pos;
+						return JSMN_ERROR_NOMEM;
+					}
+					jsmn_fill_token(token, JSMN_PRIMITIVE, pos, end, parser->on_key);
+					if (parser->toksuper != -1) {
+						tokens[parser->toksuper].size++;
+					}
+					break;
+			}
+		}
+	}
+
+	if (in_string) {
+		parser->pos = string_start;
+		return JSMN_ERROR_PART;
+	}
+	parser->pos = len;
+
+	if (tokens == NULL) {
+		return parser->toknext;
+	}
+
+	if (parser->toksuper != -1) {
+		return JSMN_ERROR_PART;
+	}
+
+	for (i = parser->toknext - 1; i >= 0; i--) {
+		if (tokens[i].start != -1 && tokens[i].end == -1) {
+			return JSMN_ERROR_PART;
+		}
+	}
+
+	return parser->toknext;
+}
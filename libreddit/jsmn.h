@@ -1,6 +1,8 @@
 #ifndef __JSMN_H_
 #define __JSMN_H_
 
+#include <stddef.h>
+
 /*
  * Both of these settings are needed by libreddit
  */
@@ -37,21 +39,29 @@ typedef enum {
  * @param		type	type (object, array, string etc.)
  * @param		start	start position in JSON data string
  * @param		end		end position in JSON data string
+ *
+ * Not in standard jsmn: The token is packed into 16 bytes, since big threads
+ * have hundreds of thousands of them and the parser streams through them all.
+ * 'type', 'is_key' and 'size' share a word, and there's no 'parent' link.
  */
 typedef struct {
-	jsmntype_t type;
 	int start;
 	int end;
-    int size;
+	unsigned int type : 2; /* A jsmntype_t */
 	/*
 	 * Key's are the labels in a json object
      *
      * Note: This is not in standard jsmn
 	 */
 	unsigned int is_key : 1;
+	unsigned int size : 29;
 #ifdef JSMN_PARENT_LINKS
-	int full_size; /* Not in standard jsmn */
-	int parent;
+	/* Number of tokens nested inside this one, at any depth. Set when an
+	 * object or array is closed -- Not in standard jsmn
+	 *
+	 * Until then it holds the index of the object or array it's inside of,
+	 * so the parser can get back to it. */
+	int full_size;
 #endif
 } jsmntok_t;
 
@@ -63,6 +73,7 @@ typedef struct {
 	unsigned int pos; /* offset in the JSON string */
 	int toknext; /* next token to allocate */
 	int toksuper; /* superior token node, e.g parent object or array */
+	int on_key; /* If the next token will be a key -- Not in standard jsmn */
 } jsmn_parser;
 
 /**
@@ -73,8 +84,30 @@ void jsmn_init(jsmn_parser *parser);
 /**
  * Run JSON parser. It parses a JSON data string into and array of tokens, each describing
  * a single JSON object.
+ *
+ * Returns the number of tokens used, or one of the negative jsmnerr_t errors.
+ *
+ * If 'tokens' is NULL nothing is filled in, and the number of tokens the
+ * string needs is returned instead. (Not in standard jsmn)
+ *
+ * The parser can be resumed: If it returns JSMN_ERROR_PART or JSMN_ERROR_NOMEM,
+ * call it again with the same parser once more of the string is available or
+ * more tokens have been allocated, and it will continue where it stopped.
+ */
+int jsmn_parse(jsmn_parser *parser, const char *js,
+		jsmntok_t *tokens, unsigned int num_tokens);
+
+/**
+ * Same as jsmn_parse, but the first 'len' bytes of 'js' are parsed in two
+ * stages: The text is indexed 64 bytes at a time for quotes, backslashes and
+ * structural characters (Using SSE2 or AVX2 when the compiler can), and only
+ * the characters that index finds are looked at to build the tokens.
+ *
+ * It gives back the same tokens as jsmn_parse for any valid JSON, and can be
+ * resumed the same way. Invalid JSON is always an error, though jsmn_parse
+ * lets some of it through as strange primitives. (Not in standard jsmn)
  */
-jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js,
+int jsmn_parse_indexed(jsmn_parser *parser, const char *js, size_t len,
 		jsmntok_t *tokens, unsigned int num_tokens);
 
 #endif /* __JSMN_H_ */
@@ -4,9 +4,11 @@ CLEAN_TARGETS +=libreddit_clean
 # Current version of libreddit
 LIBREDDIT_VERSION:=0.0.1
 
-# libreddit currently just compiles with the default settings
-LIBREDDIT_CFLAGS :=$(PROJCFLAGS) -fvisibility=hidden -DLIBREDDIT_VERSION=$(LIBREDDIT_VERSION)
-LIBREDDIT_LDFLAGS :=`curl-config --cflags` `curl-config --libs`
+# libreddit compiles with the default settings, plus pthreads for the
+# threads it parses big responses with (See pool.c), and libm for sorting
+# comments (See commenttree.c)
+LIBREDDIT_CFLAGS :=$(PROJCFLAGS) -fvisibility=hidden -pthread -DLIBREDDIT_VERSION=$(LIBREDDIT_VERSION)
+LIBREDDIT_LDFLAGS :=`curl-config --cflags` `curl-config --libs` -pthread -lm
 
 # The directory to store the object files in
 LIBREDDIT_DIR :=libreddit
@@ -55,7 +57,7 @@ $(LIBREDDIT_CMP): $(LIBREDDIT_COMBINED)
 else
 $(LIBREDDIT_CMP):  $(LIBREDDIT_COMBINED)
 	$(ECHO) " CC $(LIBREDDIT_CMP)"
-	$(CC) -shared $(LIBREDDIT_LDFLAGS) $(LIBREDDIT_CFLAGS) $(LIBREDDIT_COMBINED) -o $(LIBREDDIT_CMP)
+	$(CC) -shared $(LIBREDDIT_CFLAGS) $(LIBREDDIT_COMBINED) $(LIBREDDIT_LDFLAGS) -o $(LIBREDDIT_CMP)
 endif
 
 $(LIBREDDIT_COMBINED): $(LIBREDDIT_OBJECTS)
@@ -9,6 +9,9 @@
 #include "global.h"
 #include "link.h"
 #include "token.h"
+#include "request.h"
+#include "arena.h"
+#include "esc.h"
 #include "jsmn.h"
 
 /*
@@ -24,17 +27,45 @@ EXPORT_SYMBOL RedditLink *redditLinkNew ()
     return link;
 }
 
+/*
+ * Allocates an empty RedditLink out of 'arena', or with redditLinkNew if it's
+ * NULL
+ */
+static RedditLink *redditLinkNewIn (RedditArena *arena)
+{
+    RedditLink *link;
+
+    if (arena == NULL)
+        return redditLinkNew();
+
+    link = redditArenaAlloc(arena, sizeof(RedditLink));
+    memset(link, 0, sizeof(RedditLink));
+    link->arena = arena;
+
+    return link;
+}
+
 /*
  * Frees a single RedditLink structure
  * Note: Doesn't free the RedditLink at 'link->next'
+ *
+ * Links allocated from a list's arena are left alone, they're freed along
+ * with the list.
  */
 EXPORT_SYMBOL void redditLinkFree (RedditLink *link)
 {
-    if (link == NULL)
+    if (link == NULL || link->arena != NULL)
         return ;
 
-    free(link->selftext);
-    free(link->title);
+    if (!(link->flags & REDDIT_LINK_STRING_VIEWS)) {
+        free(link->selftext);
+        free(link->title);
+
+        free(link->id);
+        free(link->permalink);
+        free(link->author);
+        free(link->url);
+    }
 
     free(link->selftextEsc);
     free(link->titleEsc);
@@ -42,14 +73,33 @@ EXPORT_SYMBOL void redditLinkFree (RedditLink *link)
     free(link->wselftextEsc);
     free(link->wtitleEsc);
 
-    free(link->id);
-    free(link->permalink);
-    free(link->author);
-    free(link->url);
-
     free(link);
 }
 
+/*
+ * Accessors for the Esc code parsed versions of a link's title and selftext.
+ * They're parsed the first time they're asked for and then kept in the link.
+ */
+EXPORT_SYMBOL char *redditLinkTitleEsc (RedditLink *link)
+{
+    return redditParseEscCodesCached(&link->titleEsc, link->title, link->arena);
+}
+
+EXPORT_SYMBOL wchar_t *redditLinkTitleWide (RedditLink *link)
+{
+    return redditParseEscCodesCachedWide(&link->wtitleEsc, link->title, link->arena);
+}
+
+EXPORT_SYMBOL char *redditLinkSelftextEsc (RedditLink *link)
+{
+    return redditParseEscCodesCached(&link->selftextEsc, link->selftext, link->arena);
+}
+
+EXPORT_SYMBOL wchar_t *redditLinkSelftextWide (RedditLink *link)
+{
+    return redditParseEscCodesCachedWide(&link->wselftextEsc, link->selftext, link->arena);
+}
+
 /*
  * Allocates an empty RedditLinkList structure
  */
@@ -70,6 +120,9 @@ EXPORT_SYMBOL void redditLinkListFreeLinks (RedditLinkList *list)
     free(list->links);
     list->links = NULL;
     list->linkCount = 0;
+
+    redditArenaFree(list->arena);
+    list->arena = NULL;
 }
 
 /*
@@ -83,6 +136,7 @@ EXPORT_SYMBOL void redditLinkListFree (RedditLinkList *list)
     free(list->subreddit);
     free(list->modhash);
     free(list->afterId);
+    memoryBlockFreeChain(list->responses);
     free(list);
 }
 
@@ -96,42 +150,44 @@ EXPORT_SYMBOL void redditLinkListAddLink (RedditLinkList *list, RedditLink *link
     list->links[list->linkCount - 1] = link;
 }
 
-/* Macro for the varidic arguments on parseTokens */
-#define ARG_LINK_GET_LINK \
-    RedditLink *link = va_arg(args, RedditLink*);
+/*
+ * Maps the members of a RedditLink to their key strings, See TOKEN_SCHEMA
+ */
+#define LINK_FIELDS(X, type)                                                \
+    X(type, STRVIEW, "selftext",      selftext)                             \
+    X(type, STRVIEW, "title",         title)                                \
+    X(type, STRVIEW, "id",            id)                                   \
+    X(type, STRVIEW, "permalink",     permalink)                            \
+    X(type, STRVIEW, "author",        author)                               \
+    X(type, STRVIEW, "url",           url)                                  \
+    X(type, INT,     "score",         score)                                \
+    X(type, INT,     "downs",         downs)                                \
+    X(type, INT,     "ups",           ups)                                  \
+    X(type, INT,     "num_comments",  numComments)                          \
+    X(type, INT,     "num_reports",   numReports)                           \
+    X(type, BOOL,    "is_self",       flags, REDDIT_LINK_IS_SELF)           \
+    X(type, BOOL,    "over_18",       flags, REDDIT_LINK_OVER_18)           \
+    X(type, BOOL,    "clicked",       flags, REDDIT_LINK_CLICKED)           \
+    X(type, BOOL,    "stickied",      flags, REDDIT_LINK_STICKIED)          \
+    X(type, BOOL,    "edited",        flags, REDDIT_LINK_EDITED)            \
+    X(type, BOOL,    "hidden",        flags, REDDIT_LINK_HIDDEN)            \
+    X(type, BOOL,    "distinguished", flags, REDDIT_LINK_DISTINGUISHED)     \
+    X(type, DATE,    "created_utc",   created_utc)
+
+TOKEN_SCHEMA(linkSchema, RedditLink, LINK_FIELDS);
 
 /*
  * Details how to parse a RedditLink. Doesn't do much more then allocate a new
- * RedditLink and map it's members to key strings.
+ * RedditLink and parse it using linkSchema.
  */
 RedditLink *redditGetLink(TokenParser *parser)
 {
-    RedditLink *link = redditLinkNew();
+    RedditLink *link = redditLinkNewIn(parser->arena);
 
-    TokenIdent ids[] = {
-        ADD_TOKEN_IDENT_STRPARSE("selftext",      link->selftext, link->selftextEsc, link->wselftextEsc),
-        ADD_TOKEN_IDENT_STRPARSE("title",         link->title,    link->titleEsc,    link->wtitleEsc),
-        ADD_TOKEN_IDENT_STRING  ("id",            link->id),
-        ADD_TOKEN_IDENT_STRING  ("permalink",     link->permalink),
-        ADD_TOKEN_IDENT_STRING  ("author",        link->author),
-        ADD_TOKEN_IDENT_STRING  ("url",           link->url),
-        ADD_TOKEN_IDENT_INT     ("score",         link->score),
-        ADD_TOKEN_IDENT_INT     ("downs",         link->downs),
-        ADD_TOKEN_IDENT_INT     ("ups",           link->ups),
-        ADD_TOKEN_IDENT_INT     ("num_comments",  link->numComments),
-        ADD_TOKEN_IDENT_INT     ("num_reports",   link->numReports),
-        ADD_TOKEN_IDENT_BOOL    ("is_self",       link->flags, REDDIT_LINK_IS_SELF),
-        ADD_TOKEN_IDENT_BOOL    ("over_18",       link->flags, REDDIT_LINK_OVER_18),
-        ADD_TOKEN_IDENT_BOOL    ("clicked",       link->flags, REDDIT_LINK_CLICKED),
-        ADD_TOKEN_IDENT_BOOL    ("stickied",      link->flags, REDDIT_LINK_STICKIED),
-        ADD_TOKEN_IDENT_BOOL    ("edited",        link->flags, REDDIT_LINK_EDITED),
-        ADD_TOKEN_IDENT_BOOL    ("hidden",        link->flags, REDDIT_LINK_HIDDEN),
-        ADD_TOKEN_IDENT_BOOL    ("distinguished", link->flags, REDDIT_LINK_DISTINGUISHED),
-        ADD_TOKEN_IDENT_DATE    ("created_utc",   link->created_utc),
-        {0}
-    };
+    if (parser->stringViews)
+        link->flags |= REDDIT_LINK_STRING_VIEWS;
 
-    parseTokens(parser, ids, link);
+    parseTokensSchema(parser, &linkSchema, link);
 
     return link;
 }
@@ -141,41 +197,56 @@ RedditLink *redditGetLink(TokenParser *parser)
     RedditLinkList *list = va_arg(args, RedditLinkList*);
 
 /*
- * When we encounter a 't3', which is a new RedditLink, we parse it with
- * redditGetLink, and then add it to our RedditLinkList
+ * Parses the 'data' of one 't3' in a listing, See tokenParseObjects
+ */
+static void *getListingLink (TokenParser *parser, void *data)
+{
+    return redditGetLink(parser);
+}
+
+/*
+ * Called on the 'children' array of a listing. Every 't3' in it is a new
+ * RedditLink, which are all parsed with redditGetLink (On more then one thread
+ * if the list asks for it), and then added to our RedditLinkList in order.
  */
-DEF_TOKEN_CALLBACK(getListingHelper)
+DEF_TOKEN_CALLBACK(getListingChildren)
 {
     ARG_LIST_GET_LISTING
+    int count = parser->tokens[parser->currentToken].size;
+    int linkCount = 0, i;
+    TokenThing *things;
+    int *objects;
+    void **links;
 
+    if (count == 0)
+        return ;
 
-    /* Search for the 'kind' ident, and check if it was set to 't3' */
-    int i;
-    for (i = 0; idents[i].name != NULL; i++)
-        if (strcmp(idents[i].name, "kind") == 0)
-            if (idents[i].value != NULL && strcmp(*((char**)idents[i].value), "t3") == 0)
-                redditLinkListAddLink(list, redditGetLink(parser));
+    things = rmalloc(count * sizeof(TokenThing));
+    objects = rmalloc(count * sizeof(int));
+    links = rmalloc(count * sizeof(void*));
+
+    count = tokenFindThings(parser, things);
+    for (i = 0; i < count; i++)
+        if (things[i].kind != -1 && things[i].data != -1 && tokenEquals(parser, things[i].kind, "t3"))
+            objects[linkCount++] = things[i].data;
+
+    tokenParseObjects(parser, linkCount, objects, list->parseThreads, getListingLink, NULL, links);
+
+    for (i = 0; i < linkCount; i++)
+        redditLinkListAddLink(list, links[i]);
 
+    free(links);
+    free(objects);
+    free(things);
 }
 
 /*
- * Gets the contents of a subreddit and adds them to 'list' -- If list already has elements in it
- * it will ask reddit to give us the next links in the list
- *
- * 'subreddit' should be in the form '/r/subreddit' or empty to indicate 'front'
+ * Creates the request for the contents of a subreddit. If 'list' already has
+ * elements in it, it will ask reddit to give us the next links in the list
  */
-EXPORT_SYMBOL RedditErrno redditGetListing (RedditLinkList *list)
+static RedditRequest *redditListingRequest (RedditLinkList *list)
 {
-    char subred[1024], *kindStr = NULL;
-    TokenParserResult res;
-
-    TokenIdent ids[] = {
-        ADD_TOKEN_IDENT_STRING("modhash", list->modhash),
-        ADD_TOKEN_IDENT_STRING("kind",    kindStr),
-        ADD_TOKEN_IDENT_FUNC  ("data",    getListingHelper),
-        ADD_TOKEN_IDENT_STRING("after",   list->afterId),
-        {0}
-    };
+    char subred[1024];
 
     strcpy(subred, REDDIT_URL);
     if (list->subreddit != NULL)
@@ -195,9 +266,119 @@ EXPORT_SYMBOL RedditErrno redditGetListing (RedditLinkList *list)
     if (list->linkCount > 0)
         sprintf(subred + strlen(subred), "?after=%s", list->afterId);
 
-    res = redditRunParser(subred, NULL, ids, list);
+    return redditRequestNew(subred, NULL);
+}
 
-    free(kindStr);
+/*
+ * Parses the tokens of a subreddit listing and adds the links onto 'list'
+ *
+ * For a 'zeroCopy' list the JSON text is taken from the parser afterwards,
+ * since the links point into it. For a list using an arena, the links are
+ * allocated out of it (Or out of it's children, when 'parseThreads' is set).
+ */
+void redditParseListing (TokenParser *parser, RedditLinkList *list)
+{
+    TokenIdent ids[] = {
+        ADD_TOKEN_IDENT_STRING ("modhash",  list->modhash),
+        ADD_TOKEN_IDENT_DESCEND("data"),
+        ADD_TOKEN_IDENT_STRING ("after",    list->afterId),
+        ADD_TOKEN_IDENT_FUNC   ("children", getListingChildren),
+        {0}
+    };
+
+    if (list->useArena && list->arena == NULL)
+        list->arena = redditArenaNew();
+
+    parser->stringViews = list->zeroCopy;
+    parser->arena = list->arena;
+    parseTokens(parser, ids, list);
+
+    if (list->zeroCopy) {
+        MemoryBlock *block = tokenParserTakeBlock(parser);
+        block->next = list->responses;
+        list->responses = block;
+    }
+}
+
+/*
+ * Parses the listing in 'block' (Which is freed, or kept by 'list' if it's
+ * 'zeroCopy') into 'list'. A NULL 'block' means the text couldn't be read.
+ */
+static RedditErrno redditParseListingBlock (RedditLinkList *list, MemoryBlock *block)
+{
+    RedditErrno err = REDDIT_ERROR_RESPONSE;
+    TokenParser *parser;
+
+    if (block == NULL)
+        return REDDIT_ERROR;
+
+    parser = tokenParserNewFromBlock(block);
+    if (parser->jsmnResult == JSMN_SUCCESS) {
+        redditParseListing(parser, list);
+        err = REDDIT_SUCCESS;
+    }
+
+    tokenParserFree(parser);
+    return err;
+}
+
+/*
+ * Parses a listing that's already been downloaded, instead of asking Reddit
+ * for it. 'json' is copied, so it doesn't have to stay around. Links are
+ * added onto 'list' the same way redditGetListing adds them.
+ */
+EXPORT_SYMBOL RedditErrno redditParseListingBuffer (RedditLinkList *list, const char *json, size_t len)
+{
+    MemoryBlock *block = memoryBlockNew();
+
+    memoryBlockAppend(block, json, len);
+    return redditParseListingBlock(list, block);
+}
+
+/*
+ * Same as redditParseListingBuffer, but for a listing saved in the file at
+ * 'path'. The file is mapped into memory instead of being read, so nothing is
+ * copied. Returns REDDIT_ERROR if the file can't be opened.
+ */
+EXPORT_SYMBOL RedditErrno redditParseListingFile (RedditLinkList *list, const char *path)
+{
+    return redditParseListingBlock(list, memoryBlockMapFile(path));
+}
+
+/*
+ * Handler for redditGetListingAsync. Parses the listing if we got one, and
+ * lets the caller know we're done
+ */
+static void getListingDone (RedditRequest *request, TokenParserResult res)
+{
+    RedditLinkList *list = request->object;
+    RedditErrno err = REDDIT_ERROR_RESPONSE;
+
+    if (res == TOKEN_PARSER_SUCCESS) {
+        redditParseListing(request->parser, list);
+        err = REDDIT_SUCCESS;
+    }
+
+    if (request->callback != NULL)
+        ((RedditLinkListCallback)request->callback)(list, err, request->data);
+}
+
+/*
+ * Gets the contents of a subreddit and adds them to 'list' -- If list already has elements in it
+ * it will ask reddit to give us the next links in the list
+ *
+ * 'subreddit' should be in the form '/r/subreddit' or empty to indicate 'front'
+ */
+EXPORT_SYMBOL RedditErrno redditGetListing (RedditLinkList *list)
+{
+    RedditRequest *request = redditListingRequest(list);
+    TokenParserResult res;
+
+    res = redditRequestWait(request);
+    if (res == TOKEN_PARSER_SUCCESS)
+        redditParseListing(request->parser, list);
+
+    redditRequestFree(request);
 
     if (res == TOKEN_PARSER_SUCCESS)
         return REDDIT_SUCCESS;
@@ -205,5 +386,25 @@ EXPORT_SYMBOL RedditErrno redditGetListing (RedditLinkList *list)
         return REDDIT_ERROR_RESPONSE;
 }
 
+/*
+ * Same as redditGetListing, but returns right away. 'callback' is called with
+ * 'data' once the links have been added to 'list'.
+ *
+ * 'list' has to stay valid until the callback is called.
+ */
+EXPORT_SYMBOL RedditRequest *redditGetListingAsync (RedditLinkList *list, RedditLinkListCallback callback, void *data)
+{
+    RedditRequest *request = redditListingRequest(list);
+
+    request->handler  = getListingDone;
+    request->object   = list;
+    request->callback = (RedditRequestCallback)callback;
+    request->data     = data;
+
+    redditRequestSubmit(request);
+
+    return request;
+}
+
 
 #endif
@@ -7,4 +7,7 @@
 
 RedditLink *redditGetLink (TokenParser *parser);
 
+/* Parses the tokens of a subreddit listing, adding the links onto 'list' */
+void redditParseListing (TokenParser *parser, RedditLinkList *list);
+
 #endif
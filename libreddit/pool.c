@@ -0,0 +1,167 @@
+#ifndef _REDDIT_POOL_C_
+#define _REDDIT_POOL_C_
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "global.h"
+#include "pool.h"
+
+/* Passed to each thread when it's started */
+struct RedditWorkerStart {
+    RedditWorkerPool *pool;
+    int               worker;
+};
+
+/*
+ * Takes jobs out of 'pool' until there are none left
+ */
+static void redditWorkerPoolWork (RedditWorkerPool *pool, int worker)
+{
+    int index;
+
+    while ((index = __atomic_fetch_add(&pool->nextJob, 1, __ATOMIC_RELAXED)) < pool->jobCount)
+        pool->job(pool->data, index, worker);
+}
+
+/*
+ * The loop each thread in a pool runs: Wait for a new run to start, help out
+ * with it, and let redditWorkerPoolRun know once there's nothing left to take
+ */
+static void *redditWorkerThread (void *arg)
+{
+    struct RedditWorkerStart *start = arg;
+    RedditWorkerPool *pool = start->pool;
+    int worker = start->worker;
+    unsigned int seen = 0;
+
+    free(start);
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+
+        if (pool->quit)
+            break;
+
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        redditWorkerPoolWork(pool, worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/*
+ * Creates a pool with 'threads' threads in total, counting the one that will
+ * be calling redditWorkerPoolRun. If a thread can't be started the pool just
+ * makes do with the ones that did.
+ */
+RedditWorkerPool *redditWorkerPoolNew (int threads)
+{
+    RedditWorkerPool *pool = rmalloc(sizeof(RedditWorkerPool));
+    struct RedditWorkerStart *start;
+    int i;
+
+    memset(pool, 0, sizeof(RedditWorkerPool));
+
+    if (threads > REDDIT_WORKER_POOL_MAX)
+        threads = REDDIT_WORKER_POOL_MAX;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    if (threads <= 1)
+        return pool;
+
+    pool->threads = rmalloc((threads - 1) * sizeof(pthread_t));
+    for (i = 0; i < threads - 1; i++) {
+        start = rmalloc(sizeof(struct RedditWorkerStart));
+        start->pool = pool;
+        start->worker = pool->threadCount + 1;
+
+        if (pthread_create(pool->threads + pool->threadCount, NULL, redditWorkerThread, start) != 0) {
+            free(start);
+            break;
+        }
+        pool->threadCount++;
+    }
+
+    return pool;
+}
+
+/*
+ * Stops every thread in 'pool', and frees it
+ */
+void redditWorkerPoolFree (RedditWorkerPool *pool)
+{
+    int i;
+
+    if (pool == NULL)
+        return ;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->threadCount; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->threads);
+    free(pool);
+}
+
+RedditWorkerPool *redditWorkerPoolGet (RedditState *state, int threads)
+{
+    if (threads > REDDIT_WORKER_POOL_MAX)
+        threads = REDDIT_WORKER_POOL_MAX;
+
+    if (state->workers != NULL && state->workers->threadCount + 1 != threads) {
+        redditWorkerPoolFree(state->workers);
+        state->workers = NULL;
+    }
+
+    if (state->workers == NULL)
+        state->workers = redditWorkerPoolNew(threads);
+
+    return state->workers;
+}
+
+void redditWorkerPoolRun (RedditWorkerPool *pool, int jobCount, RedditWorkerJob job, void *data)
+{
+    if (jobCount <= 0)
+        return ;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->data = data;
+    pool->jobCount = jobCount;
+    pool->nextJob = 0;
+    pool->busy = pool->threadCount;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    redditWorkerPoolWork(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _REDDIT_POOL_H_
+#define _REDDIT_POOL_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "reddit.h"
+
+/*
+ * The most threads a RedditWorkerPool will run at once, counting the thread
+ * that calls redditWorkerPoolRun. Asking for more just gets this many.
+ */
+#define REDDIT_WORKER_POOL_MAX 16
+
+/*
+ * A job run by redditWorkerPoolRun. 'index' is which of the jobs this is, and
+ * 'worker' is which thread it's running on (0 is the calling thread), so
+ * anything a thread needs to itself can be kept in an array indexed by it.
+ */
+typedef void (*RedditWorkerJob) (void *data, int index, int worker);
+
+/*
+ * A small pool of threads attached to a RedditState, used to parse the big
+ * pieces of a response at the same time (See tokenParseObjects). The threads
+ * are started once and sleep on 'start' until there's something to do.
+ *
+ * 'threadCount' is the number of threads in 'threads', which doesn't count
+ * the thread calling redditWorkerPoolRun (It does jobs too). Every run bumps
+ * 'generation' to wake the threads up, and jobs are handed out by taking the
+ * next index out of 'nextJob'. 'busy' is the number of threads still working
+ * on the current run.
+ */
+typedef struct RedditWorkerPool {
+    pthread_t *threads;
+    int        threadCount;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  start;
+    pthread_cond_t  done;
+
+    RedditWorkerJob job;
+    void           *data;
+    int             jobCount;
+    int             nextJob;
+    unsigned int    generation;
+    int             busy;
+    bool            quit;
+} RedditWorkerPool;
+
+RedditWorkerPool *redditWorkerPoolNew  (int threads);
+void              redditWorkerPoolFree (RedditWorkerPool *pool);
+
+/*
+ * Returns the pool of 'state', made so there are 'threads' threads in total
+ * (Counting the calling one). The pool is created the first time, and only
+ * recreated if a different number of threads is asked for.
+ */
+RedditWorkerPool *redditWorkerPoolGet (RedditState *state, int threads);
+
+/*
+ * Runs 'job' once for every index from 0 to 'jobCount - 1', spread over the
+ * threads of 'pool' and the calling thread, and returns once they've all
+ * finished. The jobs can run in any order.
+ *
+ * Note: Only one thread can be running jobs on a pool at a time.
+ */
+void redditWorkerPoolRun (RedditWorkerPool *pool, int jobCount, RedditWorkerJob job, void *data);
+
+#endif
@@ -0,0 +1,356 @@
+#ifndef _REDDIT_REQUEST_C_
+#define _REDDIT_REQUEST_C_
+
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+
+#include "global.h"
+#include "request.h"
+#include "connection.h"
+#include "cookie.h"
+
+/*
+ * Callback used by curl. The userp is a pointer to a TokenParser. This
+ * callback stores the JSON text that curl got back into the TokenParser's
+ * MemoryBlock, which grows as more memory is needed for the JSON.
+ *
+ * The new text is tokenized right away, so for large responses most of the
+ * tokenizing is already done by the time the download finishes.
+ */
+static size_t writeToParser(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    size_t realsize = size * nmemb;
+    TokenParser *parser = (TokenParser*)userp;
+
+    memoryBlockAppend(parser->block, contents, realsize);
+
+    tokenParserFeed(parser);
+
+    return realsize;
+}
+
+/*
+ * Returns the multi handle of the current state's pool, creating the pool if
+ * this state doesn't have one yet.
+ */
+static CURLM *redditMultiGet(RedditState *state)
+{
+    if (state->connections == NULL)
+        state->connections = redditConnectionPoolNew();
+
+    return state->connections->multi;
+}
+
+/*
+ * Sets up a new request. This does all of the curl setup, so the request is
+ * ready to go as soon as it's submitted.
+ *
+ * 'url' is the url of the JSON you want. Ex. www.reddit.com/.json
+ * 'post' is any text that should be sent in a POST request. If you want to
+ *        do a GET, set this to NULL.
+ */
+RedditRequest *redditRequestNew(const char *url, const char *post)
+{
+    RedditRequest *request = rmalloc(sizeof(RedditRequest));
+    char *cookieStr = NULL;
+    char fullUseragent[1024];
+
+    memset(request, 0, sizeof(RedditRequest));
+    request->state  = currentRedditState;
+    request->parser = tokenParserGet(request->state);
+    request->handle = redditConnectionGet(request->state);
+
+    DEBUG_PRINT(L"Grabbing %s\n", url);
+    if (post)
+        DEBUG_PRINT(L"Post: %s\n", post);
+
+    /* Sets up curl to get 'url' and use writeToParser as the callback writer */
+    curl_easy_setopt(request->handle, CURLOPT_URL, url);
+    curl_easy_setopt(request->handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(request->handle, CURLOPT_WRITEFUNCTION, writeToParser);
+    curl_easy_setopt(request->handle, CURLOPT_WRITEDATA, (void *)request->parser);
+    curl_easy_setopt(request->handle, CURLOPT_PRIVATE, (void *)request);
+
+    /* This gets and sets any cookies, if any are currently in the global state */
+    cookieStr = redditGetCookieString();
+    if (cookieStr != NULL)
+        curl_easy_setopt(request->handle, CURLOPT_COOKIE, cookieStr);
+
+    /* If we're doing a POST, then this sets curl to use POST and gives it a
+     * copy of the text to use, since the request may outlive 'post' */
+    if (post != NULL) {
+        curl_easy_setopt(request->handle, CURLOPT_POST, 1L);
+        curl_easy_setopt(request->handle, CURLOPT_COPYPOSTFIELDS, post);
+    }
+
+    /* Set the user agent, A combo of libreddit's useragent and the program
+     * using libreddit's useragent */
+    strcpy(fullUseragent, LIBREDDIT_USERAGENT);
+    strcat(fullUseragent, request->state->userAgent);
+    curl_easy_setopt(request->handle, CURLOPT_USERAGENT, fullUseragent);
+
+    free(cookieStr);
+
+    return request;
+}
+
+/*
+ * Takes a finished request off of the pool's 'finished' list
+ */
+static void redditRequestUnqueue(RedditRequest *request)
+{
+    RedditRequest **link;
+
+    for (link = &request->state->connections->finished; *link != NULL; link = &(*link)->next) {
+        if (*link == request) {
+            *link = request->next;
+            break;
+        }
+    }
+
+    request->next = NULL;
+    request->queued = 0;
+}
+
+/*
+ * Frees a request. If it's still running it is stopped first, and its handler
+ * is never called.
+ */
+void redditRequestFree(RedditRequest *request)
+{
+    if (request == NULL)
+        return ;
+
+    if (request->release != NULL)
+        request->release(request);
+
+    if (request->queued)
+        redditRequestUnqueue(request);
+
+    if (request->handle != NULL) {
+        if (request->submitted) {
+            curl_multi_remove_handle(request->state->connections->multi, request->handle);
+            request->state->connections->activeCount--;
+        }
+        redditConnectionRelease(request->state, request->handle);
+    }
+
+    tokenParserRelease(request->state, request->parser);
+    free(request);
+}
+
+void redditRequestSubmit(RedditRequest *request)
+{
+    if (request->submitted)
+        return ;
+
+    request->submitted = 1;
+    curl_multi_add_handle(redditMultiGet(request->state), request->handle);
+    request->state->connections->activeCount++;
+}
+
+/*
+ * Turns the result of the transfer into a TokenParserResult. The JSON was
+ * tokenized as it came in, so all that's left is to check jsmn got all of it.
+ */
+TokenParserResult redditRequestResult(RedditRequest *request)
+{
+    TokenParser *parser = request->parser;
+
+    /* If we didn't get any memory back for whatever reason, it's an error */
+    if (request->curlResult != CURLE_OK || parser->block->size <= 0 || parser->block->memory == NULL)
+        return TOKEN_PARSER_CURL_FAIL;
+
+    if (parser->jsmnResult != JSMN_SUCCESS)
+        return TOKEN_PARSER_JSON_FAIL;
+
+    return TOKEN_PARSER_SUCCESS;
+}
+
+/*
+ * Called when curl reports a request as done. The handle goes straight back
+ * into the pool so the next request can use its connection.
+ *
+ * Requests nobody is waiting on are put at the end of the pool's 'finished'
+ * list, for redditAsyncPerform to hand to their handler.
+ */
+static void redditRequestDone(RedditRequest *request, CURLcode result)
+{
+    RedditState *state = request->state;
+    RedditRequest **link;
+
+    curl_multi_remove_handle(state->connections->multi, request->handle);
+    state->connections->activeCount--;
+    redditConnectionRelease(state, request->handle);
+
+    request->handle = NULL;
+    request->curlResult = result;
+    request->done = 1;
+
+    if (request->blocking)
+        return ;
+
+    for (link = &state->connections->finished; *link != NULL; link = &(*link)->next)
+        ;
+
+    *link = request;
+    request->next = NULL;
+    request->queued = 1;
+}
+
+/*
+ * Runs the transfers on 'multi' as far as they can go without blocking, and
+ * marks any that finished as done. No handlers are called from in here.
+ */
+static void redditMultiRun(CURLM *multi)
+{
+    RedditRequest *request;
+    CURLMsg *msg;
+    int running, left;
+
+    curl_multi_perform(multi, &running);
+
+    while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&request);
+        redditRequestDone(request, msg->data.result);
+    }
+}
+
+/*
+ * Only 'request' is finished off in here. Anything else that finishes in the
+ * meantime stays on the 'finished' list until the caller's next
+ * redditAsyncPerform, so no unrelated handler runs in the middle of a
+ * blocking call.
+ */
+TokenParserResult redditRequestWait(RedditRequest *request)
+{
+    request->blocking = 1;
+    redditRequestSubmit(request);
+
+    while (!request->done) {
+        redditRequestPerform(request->state);
+        if (!request->done)
+            redditRequestPoll(request->state, 1000);
+    }
+
+    return redditRequestResult(request);
+}
+
+void redditRequestPerform(RedditState *state)
+{
+    redditMultiRun(redditMultiGet(state));
+}
+
+void redditRequestPoll(RedditState *state, int timeoutMs)
+{
+    curl_multi_wait(redditMultiGet(state), NULL, 0, timeoutMs, NULL);
+}
+
+/*
+ * Adds the file descriptors curl is currently waiting on to the passed sets,
+ * for use with select(). 'maxfd' is set to the highest descriptor added, or -1
+ * if there are none right now (In which case you should wait for at most
+ * redditAsyncTimeout() before calling redditAsyncPerform anyway).
+ */
+EXPORT_SYMBOL RedditErrno redditAsyncFdset(fd_set *readSet, fd_set *writeSet, fd_set *exceptSet, int *maxfd)
+{
+    *maxfd = -1;
+
+    if (currentRedditState == NULL)
+        return REDDIT_ERROR;
+
+    if (curl_multi_fdset(redditMultiGet(currentRedditState), readSet, writeSet, exceptSet, maxfd) != CURLM_OK)
+        return REDDIT_ERROR;
+
+    return REDDIT_SUCCESS;
+}
+
+/*
+ * Returns how long in milliseconds the caller can wait before calling
+ * redditAsyncPerform, or -1 if there's nothing that needs to happen. If a
+ * request finished during a blocking call and still needs it's handler
+ * called, that's right away.
+ */
+EXPORT_SYMBOL long redditAsyncTimeout()
+{
+    long timeout = -1;
+
+    if (currentRedditState == NULL)
+        return -1;
+
+    curl_multi_timeout(redditMultiGet(currentRedditState), &timeout);
+
+    if (currentRedditState->connections->finished != NULL)
+        return 0;
+
+    return timeout;
+}
+
+/*
+ * Drives every running request as far as it can go without blocking, and
+ * calls the handlers of any requests that finished, including ones that
+ * finished during a blocking call since the last time this was called.
+ *
+ * A handler can make a blocking call of it's own, which can add more
+ * requests to the 'finished' list. Those are handled before this returns.
+ *
+ * Returns the number of requests that are still running.
+ */
+EXPORT_SYMBOL int redditAsyncPerform()
+{
+    RedditConnectionPool *pool;
+    RedditRequest *request;
+
+    if (currentRedditState == NULL)
+        return 0;
+
+    redditMultiRun(redditMultiGet(currentRedditState));
+    pool = currentRedditState->connections;
+
+    while ((request = pool->finished) != NULL) {
+        redditRequestUnqueue(request);
+
+        if (request->handler != NULL)
+            request->handler(request, redditRequestResult(request));
+
+        redditRequestFree(request);
+    }
+
+    return pool->activeCount;
+}
+
+/*
+ * A simple way to wait for something to happen on the running requests when
+ * you don't have an event loop of your own. Blocks for at most 'timeoutMs'
+ * milliseconds. Call redditAsyncPerform after it returns.
+ */
+EXPORT_SYMBOL void redditAsyncWait(int timeoutMs)
+{
+    CURLM *multi;
+
+    if (currentRedditState == NULL)
+        return ;
+
+    multi = redditMultiGet(currentRedditState);
+
+    /* There's already something for redditAsyncPerform to do */
+    if (currentRedditState->connections->finished != NULL)
+        return ;
+
+    curl_multi_wait(multi, NULL, 0, timeoutMs, NULL);
+}
+
+/*
+ * Stops a request started with one of the Async calls. Its callback won't be
+ * called. Only valid until the callback would have been called.
+ */
+EXPORT_SYMBOL void redditRequestCancel(RedditRequest *request)
+{
+    redditRequestFree(request);
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef _REDDIT_REQUEST_H_
+#define _REDDIT_REQUEST_H_
+
+#include <curl/curl.h>
+
+#include "reddit.h"
+#include "token.h"
+
+/*
+ * A generic function pointer for the caller's completion callback. Each type
+ * of request stores its own callback type in here and casts it back in its
+ * handler (Ex. RedditLinkListCallback for a listing)
+ */
+typedef void (*RedditRequestCallback) (void);
+
+/*
+ * Called once a request has finished and its JSON has been tokenized. It
+ * should parse the tokens into 'request->object' and then call the caller's
+ * callback. 'result' is the result of getting and tokenizing the JSON, if it's
+ * not TOKEN_PARSER_SUCCESS there is nothing to parse.
+ */
+typedef void (*RedditRequestHandler) (struct RedditRequest *request, TokenParserResult result);
+
+/*
+ * Called by redditRequestFree, whether the request finished or was
+ * cancelled, so anything the request is holding onto in 'object' can be
+ * given back or freed.
+ */
+typedef void (*RedditRequestRelease) (struct RedditRequest *request);
+
+/*
+ * A single request to Reddit, running on the multi handle of a RedditState.
+ *
+ * 'handle' is an easy handle out of the state's connection pool, the
+ * response from Reddit is written into 'parser'.
+ *
+ * 'handler', 'object', 'callback' and 'data' are only used for requests run
+ * asynchronously. Blocking requests are waited on by redditRequestWait and
+ * parsed by whoever called it. 'release' is used by either kind, if it's set.
+ *
+ * 'next' links the request into the pool's 'finished' list while it waits
+ * for its handler to be called, which 'queued' is set for.
+ */
+struct RedditRequest {
+    RedditState *state;
+    CURL        *handle;
+    TokenParser *parser;
+
+    CURLcode curlResult;
+    unsigned int submitted : 1;
+    unsigned int done      : 1;
+    unsigned int blocking  : 1;
+    unsigned int queued    : 1;
+
+    RedditRequestHandler  handler;
+    RedditRequestRelease  release;
+    void                 *object;
+    RedditRequestCallback callback;
+    void                 *data;
+
+    RedditRequest *next;
+};
+
+/*
+ * Creates a request for 'url', doing a POST with 'post' if it's not NULL,
+ * using the current global state. Nothing is sent until it's submitted.
+ */
+RedditRequest *redditRequestNew  (const char *url, const char *post);
+void           redditRequestFree (RedditRequest *request);
+
+/*
+ * Starts running a request in the background. When it finishes its handler is
+ * called from inside of redditAsyncPerform, and the request is then freed.
+ */
+void redditRequestSubmit (RedditRequest *request);
+
+/*
+ * Blocks until 'request' is finished, and then tokenizes the response. The
+ * request isn't freed, so the caller can parse 'request->parser' before
+ * calling redditRequestFree on it.
+ *
+ * Other requests keep running while this waits, but the handlers of any that
+ * finish aren't called from in here. They're left for the next call to
+ * redditAsyncPerform, so a blocking call never runs unrelated callbacks.
+ */
+TokenParserResult redditRequestWait (RedditRequest *request);
+
+/*
+ * For blocking calls that run more than one request at once: Submit each one
+ * with 'blocking' set, and then call redditRequestPerform until their 'done'
+ * is set, with redditRequestPoll in between to wait at most 'timeoutMs' for
+ * something to happen. Like redditRequestWait, no handlers are called, other
+ * requests that finish are left for the next redditAsyncPerform.
+ *
+ * redditRequestResult returns the result of a request once it's done.
+ */
+void              redditRequestPerform (RedditState *state);
+void              redditRequestPoll    (RedditState *state, int timeoutMs);
+TokenParserResult redditRequestResult  (RedditRequest *request);
+
+#endif
@@ -4,6 +4,9 @@
 #include <stdlib.h>
 
 #include "state.h"
+#include "connection.h"
+#include "token.h"
+#include "pool.h"
 /*
  * Include reddit library globals
  */
@@ -20,6 +23,11 @@ EXPORT_SYMBOL RedditState *redditStateNew()
     state = rmalloc(sizeof(RedditState));
     state->base = NULL;
     state->userAgent = NULL;
+    state->connections = NULL;
+    state->spareParser = NULL;
+    state->workers = NULL;
+    state->connectionsNew = 0;
+    state->connectionsReused = 0;
 
     return state;
 }
@@ -42,6 +50,14 @@ EXPORT_SYMBOL void redditStateFree(RedditState *state)
 
     free(state->userAgent);
 
+    /* Close any connections still open in the pool */
+    redditConnectionPoolFree(state->connections);
+
+    tokenParserFree(state->spareParser);
+
+    /* Stop the threads used for parsing, if any were started */
+    redditWorkerPoolFree(state->workers);
+
     /* Free the actual state */
     free(state);
 }
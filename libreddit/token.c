@@ -3,12 +3,18 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <curl/curl.h>
+#include <limits.h>
 #include <wchar.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "global.h"
 #include "token.h"
-#include "cookie.h"
+#include "request.h"
+#include "arena.h"
+#include "pool.h"
 
 /*
  * Returns a pointer to valid new MemoryBlock
@@ -19,9 +25,112 @@ MemoryBlock *memoryBlockNew()
     block->memory = rmalloc(1);
     block->memory[0] = 0;
     block->size   = 0;
+    block->alloc  = 1;
+    block->mapped = false;
+    block->next   = NULL;
     return block;
 }
 
+/*
+ * The text is mapped with room for a nul after it, like any other block. The
+ * whole range is mapped as zeroed memory first and then the file is mapped
+ * over the start of it, so the byte after the text is there (And 0) even when
+ * the file ends right at the end of a page.
+ *
+ * The mapping is private and writable, since parsing with string views
+ * writes nul's into the text. Only the pages written to get copied.
+ */
+MemoryBlock *memoryBlockMapFile(const char *path)
+{
+    MemoryBlock *block;
+    struct stat st;
+    char *memory;
+    size_t len;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    len = st.st_size;
+    memory = mmap(NULL, len + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    if (len > 0 && mmap(memory, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(memory, len + 1);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    block = rmalloc(sizeof(MemoryBlock));
+    block->memory = memory;
+    block->size   = len;
+    block->alloc  = len + 1;
+    block->mapped = true;
+    block->next   = NULL;
+    return block;
+}
+
+/*
+ * Frees a MemoryBlock along with every block chained after it
+ */
+void memoryBlockFreeChain(MemoryBlock *block)
+{
+    MemoryBlock *next;
+
+    for (; block != NULL; block = next) {
+        next = block->next;
+        memoryBlockFree(block);
+    }
+}
+
+/*
+ * Adds 'len' bytes of 'text' to the end of a MemoryBlock, keeping it nul
+ * terminated. The memory at least doubles when it has to grow, since
+ * responses are added a small chunk at a time.
+ */
+void memoryBlockAppend(MemoryBlock *block, const char *text, size_t len)
+{
+    size_t newAlloc = block->alloc;
+    char *memory;
+
+    /* A mapped file can't grow, so it's moved into normal memory first */
+    if (block->mapped) {
+        memory = rmalloc(block->size + 1);
+        memcpy(memory, block->memory, block->size + 1);
+        munmap(block->memory, block->alloc);
+
+        block->memory = memory;
+        block->alloc = block->size + 1;
+        block->mapped = false;
+        newAlloc = block->alloc;
+    }
+
+    if (block->size + len + 1 > block->alloc) {
+        if (newAlloc < 4096)
+            newAlloc = 4096;
+
+        while (newAlloc < block->size + len + 1)
+            newAlloc *= 2;
+
+        block->memory = rrealloc(block->memory, newAlloc);
+        block->alloc = newAlloc;
+    }
+
+    memcpy(block->memory + block->size, text, len);
+    block->size += len;
+    block->memory[block->size] = 0;
+}
+
 /*
  * Frees a MemoryBlock returned by memoryBlockNew()
  */
@@ -29,7 +138,11 @@ void memoryBlockFree(MemoryBlock *block)
 {
     if (block == NULL)
         return ;
-    free(block->memory);
+
+    if (block->mapped)
+        munmap(block->memory, block->alloc);
+    else
+        free(block->memory);
     free(block);
 }
 
@@ -41,6 +154,22 @@ TokenParser *tokenParserNew()
     TokenParser *parser = rmalloc(sizeof(TokenParser));
     memset(parser, 0, sizeof(TokenParser));
     parser->block = memoryBlockNew();
+    jsmn_init(&parser->jsmnParser);
+    parser->jsmnResult = JSMN_ERROR_PART;
+#ifdef REDDIT_JSMN_INDEXED
+    parser->indexed = true;
+#endif
+    return parser;
+}
+
+TokenParser *tokenParserNewFromBlock(MemoryBlock *block)
+{
+    TokenParser *parser = tokenParserNew();
+
+    memoryBlockFree(parser->block);
+    parser->block = block;
+    tokenParserCreateTokens(parser);
+
     return parser;
 }
 
@@ -55,41 +184,203 @@ void tokenParserFree(TokenParser *parser)
     free(parser->tokens);
     free(parser);
 }
+
 /*
- * This function takes a TokenParser with an already full MemoryBlock
- * and runs jsmn over it to tokenize the JSON. Because jsmn doesn't do
- * any allocation on it's own, this function keeps looping over jsmn_parse
- * while it returns out of memory errors and then allocates more memory
- * and runs it again
- *
- * It returns the state jsmn_parse returned.
+ * Returns a TokenParser for a new request made with 'state'. If an earlier
+ * request left its parser behind, that one is handed out again so its token
+ * array doesn't have to be allocated and grown all over again.
  */
-static jsmnerr_t tokenParserCreateTokens(TokenParser *parser)
+TokenParser *tokenParserGet(RedditState *state)
 {
-    jsmn_parser jsmnParser;
-    jsmnerr_t result;
-    const int chunk_size = 100;
+    TokenParser *parser;
 
-    if (parser->tokens == NULL) {
-        parser->tokens = rmalloc(chunk_size * sizeof(jsmntok_t));
-        parser->tokenCount = chunk_size;
-    }
+    if (state == NULL || state->spareParser == NULL)
+        return tokenParserNew();
 
-    memset(parser->tokens, 0, parser->tokenCount * sizeof(jsmntok_t));
-    jsmn_init(&jsmnParser);
+    parser = state->spareParser;
+    state->spareParser = NULL;
+    return parser;
+}
 
-    while ((result = jsmn_parse(&jsmnParser, parser->block->memory, parser->tokens, parser->tokenCount)) == JSMN_ERROR_NOMEM) {
-        parser->tokenCount += chunk_size;
-        parser->tokens = rrealloc(parser->tokens, parser->tokenCount * sizeof(jsmntok_t));
-        memset(parser->tokens + parser->tokenCount - chunk_size, 0, chunk_size * sizeof(jsmntok_t));
+/*
+ * Gives a parser back to 'state' once it's done with. The token array and
+ * the memory for the text are kept, everything else is reset. If the state
+ * is already holding a parser, the one with the bigger token array is kept.
+ */
+void tokenParserRelease(RedditState *state, TokenParser *parser)
+{
+    if (parser == NULL)
+        return ;
+
+    if (state == NULL) {
+        tokenParserFree(parser);
+        return ;
     }
 
-    if (result != JSMN_SUCCESS)
+    if (state->spareParser != NULL) {
+        if (state->spareParser->tokenAlloc >= parser->tokenAlloc) {
+            tokenParserFree(parser);
+            return ;
+        }
+        tokenParserFree(state->spareParser);
+    }
+
+    parser->block->size = 0;
+    parser->block->memory[0] = 0;
+    parser->tokenCount = 0;
+    parser->currentToken = 0;
+    parser->tokensVisited = 0;
+    parser->stringViews = false;
+    parser->arena = NULL;
+    jsmn_init(&parser->jsmnParser);
+    parser->jsmnResult = JSMN_ERROR_PART;
+
+    state->spareParser = parser;
+}
+
+MemoryBlock *tokenParserTakeBlock(TokenParser *parser)
+{
+    MemoryBlock *block = parser->block;
+
+    parser->block = memoryBlockNew();
+    return block;
+}
+
+/*
+ * Makes sure there's room for at least 'count' tokens in the parser. The
+ * array at least doubles every time it grows, so a response that needs 'n'
+ * tokens only ever causes about log(n) reallocs, even when it shows up a
+ * little bit at a time.
+ */
+static void tokenParserReserve(TokenParser *parser, int count)
+{
+    const int min_size = 256;
+    int newAlloc = parser->tokenAlloc;
+
+    if (count <= parser->tokenAlloc)
+        return ;
+
+    if (newAlloc < min_size)
+        newAlloc = min_size;
+
+    while (newAlloc < count)
+        newAlloc *= 2;
+
+    parser->tokens = rrealloc(parser->tokens, newAlloc * sizeof(jsmntok_t));
+    parser->tokenAlloc = newAlloc;
+}
+
+/*
+ * Stores the result of a call to jsmn_parse in the parser, and returns it as
+ * a jsmnerr_t.
+ */
+static jsmnerr_t tokenParserSetResult(TokenParser *parser, int result)
+{
+    /* Empty text isn't any use to us either */
+    if (result == 0)
+        result = JSMN_ERROR_PART;
+
+    if (result < 0) {
         parser->tokenCount = 0;
+        parser->jsmnResult = result;
+    } else {
+        parser->tokenCount = result;
+        parser->jsmnResult = JSMN_SUCCESS;
+    }
+
+    return parser->jsmnResult;
+}
+
+/*
+ * Runs whichever version of jsmn the parser uses from the state in
+ * 'jsmnParser', See tokenParserRun
+ */
+static int tokenParserJsmn(TokenParser *parser, jsmn_parser *jsmnParser, jsmntok_t *tokens, unsigned int count)
+{
+    if (parser->indexed)
+        return jsmn_parse_indexed(jsmnParser, parser->block->memory, parser->block->size, tokens, count);
     else
-        parser->tokenCount = jsmnParser.toknext - 1;
+        return jsmn_parse(jsmnParser, parser->block->memory, tokens, count);
+}
 
-    return result;
+/*
+ * Runs jsmn over any text in the parser's MemoryBlock it hasn't seen yet.
+ * Because jsmn doesn't do any allocation on it's own, this keeps looping over
+ * jsmn_parse while it returns out of memory errors, grows the token array,
+ * and runs it again. jsmn picks up where it stopped every time, so no text is
+ * tokenized twice. If the parser is 'indexed', the indexed version of jsmn is
+ * used for all of it, which only looks at the text of strings 64 bytes at a
+ * time instead of a byte at a time.
+ *
+ * If 'whole' is set, all of the text is already in the MemoryBlock, so when
+ * jsmn runs out of tokens the rest of the text is guessed at going by how
+ * many tokens the text so far needed. The array is grown to that guess, but
+ * never more than doubled (The first few hundred tokens say little about the
+ * rest) or by less than an eighth. The last time it grows the guess is made
+ * from most of the text, so the array ends up just about the size needed
+ * without a second scan of the text to count it.
+ */
+static jsmnerr_t tokenParserRun(TokenParser *parser, bool whole)
+{
+    int result, needed;
+    double perByte;
+
+    /* Once jsmn says the JSON is invalid, there's no point in going on */
+    if (parser->jsmnResult != JSMN_SUCCESS && parser->jsmnResult != JSMN_ERROR_PART)
+        return parser->jsmnResult;
+
+    tokenParserReserve(parser, 1);
+
+    while ((result = tokenParserJsmn(parser, &parser->jsmnParser, parser->tokens, parser->tokenAlloc)) == JSMN_ERROR_NOMEM) {
+        if (!whole || parser->jsmnParser.pos == 0) {
+            tokenParserReserve(parser, parser->tokenAlloc + 1);
+            continue;
+        }
+
+        perByte = (double)parser->jsmnParser.toknext / parser->jsmnParser.pos;
+        needed = parser->jsmnParser.toknext + (int)(perByte * (parser->block->size - parser->jsmnParser.pos)) + 16;
+        if (needed > parser->tokenAlloc * 2)
+            needed = parser->tokenAlloc * 2;
+        else if (needed < parser->tokenAlloc + parser->tokenAlloc / 8)
+            needed = parser->tokenAlloc + parser->tokenAlloc / 8;
+
+        parser->tokens = rrealloc(parser->tokens, needed * sizeof(jsmntok_t));
+        parser->tokenAlloc = needed;
+    }
+
+    return tokenParserSetResult(parser, result);
+}
+
+/*
+ * Tokenizes any JSON added to the parser's MemoryBlock since the last call.
+ * This is called as a response comes in, so the token array just grows as
+ * needed.
+ *
+ * If the JSON isn't all there yet this returns JSMN_ERROR_PART, and it can be
+ * called again after more text has been added to the MemoryBlock.
+ *
+ * It returns the state jsmn_parse returned.
+ */
+jsmnerr_t tokenParserFeed(TokenParser *parser)
+{
+    return tokenParserRun(parser, false);
+}
+
+/*
+ * This function takes a TokenParser with an already full MemoryBlock
+ * and runs jsmn over it from the start to tokenize the JSON.
+ *
+ * Since all of the text is there, the token array is grown to a guess at
+ * the size it needs instead of doubling, See tokenParserRun.
+ *
+ * It returns the state jsmn_parse returned.
+ */
+jsmnerr_t tokenParserCreateTokens(TokenParser *parser)
+{
+    jsmn_init(&parser->jsmnParser);
+    parser->jsmnResult = JSMN_ERROR_PART;
+
+    return tokenParserRun(parser, true);
 }
 
 /*
@@ -109,23 +400,137 @@ char *getCopyOfToken(const char *json, jsmntok_t token)
 }
 
 /*
- * Callback used by curl. The userp is a pointer to a TokenParser. This
- * callback stores the JSON text that curl got back into the TokenParser. It
- * reallocates the size of the memory buffer as more memory is needed for the
- * JSON.
+ * Copies the text of a token into 'buf', which is 'size' bytes long, cutting
+ * it off if it doesn't fit. This is for short values like numbers, so they can
+ * be read without allocating anything.
  */
-static size_t writeToParser(void *contents, size_t size, size_t nmemb, void *userp)
+static char *tokenToBuffer(const char *json, const jsmntok_t *token, char *buf, size_t size)
 {
-    size_t realsize = size * nmemb;
-    TokenParser *parser = (TokenParser*)userp;
+    size_t len = token->end - token->start;
 
-    parser->block->memory = rrealloc(parser->block->memory, parser->block->size + realsize + 1);
+    if (len > size - 1)
+        len = size - 1;
 
-    memcpy(parser->block->memory + parser->block->size, contents, realsize);
-    parser->block->size += realsize;
-    parser->block->memory[parser->block->size] = 0;
+    memcpy(buf, json + token->start, len);
+    buf[len] = 0;
+    return buf;
+}
 
-    return realsize;
+/*
+ * Powers of ten that a double holds exactly, for tokenDouble's fast path
+ */
+static const double tokenPow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * Reads the number in a token as a double, straight out of the JSON text.
+ * Anything that isn't a number (Ex. 'null') reads as 0.
+ *
+ * When the digits fit in a double exactly and the exponent is small, one
+ * multiply or divide gives the correctly rounded result. Anything else is
+ * rare enough to just be copied out and given to strtod.
+ */
+double tokenDouble(const char *json, const jsmntok_t *token)
+{
+    const char *cur = json + token->start, *end = json + token->end;
+    unsigned long long digits = 0;
+    int significant = 0, exponent = 0, expValue = 0;
+    bool negative = false, expNegative = false;
+    char buf[64];
+    double value;
+
+    if (cur < end && *cur == '-') {
+        negative = true;
+        cur++;
+    }
+
+    for (; cur < end && *cur >= '0' && *cur <= '9'; cur++) {
+        if (significant < 19) {
+            digits = digits * 10 + (*cur - '0');
+            if (digits)
+                significant++;
+        } else {
+            exponent++;
+        }
+    }
+
+    if (cur < end && *cur == '.') {
+        for (cur++; cur < end && *cur >= '0' && *cur <= '9'; cur++) {
+            if (significant < 19) {
+                digits = digits * 10 + (*cur - '0');
+                exponent--;
+                if (digits)
+                    significant++;
+            }
+        }
+    }
+
+    if (cur < end && (*cur == 'e' || *cur == 'E')) {
+        cur++;
+        if (cur < end && (*cur == '-' || *cur == '+'))
+            expNegative = (*cur++ == '-');
+
+        for (; cur < end && *cur >= '0' && *cur <= '9'; cur++)
+            if (expValue < 10000)
+                expValue = expValue * 10 + (*cur - '0');
+
+        exponent += expNegative ? -expValue : expValue;
+    }
+
+    if (significant >= 19 || digits > (1ULL << 53) || exponent < -22 || exponent > 22) {
+        return strtod(tokenToBuffer(json, token, buf, sizeof(buf)), NULL);
+    }
+
+    value = (double)digits;
+    if (exponent < 0)
+        value /= tokenPow10[-exponent];
+    else
+        value *= tokenPow10[exponent];
+
+    return negative ? -value : value;
+}
+
+/*
+ * Reads the number in a token as a 64-bit integer, straight out of the JSON
+ * text. Numbers too big for it are clamped, numbers with a fraction or an
+ * exponent (Ex. Reddit's '1380000000.0' dates) lose the fraction, and
+ * anything that isn't a number (Ex. 'null') reads as 0.
+ */
+long long tokenInt64(const char *json, const jsmntok_t *token)
+{
+    const char *cur = json + token->start, *end = json + token->end;
+    unsigned long long value = 0, limit;
+    bool negative = false;
+    double real;
+
+    if (cur < end && *cur == '-') {
+        negative = true;
+        cur++;
+    }
+
+    limit = negative ? (unsigned long long)LLONG_MAX + 1 : LLONG_MAX;
+    for (; cur < end && *cur >= '0' && *cur <= '9'; cur++) {
+        if (value > (limit - (*cur - '0')) / 10)
+            value = limit;
+        else
+            value = value * 10 + (*cur - '0');
+    }
+
+    if (cur < end && (*cur == '.' || *cur == 'e' || *cur == 'E')) {
+        real = tokenDouble(json, token);
+        if (real >= 9223372036854775807.0)
+            return LLONG_MAX;
+        if (real <= -9223372036854775808.0)
+            return LLONG_MIN;
+        return (long long)real;
+    }
+
+    if (negative)
+        return (value == (unsigned long long)LLONG_MAX + 1) ? LLONG_MIN : -(long long)value;
+
+    return value;
 }
 
 /*
@@ -168,110 +573,205 @@ EXPORT_SYMBOL char *redditCopyString(const char *string)
         va_end(argsCopy);                                       \
     } while (0)
 
+/*
+ * Returns a string for the contents of a token. If 'view' is set it points
+ * right into the JSON text, which gets a nul written over the character right
+ * after the token (The closing quote of a string, or the comma or bracket
+ * after anything else). jsmn is done with the text by the time it's parsed,
+ * so that's safe. Otherwise it's a copy allocated from 'arena' (Or with
+ * rmalloc if that's NULL).
+ */
+static char *tokenString(char *json, jsmntok_t *token, bool view, RedditArena *arena)
+{
+    if (!view)
+        return redditArenaCopy(arena, json + token->start, token->end - token->start);
+
+    json[token->end] = 0;
+    return json + token->start;
+}
+
+/*
+ * Sets the member at 'value' to the current token, which is the value of a
+ * key that was found. 'type', 'bitMask', 'freeFlag' and 'listOwned' are the
+ * same as in a TokenIdent, and say how to cast and assign it.
+ */
+static void tokenSetValue(TokenParser *p, int type, void *value, unsigned int bitMask, bool freeFlag, bool listOwned)
+{
+    long long number;
+    bool view = listOwned && p->stringViews;
+    RedditArena *arena = listOwned ? p->arena : NULL;
+
+    switch(type) {
+    case TOKEN_BOOL:
+        if (TOKEN_IS_TRUE(p->block->memory, p->tokens[p->currentToken]))
+            *((unsigned int *)value) |= bitMask;
+        else
+            *((unsigned int *)value) &= ~bitMask;
+
+        break;
+    case TOKEN_INT:
+        number = tokenInt64(p->block->memory, p->tokens + p->currentToken);
+        if (number > INT_MAX)
+            number = INT_MAX;
+        else if (number < INT_MIN)
+            number = INT_MIN;
+
+        *((int*)value) = number;
+        break;
+    case TOKEN_INT64:
+        *((long long*)value) = tokenInt64(p->block->memory, p->tokens + p->currentToken);
+        break;
+    case TOKEN_STRING:
+    case TOKEN_OBJECT:
+        if (freeFlag && !view && arena == NULL)
+            free(*((char**)value));
+
+        *((char**)value) = tokenString(p->block->memory, p->tokens + p->currentToken, view, arena);
+        break;
+    case TOKEN_DATE:
+        /* Reddit sends dates as a float, Ex. '1380000000.0', only the
+         * whole seconds are kept */
+        *((time_t*)value) = tokenInt64(p->block->memory, p->tokens + p->currentToken);
+        break;
+    }
+}
+
 /*
  * This function handles the bulk of the token parser work. It 'performs' the action
- * specified by a TokenIdent.
+ * specified by a TokenIdent, once vparseTokens has found that the current
+ * token is the key it's looking for.
  *
- * When called, it checks if the current token has an equal name to the current
- * TokenIdent. If it does, then it checks the tokens action and calls the
- * callback on a TOKEN_CHECK_CALL, else it checks for TOKEN_SET and does proper
- * casting and assignments in those cases depending on the type of token.
- */
-int performIdentAction(TokenParser *p, TokenIdent *identifiers, int i, va_list args)
-{
-    char *tmp = NULL;
-    int performedAction = 0, len;
-
-    time_t created_time_t;
-    struct tm *localtime_internal_data;
-    struct tm *created_struct_tm;
-    char *formatted_time_string;
-
-    READ_TOKEN_TO_TMP(p->block->memory, tmp, p->tokens[p->currentToken]);
-
-    if (TOKEN_EQUALS(tmp, identifiers[i].name)) {
-        switch(identifiers[i].action) {
-        case TOKEN_CHECK_CALL:
-            (p->currentToken)++;
-            CALL_TOKEN_FUNC(identifiers[i].funcCallback, p, identifiers, args);
-            performedAction = 1;
-            break;
-
-        case TOKEN_SET_PARSE:
-            (p->currentToken)++;
-            if (identifiers[i].freeFlag) {
-                free(*((char**)identifiers[i].value));
-                free(*(identifiers[i].parseStrWide));
-                free(*(identifiers[i].parseStr));
-            }
+ * It calls the callback on a TOKEN_CHECK_CALL, else it checks for TOKEN_SET and
+ * sets the value with tokenSetValue.
+ */
+static void performIdentAction(TokenParser *p, TokenIdent *identifiers, int i, va_list args)
+{
+    switch(identifiers[i].action) {
+    case TOKEN_CHECK_CALL:
+        (p->currentToken)++;
+        CALL_TOKEN_FUNC(identifiers[i].funcCallback, p, identifiers, args);
+        break;
 
-            *((char**)identifiers[i].value) = getCopyOfToken(p->block->memory, p->tokens[p->currentToken]);
+    case TOKEN_SET:
+        (p->currentToken)++;
+        tokenSetValue(p, identifiers[i].type, identifiers[i].value, identifiers[i].bitMask,
+                      identifiers[i].freeFlag, identifiers[i].listOwned);
+        break;
 
-            len = p->tokens[p->currentToken].end - p->tokens[p->currentToken].start;
+    case TOKEN_DESCEND:
+        break;
+    }
+}
 
-            *(identifiers[i].parseStr)     = redditParseEscCodes    (*((char**)identifiers[i].value), len);
-            *(identifiers[i].parseStrWide) = redditParseEscCodesWide(*((char**)identifiers[i].value), len);
+/*
+ * The same as performIdentAction, but for a TokenField of a schema, with the
+ * member found at it's offset into 'object'
+ */
+static void performFieldAction(TokenParser *p, const TokenField *field, void *object, va_list args)
+{
+    switch(field->action) {
+    case TOKEN_CHECK_CALL:
+        (p->currentToken)++;
+        CALL_TOKEN_FUNC(field->funcCallback, p, NULL, args);
+        break;
 
-            break;
+    case TOKEN_SET:
+        (p->currentToken)++;
+        tokenSetValue(p, field->type, (char *)object + field->offset, field->bitMask,
+                      field->freeFlag, field->listOwned);
+        break;
+    }
+}
 
-        case TOKEN_SET:
-            (p->currentToken)++;
-            READ_TOKEN_TO_TMP(p->block->memory, tmp, p->tokens[p->currentToken]);
-            switch(identifiers[i].type) {
-            case TOKEN_BOOL:
-                if (TOKEN_IS_TRUE(p->block->memory, p->tokens[p->currentToken]))
-                    *((unsigned int *)identifiers[i].value) |= identifiers[i].bitMask;
-                else
-                    *((unsigned int *)identifiers[i].value) &= ~identifiers[i].bitMask;
+/*
+ * vparseTokens has to find which TokenIdent (if any) goes with every key in
+ * an object. Instead of comparing each key against every name, the names are
+ * put into a small hash table when vparseTokens starts, and keys are hashed
+ * and compared straight out of the JSON text. (A TokenSchema does this once,
+ * at compile-time, see tokenSchemaFind).
+ *
+ * Each slot holds the index of a TokenIdent plus one, with zero meaning the
+ * slot is empty. An array with too many idents to fit is just searched in
+ * order instead.
+ */
+#define TOKEN_IDENT_TABLE_SIZE 64
+#define TOKEN_IDENT_TABLE_SHIFT (32 - 6) /* Top bits of the hash pick the slot */
 
-                break;
-            case TOKEN_INT:
-                *((int*)(identifiers[i].value)) = atoi(tmp);
-                break;
-            case TOKEN_STRING:
-            case TOKEN_OBJECT:
-                if (identifiers[i].freeFlag)
-                    free(*((char**)identifiers[i].value));
+typedef struct TokenIdentTable {
+    int           identCount;
+    bool          useTable;
+    unsigned char slots[TOKEN_IDENT_TABLE_SIZE];
+    size_t        nameLen[TOKEN_IDENT_TABLE_SIZE / 2];
+} TokenIdentTable;
 
-                *((char**)identifiers[i].value) = getCopyOfToken(p->block->memory, p->tokens[p->currentToken]);
-                break;
-            case TOKEN_DATE:
-                // Process the tmp char* string as a date
-                created_time_t = atol(tmp);
-                created_struct_tm = (struct tm *)(rmalloc(sizeof(struct tm)));
-                formatted_time_string = (char *)(rmalloc(CREATE_DATE_FORMAT_BYTE_COUNT));
-                
-                // Convert created_time_t (seconds since epoch) to 
-                // the struct tm object of localtime_internal_data. After we get
-                // the value, copy the internal data (static data)to a newly created
-                // struct tm object.
-                localtime_internal_data = localtime(&created_time_t);
-                if (localtime_internal_data != NULL)
-                {
-                    memcpy(created_struct_tm, localtime_internal_data, sizeof(struct tm));
-
-                    // Use strftime to convert the struct tm to a formatted string. The
-                    // format for the string is specified by CREATE_DATE_FORMAT
-                    if (0 != strftime(formatted_time_string, CREATE_DATE_FORMAT_BYTE_COUNT, 
-                                CREATE_DATE_FORMAT, created_struct_tm))
-                    {
-                        *((char**)identifiers[i].value) = formatted_time_string;
-                    }
-                }
-
-                // Free only created_struct_tm, don't free formatted_time_string
-                // because that data is now pointed to by identifiers[i].value
-                free(created_struct_tm);
+/*
+ * Hash of 'len' bytes of 'key'. This has to give the same result as the
+ * TOKEN_KEY_HASH macro in token.h.
+ */
+static unsigned int tokenKeyHash(const char *key, size_t len)
+{
+    unsigned int hash = (unsigned int)len * TOKEN_KEY_HASH_K(TOKEN_KEY_HASH_PREFIX);
+    size_t i;
+
+    for (i = 0; i < len && i < TOKEN_KEY_HASH_PREFIX; i++)
+        hash += (unsigned int)(unsigned char)key[i] * TOKEN_KEY_HASH_K(i);
+
+    return hash;
+}
+
+static void tokenIdentTableBuild(TokenIdentTable *table, TokenIdent *identifiers, int identCount)
+{
+    unsigned int slot;
+    int i;
+
+    table->identCount = identCount;
+    table->useTable = (identCount <= TOKEN_IDENT_TABLE_SIZE / 2);
+    if (!table->useTable)
+        return ;
+
+    memset(table->slots, 0, sizeof(table->slots));
+
+    for (i = 0; i < identCount; i++) {
+        table->nameLen[i] = strlen(identifiers[i].name);
+
+        slot = tokenKeyHash(identifiers[i].name, table->nameLen[i]) >> TOKEN_IDENT_TABLE_SHIFT;
+        for (; table->slots[slot] != 0; slot = (slot + 1) & (TOKEN_IDENT_TABLE_SIZE - 1))
+            /* If a name is in the array twice, the first one wins */
+            if (strcmp(identifiers[table->slots[slot] - 1].name, identifiers[i].name) == 0)
                 break;
-            }
-            performedAction = 1;
 
-            break;
-        }
+        if (table->slots[slot] == 0)
+            table->slots[slot] = i + 1;
     }
+}
 
-    free(tmp);
-    return performedAction;
+/*
+ * Returns the index of the TokenIdent who's name matches the key 'token', or
+ * -1 if there isn't one.
+ */
+static int tokenIdentTableFind(TokenIdentTable *table, TokenIdent *identifiers, const char *json, jsmntok_t *token)
+{
+    const char *key = json + token->start;
+    size_t len = token->end - token->start;
+    unsigned int slot;
+    int i;
+
+    if (!table->useTable) {
+        for (i = 0; i < table->identCount; i++)
+            if (strncmp(identifiers[i].name, key, len) == 0 && identifiers[i].name[len] == 0)
+                return i;
+
+        return -1;
+    }
+
+    slot = tokenKeyHash(key, len) >> TOKEN_IDENT_TABLE_SHIFT;
+    for (; table->slots[slot] != 0; slot = (slot + 1) & (TOKEN_IDENT_TABLE_SIZE - 1)) {
+        i = table->slots[slot] - 1;
+        if (table->nameLen[i] == len && memcmp(identifiers[i].name, key, len) == 0)
+            return i;
+    }
+
+    return -1;
 }
 
 /*
@@ -282,11 +782,17 @@ int performIdentAction(TokenParser *p, TokenIdent *identifiers, int i, va_list a
  * the start of an object, and will return if this is not the case
  *
  * The intention is that the 'p->currentToken' count will be incremented to the object
- * you want to parse when calling this, and the parser will loop over every token inside
+ * you want to parse when calling this, and the parser will loop over the tokens inside
  * of that object.
+ *
+ * When a key doesn't match any of the identifiers, it's whole value is jumped
+ * over using it's full_size, so things like media embeds and award lists
+ * Reddit sends along never get looked at. Values of matched keys, along with
+ * keys marked TOKEN_DESCEND, are still looked inside of.
  */
 void vparseTokens (TokenParser *p, TokenIdent *identifiers, va_list args)
 {
+    TokenIdentTable table;
     int tokenCount = 0, i;
     int identCount = 0;
 
@@ -302,20 +808,25 @@ void vparseTokens (TokenParser *p, TokenIdent *identifiers, va_list args)
 
     tokenCount += p->currentToken;
 
+    tokenIdentTableBuild(&table, identifiers, identCount);
+
     for (; p->currentToken < tokenCount; (p->currentToken)++) {
-        if (p->tokens[p->currentToken].type == JSMN_OBJECT || p->tokens[p->currentToken].type == JSMN_ARRAY)
-            continue;
+        p->tokensVisited++;
 
-        /* We only need to check key values */
+        /* We only need to check key values (Objects and arrays are never
+         * keys) */
         if (!p->tokens[p->currentToken].is_key)
             continue;
 
-        for (i = 0; i < identCount; i++)
-            if (performIdentAction(p, identifiers, i, args)) {
-                (p->currentToken)--;
-                break;
-            }
-
+        i = tokenIdentTableFind(&table, identifiers, p->block->memory, p->tokens + p->currentToken);
+        if (i == -1) {
+            /* Jump to the last token of the value, the loop moves past it */
+            if (p->currentToken + 1 < tokenCount)
+                p->currentToken += p->tokens[p->currentToken + 1].full_size + 1;
+        } else if (identifiers[i].action != TOKEN_DESCEND) {
+            performIdentAction(p, identifiers, i, args);
+            (p->currentToken)--;
+        }
     }
 
     return ;
@@ -335,229 +846,243 @@ void parseTokens (TokenParser *parser, TokenIdent *identifiers, ...)
 }
 
 /*
- * This function controls the actual parsing, by calling curl to get the JSON,
- * creating the jsmn tokens, and then calling the parser.
- *
- * 'url' is the url of the JSON you want. Ex. www.reddit.com/.json
- * 'post' is any text that should be sent in a POST request. If you want to
- *        do a GET, set this to NULL.
- * 'idents' is the list of token identifiers to use when running the parser
- * 'args' is any extra arguments to be passed on to the parser. (Normally used
- *        by callbacks)
+ * Returns the field of 'schema' who's name matches the key 'token', or NULL
+ * if there isn't one. The filter rules out most keys in one go, the rest are
+ * found by comparing the hash and length of every field before the name.
  */
-TokenParserResult redditvRunParser(char *url, char *post, TokenIdent *idents, va_list args)
+static const TokenField *tokenSchemaFind(const TokenSchema *schema, const char *json, jsmntok_t *token)
 {
-    /* Initalize various pieces that are needed to get and parse the JSON */
-    TokenParser *parser = tokenParserNew();
-    char *cookieStr = NULL;
-    CURL *redditHandle = curl_easy_init();
-    jsmnerr_t jsmnResult;
-    char fullUseragent[1024];
-
-    DEBUG_PRINT(L"Grabbing %s\n", url);
-    if (post)
-        DEBUG_PRINT(L"Post: %s\n", post);
-
-    /* Set default response */
-    TokenParserResult result = TOKEN_PARSER_SUCCESS;
-
-    /* Sets up curl to get 'url' and use writeToParser as the callback writer */
-    curl_easy_setopt(redditHandle, CURLOPT_URL, url);
-    curl_easy_setopt(redditHandle, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(redditHandle, CURLOPT_WRITEFUNCTION, writeToParser);
-    curl_easy_setopt(redditHandle, CURLOPT_WRITEDATA, (void *)parser);
-
-    /* This gets and sets any cookies, if any are currently in the global state */
-    cookieStr = redditGetCookieString();
-    if (cookieStr != NULL)
-        curl_easy_setopt(redditHandle, CURLOPT_COOKIE, cookieStr);
-
-    /* If we're doing a POST, then this sets curl to use POST and tells it what
-     * text to use */
-    if (post != NULL) {
-        curl_easy_setopt(redditHandle, CURLOPT_POST, 1);
-        curl_easy_setopt(redditHandle, CURLOPT_POSTFIELDS, (void *)post);
-    }
-
-    /* Set the user agent, A combo of libreddit's useragent and the program
-     * using libreddit's useragent */
-    strcpy(fullUseragent, LIBREDDIT_USERAGENT);
-    strcat(fullUseragent, currentRedditState->userAgent);
-    curl_easy_setopt(redditHandle, CURLOPT_USERAGENT, fullUseragent);
-
-    /* Run curl, which will run the callback and store our text in the parser
-     * then cleanup */
-    curl_easy_perform(redditHandle);
-    curl_easy_cleanup(redditHandle);
-
-    /* If we didn't get any memory back for whatever reason, set our
-     * result to an error and jump to cleanup code. */
-    if (parser->block->size <= 0 || parser->block->memory == NULL) {
-        result = TOKEN_PARSER_CURL_FAIL;
-        goto cleanup;
-    }
+    const char *key = json + token->start;
+    size_t len = token->end - token->start;
+    unsigned int hash = tokenKeyHash(key, len);
+    int i;
 
-    /* Create our tokens */
-    jsmnResult = tokenParserCreateTokens(parser);
+    if (!(schema->filter & TOKEN_KEY_FILTER_BIT(hash)))
+        return NULL;
 
-    if (jsmnResult != JSMN_SUCCESS) {
-        result = TOKEN_PARSER_JSON_FAIL;
-        goto cleanup;
-    }
+    for (i = 0; i < schema->fieldCount; i++)
+        if (schema->fields[i].hash == hash && schema->fields[i].nameLen == len
+         && memcmp(schema->fields[i].name, key, len) == 0)
+            return schema->fields + i;
 
-    /* Run the parser over our tokens using the idents */
-    vparseTokens(parser, idents, args);
+    return NULL;
+}
 
-    /* We're done, set the response and then goto cleanup code */
-    result = TOKEN_PARSER_SUCCESS;
+/*
+ * The same as vparseTokens, but the object is parsed into the members of
+ * 'object' with a TokenSchema, instead of with an array of TokenIdent's.
+ */
+void vparseTokensSchema (TokenParser *p, const TokenSchema *schema, void *object, va_list args)
+{
+    const TokenField *field;
+    int tokenCount;
 
+    tokenCount = p->tokens[p->currentToken].full_size;
+    if (tokenCount == 0)
+        return ;
 
+    tokenCount += p->currentToken;
 
-    /* Simply frees any allocated memory used in the function */
-cleanup:;
+    for (; p->currentToken < tokenCount; (p->currentToken)++) {
+        p->tokensVisited++;
 
-    free(cookieStr);
-    tokenParserFree(parser);
+        if (!p->tokens[p->currentToken].is_key)
+            continue;
 
-    return result;
+        field = tokenSchemaFind(schema, p->block->memory, p->tokens + p->currentToken);
+        if (field == NULL) {
+            if (p->currentToken + 1 < tokenCount)
+                p->currentToken += p->tokens[p->currentToken + 1].full_size + 1;
+        } else {
+            performFieldAction(p, field, object, args);
+            (p->currentToken)--;
+        }
+    }
 }
 
-/*
- * This his a varidic wrapper around redditvRunParser. It takes a variable
- * number of arguments and creates a va_list out of them to call
- * redditvRunParser with.
- */
-TokenParserResult redditRunParser(char *url, char *post, TokenIdent *idents, ...)
+void parseTokensSchema (TokenParser *parser, const TokenSchema *schema, void *object, ...)
 {
-    TokenParserResult result;
     va_list args;
-    va_start(args, idents);
-    result = redditvRunParser(url, post, idents, args);
+    va_start(args, object);
+    vparseTokensSchema(parser, schema, object, args);
     va_end(args);
-    return result;
+}
+
+int tokenFindThings (TokenParser *parser, TokenThing *things)
+{
+    jsmntok_t *tokens = parser->tokens;
+    int array = parser->currentToken;
+    int count = tokens[array].size, i, key, end;
+
+    /* Every 'thing' starts right after the last token of the one before it */
+    key = array + 1;
+    for (i = 0; i < count; i++) {
+        things[i].kind = -1;
+        things[i].data = -1;
+
+        end = key + tokens[key].full_size;
+        if (tokens[key].type == JSMN_OBJECT) {
+            for (key++; key < end; key += tokens[key + 1].full_size + 2) {
+                if (tokenEquals(parser, key, "kind"))
+                    things[i].kind = key + 1;
+                else if (tokenEquals(parser, key, "data"))
+                    things[i].data = key + 1;
+            }
+        }
+        key = end + 1;
+    }
+
+    parser->currentToken = array + tokens[array].full_size;
+    return count;
+}
+
+bool tokenEquals (TokenParser *parser, int token, const char *text)
+{
+    size_t len = parser->tokens[token].end - parser->tokens[token].start;
+
+    return strlen(text) == len && memcmp(parser->block->memory + parser->tokens[token].start, text, len) == 0;
 }
 
 /*
- * This is a simple structure used by the EscCodeParser. It's simply here to
- * make passing the data around easy and faster then passing a ton of pointers
- * separately.
+ * What the threads of tokenParseObjects share. 'parsers' has a copy of the
+ * original parser for each thread.
  */
-struct charParser {
-    const char *text;
-    int cur;
-    int offset;
-    int wide;
-    void *new_text;
+struct TokenObjectJobs {
+    TokenParser       *parsers;
+    const int         *objects;
+    TokenObjectParser  parse;
+    void              *data;
+    void             **results;
 };
 
-/*
- * This function parses a single character in a piece of text and handles any
- * escaped characters.
- */
-static void parseChar (struct charParser *p)
-{
-    int k;
-    wchar_t temp;
-    switch(p->text[p->cur]) {
-    case '\\':
-        p->cur++;
-        switch(p->text[p->cur]) {
-        case 'n':
-            if (p->wide)
-                ((wchar_t*)(p->new_text))[p->offset] = L'\n';
-            else
-                ((char*)(p->new_text))[p->offset] = '\n';
-            p->offset++;
-            break;
-
-        case 'u':
-            if (p->wide) {
-                temp = L'\0';
-                for (k = 3; k >= 0; k--) {
-                    p->cur++;
-                    /* This weird piece of code converts a hex character (0-9 and a-f) into
-                     * it's decimal equivalent, and then shits it over the correct number of
-                     * bits corresponding to it's position in the wchar_t */
-                    temp |= (((p->text[p->cur] < 58)? p->text[p->cur] - 48: ((p->text[p->cur] & 0x0F) + 9))) << (k << 2);
-                }
-                ((wchar_t*)(p->new_text))[p->offset] = temp;
-                p->offset++;
-            } else {
-                p->cur+=4;
-            }
-            break;
-
-        case '\"':
-            if (p->wide)
-                ((wchar_t*)(p->new_text))[p->offset] = L'\"';
-            else
-                ((char*)(p->new_text))[p->offset] = '\"';
-            p->offset++;
-            break;
+static void tokenParseObjectJob (void *data, int index, int worker)
+{
+    struct TokenObjectJobs *jobs = data;
+    TokenParser *parser = jobs->parsers + worker;
 
-        }
-        break;
-    default:
-        if (p->wide)
-            ((wchar_t*)(p->new_text))[p->offset] = btowc(p->text[p->cur]);
-        else
-            ((char*)(p->new_text))[p->offset] = p->text[p->cur];
-        p->offset++;
-        break;
-    }
+    parser->currentToken = jobs->objects[index];
+    jobs->results[index] = jobs->parse(parser, jobs->data);
 }
 
 /*
- * This code implements a generic version of the 'redditParseEscCodes'
- * functions which works with both wchar_t and char strings. To use wchar_t set
- * 'wide' to 1, else set it to 0 for plain char strings.
+ * The fewest tokens worth giving a thread of it's own in tokenParseObjects.
+ * That's around 0.1 ms of parsing, and with less than that each thread spends
+ * more time waking up and making it's arena than it saves.
+ */
+#define TOKEN_PARSE_THREAD_TOKENS 16384
+
+/*
+ * How many of the 'threads' tokenParseObjects asked for are worth using on
+ * 'objects': No more than there are cores to run them on (Extra threads just
+ * take turns on the same ones), or objects to hand out, and one for every
+ * TOKEN_PARSE_THREAD_TOKENS tokens the objects cover.
  */
-static void *redditParseEscCodesGeneric (const void *text, int len, int wide)
+static int tokenParseThreadCount (TokenParser *parser, int count, const int *objects, int threads)
 {
-    struct charParser parser;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int last, tokens;
 
-    if (len == 0)
-        return NULL;
+    if (threads <= 1 || count <= 1)
+        return 1;
 
-    parser.wide = wide;
-    parser.text = text;
-    parser.cur = 0;
-    parser.offset = 0;
+    if (cores >= 1 && threads > cores)
+        threads = cores;
 
-    if (wide)
-        parser.new_text = rmalloc((len + 1) * sizeof(wchar_t));
-    else
-        parser.new_text = rmalloc((len + 1) * sizeof(char));
+    if (threads > count)
+        threads = count;
 
-    for (parser.cur = 0; parser.cur < len; parser.cur++)
-        parseChar(&parser);
+    last = objects[count - 1];
+    tokens = last + parser->tokens[last].full_size + 1 - objects[0];
+    if (threads > tokens / TOKEN_PARSE_THREAD_TOKENS)
+        threads = tokens / TOKEN_PARSE_THREAD_TOKENS;
 
-    if (wide)
-        ((wchar_t*)(parser.new_text))[parser.offset] = L'\0';
-    else
-        ((char*)(parser.new_text))[parser.offset] = '\0';
+    return threads;
+}
 
-    return parser.new_text;
+void tokenParseObjects (TokenParser *parser, int count, const int *objects, int threads,
+                        TokenObjectParser parse, void *data, void **results)
+{
+    struct TokenObjectJobs jobs;
+    RedditWorkerPool *pool;
+    int i, current = parser->currentToken;
+
+    threads = tokenParseThreadCount(parser, count, objects, threads);
+
+    if (threads <= 1 || currentRedditState == NULL) {
+        for (i = 0; i < count; i++) {
+            parser->currentToken = objects[i];
+            results[i] = parse(parser, data);
+        }
+        parser->currentToken = current;
+        return ;
+    }
+
+    pool = redditWorkerPoolGet(currentRedditState, threads);
+
+    jobs.parsers = rmalloc((pool->threadCount + 1) * sizeof(TokenParser));
+    jobs.objects = objects;
+    jobs.parse = parse;
+    jobs.data = data;
+    jobs.results = results;
+
+    /* The copies share the text and tokens, which are only read (Or written
+     * to in different places, for string views) */
+    for (i = 0; i <= pool->threadCount; i++) {
+        jobs.parsers[i] = *parser;
+        jobs.parsers[i].tokensVisited = 0;
+        if (parser->arena != NULL)
+            jobs.parsers[i].arena = redditArenaNewChild(parser->arena);
+    }
+
+    redditWorkerPoolRun(pool, count, tokenParseObjectJob, &jobs);
+
+    for (i = 0; i <= pool->threadCount; i++)
+        parser->tokensVisited += jobs.parsers[i].tokensVisited;
+
+    free(jobs.parsers);
 }
 
 /*
- * Takes a string of json and the token containing the string data, and
- * parses out any '\' escape characters, such as '\n' and '\u'. This version
- * returns a straight char* version, meaning unicode characters are discarded.
+ * This function controls the actual parsing, by calling curl to get the JSON,
+ * creating the jsmn tokens, and then calling the parser. It blocks until it's
+ * all done.
+ *
+ * 'url' is the url of the JSON you want. Ex. www.reddit.com/.json
+ * 'post' is any text that should be sent in a POST request. If you want to
+ *        do a GET, set this to NULL.
+ * 'idents' is the list of token identifiers to use when running the parser
+ * 'args' is any extra arguments to be passed on to the parser. (Normally used
+ *        by callbacks)
  */
-EXPORT_SYMBOL char *redditParseEscCodes (const char *text, int len)
+TokenParserResult redditvRunParser(char *url, char *post, TokenIdent *idents, va_list args)
 {
-    return redditParseEscCodesGeneric(text, len, 0);
+    RedditRequest *request = redditRequestNew(url, post);
+    TokenParserResult result;
+
+    /* Get and tokenize the JSON, then run the parser over our tokens using
+     * the idents */
+    result = redditRequestWait(request);
+    if (result == TOKEN_PARSER_SUCCESS)
+        vparseTokens(request->parser, idents, args);
+
+    redditRequestFree(request);
+
+    return result;
 }
 
 /*
- * This is another version of the above redditParseEscCodes. The difference is
- * that this returns a whcar_t, so unicode characters are encoded correctly
+ * This his a varidic wrapper around redditvRunParser. It takes a variable
+ * number of arguments and creates a va_list out of them to call
+ * redditvRunParser with.
  */
-EXPORT_SYMBOL wchar_t *redditParseEscCodesWide (const char *text, int len)
+TokenParserResult redditRunParser(char *url, char *post, TokenIdent *idents, ...)
 {
-    return redditParseEscCodesGeneric(text, len, 1);
+    TokenParserResult result;
+    va_list args;
+    va_start(args, idents);
+    result = redditvRunParser(url, post, idents, args);
+    va_end(args);
+    return result;
 }
 
-
 #endif
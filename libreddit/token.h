@@ -4,29 +4,73 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
 
 #include "reddit.h"
 #include "jsmn.h"
 
 
 /*
- * Structure representing a block of memory and it's current size
+ * Structure representing a block of memory and it's current size. 'alloc' is
+ * how much is actually allocated.
+ *
+ * Responses kept around by a list (See 'zeroCopy' in RedditLinkList) are
+ * chained together through 'next'.
+ *
+ * If 'mapped' is set, 'memory' is a private mapping of a file 'alloc' bytes
+ * long (See memoryBlockMapFile) instead of coming from rmalloc. Writing to it
+ * doesn't change the file.
  */
 typedef struct MemoryBlock {
     char   *memory;
     size_t  size;
+    size_t  alloc;
+    bool    mapped;
+
+    struct MemoryBlock *next;
 } MemoryBlock;
 
 /*
  * Represents the state of a parser for parsing Reddit JSON. It holds a block
  * of memory with the JSON text, the jsmn parsed tokens, the number of tokens,
  * and the current token that is being parsed.
+ *
+ * 'tokensVisited' counts how many tokens vparseTokens has looked at, which
+ * shows how much of the JSON parsing is actually skipping over.
+ *
+ * If 'stringViews' is set, strings for idents marked 'listOwned' aren't
+ * copied. They're nul-terminated in place and pointed to right inside of the
+ * JSON text, so whoever is parsing has to keep the MemoryBlock around (See
+ * tokenParserTakeBlock).
+ *
+ * If 'arena' is set, the strings for those idents that do get copied come out
+ * of it instead of being allocated one at a time (See 'useArena' in
+ * RedditLinkList), along with the links and comments themselves.
+ *
+ * The JSON can be tokenized a piece at a time while it's still being
+ * downloaded. 'jsmnParser' keeps jsmn's place in the text between calls to
+ * tokenParserFeed, and 'jsmnResult' is what jsmn returned last time.
+ * 'tokenAlloc' is the number of tokens allocated in 'tokens'.
+ *
+ * If 'indexed' is set, the text is tokenized with jsmn_parse_indexed instead
+ * of jsmn_parse. It's only turned on by default if libreddit is built with
+ * REDDIT_JSMN_INDEXED, since it turns down a few kinds of broken JSON that
+ * jsmn_parse lets through (See jsmn.h).
  */
 typedef struct TokenParser {
     MemoryBlock *block;
     jsmntok_t *tokens;
     int       tokenCount;
+    int       tokenAlloc;
     int       currentToken;
+    int       tokensVisited;
+    bool      stringViews;
+    bool      indexed;
+
+    struct RedditArena *arena;
+
+    jsmn_parser jsmnParser;
+    jsmnerr_t   jsmnResult;
 } TokenParser;
 
 /*
@@ -60,7 +104,8 @@ typedef struct TokenIdent {
         TOKEN_INT = 1, /* Same as Bool, 'int', however can be any value */
         TOKEN_STRING = 2, /* Should be of type 'char*' */
         TOKEN_OBJECT = 3, /* For now, acts same as TOKEN_STRING */
-        TOKEN_DATE = 4 /* Parse this id as a date object */
+        TOKEN_DATE = 4, /* Should be of type 'time_t', the seconds since the epoch */
+        TOKEN_INT64 = 5 /* Same as Int, but 'long long' for counts that don't fit in an 'int' */
     } type;
 
     enum {
@@ -68,23 +113,21 @@ typedef struct TokenIdent {
          * based on the 'type' to the value of the token after 'name' */
         TOKEN_SET = 0,
 
-        /* If we have this, then the parser will run the EscCode parser on the string 'value'
-         * and store the contents in 'strParse' and 'strParseWide' */
-        TOKEN_SET_PARSE,
-
         /* If 'name' is found as a key, then 'funcCallback' will be called
          * and 'value' will be completely ignored. */
-        TOKEN_CHECK_CALL
+        TOKEN_CHECK_CALL,
+
+        /* The value of a key that isn't in the idents is skipped over whole.
+         * A key with this action is just looked inside of instead, so any of
+         * the other idents can be found in it. Ex. The 'children' array of a
+         * Listing. */
+        TOKEN_DESCEND
     } action;
 
 
     /* A pointer to one of the token type's to store the token's data -- See enum type */
     void *value;
 
-    /* Some extra pointers if we have a Parsed string */
-    char **parseStr;
-    wchar_t **parseStrWide;
-
     /* If using 'TOKEN_BOOL', then if the token is 'true', *value will be cast as an
      * unsigned int, and |= with bitMask. If 'false', it will be &= ~bitMask */
     unsigned int bitMask;
@@ -94,6 +137,13 @@ typedef struct TokenIdent {
      * before it is overwritten to avoid a memory leak */
     bool freeFlag;
 
+    /* Set for members of a link or comment, who's strings belong to the list.
+     * If the parser has 'stringViews' turned on, then 'value' is pointed into
+     * the JSON text instead of being set to a copy (And it isn't freed first
+     * either). If the parser has an 'arena', the string is allocated out of it
+     * and nothing is freed first. */
+    bool listOwned;
+
     /* A function to call when this token is found
      *
      * Parameters from left to right:
@@ -108,19 +158,105 @@ typedef struct TokenIdent {
 
 } TokenIdent;
 
+/*
+ * A TokenSchema describes how to parse one kind of object, Ex. a RedditLink,
+ * the same way an array of TokenIdent's does. The difference is that each
+ * TokenField holds the offset of a member instead of a pointer to it, so the
+ * whole table is a 'static const' that's only built once by the compiler,
+ * instead of on the stack every time an object is parsed.
+ *
+ * The hash and length of every key are worked out at compile-time too (See
+ * TOKEN_KEY_HASH), and 'filter' has a bit set for the hash of each of them.
+ * Most keys Reddit sends aren't in the schema, and the filter throws out the
+ * majority of those without looking at the fields at all.
+ *
+ * Schemas are declared with TOKEN_SCHEMA, see the bottom of this file.
+ */
+typedef struct TokenField {
+    unsigned int hash;
+    unsigned int nameLen;
+    const char  *name;
+
+    /* Same as 'type' and 'action' in TokenIdent. TOKEN_DESCEND isn't
+     * supported */
+    int type;
+    int action;
+
+    /* Where the member is in the object, See 'value' in TokenIdent */
+    size_t       offset;
+    unsigned int bitMask;
+    bool         freeFlag;
+    bool         listOwned;
+
+    /* Called with NULL for 'idents', since there isn't an array of them */
+    void (*funcCallback) (TokenParser       *parser,
+                          struct TokenIdent *idents,
+                          va_list            args
+                          );
+} TokenField;
+
+typedef struct TokenSchema {
+    const TokenField   *fields;
+    int                 fieldCount;
+    unsigned long long  filter;
+} TokenSchema;
+
 /*
  * Functions for handling allocations of a TokenParser
  */
 TokenParser *tokenParserNew();
 void         tokenParserFree(TokenParser *parser);
 
+/*
+ * Returns a new parser for the JSON already in 'block', which the parser takes
+ * over, with all of it tokenized. 'jsmnResult' is JSMN_SUCCESS if the JSON
+ * was valid.
+ */
+TokenParser *tokenParserNewFromBlock(MemoryBlock *block);
+
+/*
+ * Get a parser for a new request, reusing the token array of one that was
+ * given back to 'state' earlier if there is one, and give it back when done.
+ */
+TokenParser *tokenParserGet     (RedditState *state);
+void         tokenParserRelease (RedditState *state, TokenParser *parser);
+
+/*
+ * Takes the MemoryBlock holding the JSON text away from a parser, giving it a
+ * new empty one. Used to keep the text around after the parser is gone.
+ */
+MemoryBlock *tokenParserTakeBlock (TokenParser *parser);
+
 /*
  * Some basic functions for creating MemoryBlocks
  */
 MemoryBlock *memoryBlockNew();
 void memoryBlockFree(MemoryBlock *block);
+void memoryBlockFreeChain(MemoryBlock *block);
+void memoryBlockAppend(MemoryBlock *block, const char *text, size_t len);
+
+/*
+ * Returns a MemoryBlock holding the contents of the file at 'path', which is
+ * mapped into memory instead of being read in. Returns NULL if the file can't
+ * be opened or mapped.
+ */
+MemoryBlock *memoryBlockMapFile(const char *path);
+
+/*
+ * tokenParserFeed tokenizes any JSON added to the parser's MemoryBlock since
+ * it was last called, tokenParserCreateTokens tokenizes the whole block from
+ * the start.
+ */
+jsmnerr_t tokenParserFeed        (TokenParser *parser);
+jsmnerr_t tokenParserCreateTokens(TokenParser *parser);
 
 char *getCopyOfToken(const char *json, jsmntok_t token);
+
+/* Read the number in a token straight out of the JSON text, without copying
+ * it anywhere first. 'null' and other non-numbers read as 0 */
+long long tokenInt64 (const char *json, const jsmntok_t *token);
+double    tokenDouble(const char *json, const jsmntok_t *token);
+
 char *trueFalseString(char *string, bool tf);
 
 /* Functions to get the JSON from a url and run the parser over it */
@@ -132,6 +268,51 @@ TokenParserResult redditRunParser(char *url, char *post, TokenIdent *idents, ...
 void vparseTokens (TokenParser *parser, TokenIdent *identifiers, va_list args);
 void parseTokens  (TokenParser *parser, TokenIdent *identifiers, ...);
 
+/* Same as above, but parses the object into the members of 'object' using a
+ * TokenSchema. The extra arguments are passed on to any callbacks */
+void vparseTokensSchema (TokenParser *parser, const TokenSchema *schema, void *object, va_list args);
+void parseTokensSchema  (TokenParser *parser, const TokenSchema *schema, void *object, ...);
+
+/*
+ * Reddit sends lists of things (Links, comments, etc.) as an array of objects
+ * like '{"kind": "t3", "data": {...}}'. A TokenThing is the index of the
+ * 'kind' and 'data' tokens of one of those objects, or -1 if it didn't have
+ * one.
+ */
+typedef struct TokenThing {
+    int kind;
+    int data;
+} TokenThing;
+
+/*
+ * Fills 'things' with every object in the array at the parser's current token
+ * ('things' needs room for the array's 'size'), and returns how many there
+ * were. The current token is left on the last token of the array, the same as
+ * a callback that parsed it.
+ */
+int tokenFindThings (TokenParser *parser, TokenThing *things);
+
+/* Checks if the text of 'token' is exactly 'text' */
+bool tokenEquals (TokenParser *parser, int token, const char *text);
+
+/*
+ * Parses a number of objects (Ex. the 'data' objects of links) that don't
+ * depend on each other. 'parse' is called once for each token in 'objects',
+ * with the parser's current token set to it, and what it returns is stored in
+ * the same spot in 'results'. 'data' is passed along to it.
+ *
+ * If 'threads' is more than 1 the objects are spread over that many threads
+ * (Using the worker pool of the current RedditState), each parsing with a
+ * copy of 'parser' and allocating out of it's own child of 'parser->arena'.
+ * 'parse' can't change anything the objects share then. Fewer threads are
+ * used if there aren't enough cores or tokens to make them worth it, down to
+ * just parsing on the calling thread.
+ */
+typedef void *(*TokenObjectParser) (TokenParser *parser, void *data);
+
+void tokenParseObjects (TokenParser *parser, int count, const int *objects, int threads,
+                        TokenObjectParser parse, void *data, void **results);
+
 /*
  * Small #define macro to allocate space for a token and then read the data from
  * a token into the temporary string.
@@ -155,10 +336,9 @@ void parseTokens  (TokenParser *parser, TokenIdent *identifiers, ...);
         string = getCopyOfToken(json, token);      \
     } while (0)
 
-#define READ_TOKEN_AS_NUMBER(number, json, token, tmp)   \
+#define READ_TOKEN_AS_NUMBER(number, json, token)        \
     do {                                                 \
-        READ_TOKEN_TO_TMP(json, tmp, token);             \
-        number = atoi(tmp);                              \
+        number = tokenInt64(json, &(token));             \
     } while (0)
 
 #define READ_TOKEN_AS_BOOL(boolean, json, token)         \
@@ -193,6 +373,15 @@ void parseTokens  (TokenParser *parser, TokenIdent *identifiers, ...);
      .action = TOKEN_SET,                     \
      .value = &(member)}
 
+/*
+ * Same as ADD_TOKEN_IDENT_INT, but for 'long long' members
+ */
+#define ADD_TOKEN_IDENT_INT64(key_name, member) \
+    {.name = key_name,                          \
+     .type = TOKEN_INT64,                       \
+     .action = TOKEN_SET,                       \
+     .value = &(member)}
+
 /*
  * A specific token for getting the date from the 'created_utc' JSON API object
  */
@@ -214,14 +403,18 @@ void parseTokens  (TokenParser *parser, TokenIdent *identifiers, ...);
      .bitMask = mask}
 
 
-#define ADD_TOKEN_IDENT_STRPARSE(key_name, unparsed, parsed, wideparsed) \
-    {.name = key_name,                                                   \
-     .type = TOKEN_STRING,                                               \
-     .action = TOKEN_SET_PARSE,                                          \
-     .value = &(unparsed),                                               \
-     .parseStr = &(parsed),                                              \
-     .parseStrWide = &(wideparsed),                                      \
-     .freeFlag = 1}
+/*
+ * Same as ADD_TOKEN_IDENT_STRING, but the string can be a view into the JSON
+ * text or be allocated from the parser's arena. Only for members that are freed
+ * by checking for both first (Ex. REDDIT_LINK_STRING_VIEWS)
+ */
+#define ADD_TOKEN_IDENT_STRVIEW(key_name, member) \
+    {.name = key_name,                            \
+     .type = TOKEN_STRING,                        \
+     .action = TOKEN_SET,                         \
+     .value = &(member),                          \
+     .freeFlag = 1,                               \
+     .listOwned = 1}
 /*
  * Again, another similar macro. This time, it creates a callback instead
  */
@@ -231,5 +424,133 @@ void parseTokens  (TokenParser *parser, TokenIdent *identifiers, ...);
      .action = TOKEN_CHECK_CALL,             \
      .funcCallback = &(func)}
 
+/*
+ * Marks a key who's value should be searched for the other idents, instead of
+ * being skipped
+ */
+#define ADD_TOKEN_IDENT_DESCEND(key_name) \
+    {.name = key_name,                    \
+     .type = TOKEN_OBJECT,                \
+     .action = TOKEN_DESCEND}
+
+/*
+ * Hash of a key, for TokenSchema's. Only the first TOKEN_KEY_HASH_PREFIX
+ * characters are hashed, along with the length. Each character is multiplied
+ * by a different constant for it's position and added up, which makes the
+ * top bits (The ones that are used) a good mix of all of them.
+ *
+ * This works out to a constant for a string literal 'key', and tokenKeyHash
+ * in token.c gives the same result for keys in the JSON text.
+ */
+#define TOKEN_KEY_HASH_PREFIX 16
+#define TOKEN_KEY_HASH_K(i) ((((unsigned int)(i) * 0x85EBCA6Bu) ^ 0x9E3779B1u) | 1u)
+
+#define TOKEN_KEY_CHAR(key, i) \
+    ((i) < sizeof(key) - 1 ? (unsigned int)(unsigned char)(key)[(i) < sizeof(key) - 1 ? (i) : 0] : 0u)
+
+#define TOKEN_KEY_HASH(key)                                                    \
+    ((unsigned int)(sizeof(key) - 1) * TOKEN_KEY_HASH_K(TOKEN_KEY_HASH_PREFIX) \
+     + TOKEN_KEY_CHAR(key,  0) * TOKEN_KEY_HASH_K( 0)                       \
+     + TOKEN_KEY_CHAR(key,  1) * TOKEN_KEY_HASH_K( 1)                       \
+     + TOKEN_KEY_CHAR(key,  2) * TOKEN_KEY_HASH_K( 2)                       \
+     + TOKEN_KEY_CHAR(key,  3) * TOKEN_KEY_HASH_K( 3)                       \
+     + TOKEN_KEY_CHAR(key,  4) * TOKEN_KEY_HASH_K( 4)                       \
+     + TOKEN_KEY_CHAR(key,  5) * TOKEN_KEY_HASH_K( 5)                       \
+     + TOKEN_KEY_CHAR(key,  6) * TOKEN_KEY_HASH_K( 6)                       \
+     + TOKEN_KEY_CHAR(key,  7) * TOKEN_KEY_HASH_K( 7)                       \
+     + TOKEN_KEY_CHAR(key,  8) * TOKEN_KEY_HASH_K( 8)                       \
+     + TOKEN_KEY_CHAR(key,  9) * TOKEN_KEY_HASH_K( 9)                       \
+     + TOKEN_KEY_CHAR(key, 10) * TOKEN_KEY_HASH_K(10)                       \
+     + TOKEN_KEY_CHAR(key, 11) * TOKEN_KEY_HASH_K(11)                       \
+     + TOKEN_KEY_CHAR(key, 12) * TOKEN_KEY_HASH_K(12)                       \
+     + TOKEN_KEY_CHAR(key, 13) * TOKEN_KEY_HASH_K(13)                       \
+     + TOKEN_KEY_CHAR(key, 14) * TOKEN_KEY_HASH_K(14)                       \
+     + TOKEN_KEY_CHAR(key, 15) * TOKEN_KEY_HASH_K(15))
+
+/* The bit of a TokenSchema's 'filter' a hash uses */
+#define TOKEN_KEY_FILTER_BIT(hash) (1ULL << ((hash) >> 26))
+
+/*
+ * Entries of a TokenSchema, one for each of the ADD_TOKEN_IDENT_* macros
+ * above. 'object_type' is the type of the object, Ex. RedditLink.
+ */
+#define TOKEN_FIELD_KEY(key_name)      \
+     .hash = TOKEN_KEY_HASH(key_name), \
+     .nameLen = sizeof(key_name) - 1,  \
+     .name = key_name
+
+#define TOKEN_FIELD_STRING(object_type, key_name, member) \
+    {TOKEN_FIELD_KEY(key_name),                           \
+     .type = TOKEN_STRING,                                \
+     .action = TOKEN_SET,                                 \
+     .offset = offsetof(object_type, member),             \
+     .freeFlag = 1}
+
+#define TOKEN_FIELD_STRVIEW(object_type, key_name, member) \
+    {TOKEN_FIELD_KEY(key_name),                            \
+     .type = TOKEN_STRING,                                 \
+     .action = TOKEN_SET,                                  \
+     .offset = offsetof(object_type, member),              \
+     .freeFlag = 1,                                        \
+     .listOwned = 1}
+
+#define TOKEN_FIELD_INT(object_type, key_name, member) \
+    {TOKEN_FIELD_KEY(key_name),                        \
+     .type = TOKEN_INT,                                \
+     .action = TOKEN_SET,                              \
+     .offset = offsetof(object_type, member)}
+
+#define TOKEN_FIELD_INT64(object_type, key_name, member) \
+    {TOKEN_FIELD_KEY(key_name),                          \
+     .type = TOKEN_INT64,                                \
+     .action = TOKEN_SET,                                \
+     .offset = offsetof(object_type, member)}
+
+#define TOKEN_FIELD_DATE(object_type, key_name, member) \
+    {TOKEN_FIELD_KEY(key_name),                         \
+     .type = TOKEN_DATE,                                \
+     .action = TOKEN_SET,                               \
+     .offset = offsetof(object_type, member)}
+
+#define TOKEN_FIELD_BOOL(object_type, key_name, member, mask) \
+    {TOKEN_FIELD_KEY(key_name),                               \
+     .type = TOKEN_BOOL,                                      \
+     .action = TOKEN_SET,                                     \
+     .offset = offsetof(object_type, member),                 \
+     .bitMask = mask}
+
+#define TOKEN_FIELD_FUNC(object_type, key_name, func) \
+    {TOKEN_FIELD_KEY(key_name),                       \
+     .type = TOKEN_OBJECT,                            \
+     .action = TOKEN_CHECK_CALL,                      \
+     .funcCallback = &(func)}
+
+/* Used by TOKEN_SCHEMA to expand the list of fields */
+#define TOKEN_SCHEMA_ENTRY(object_type, kind, ...)            TOKEN_FIELD_##kind(object_type, __VA_ARGS__),
+#define TOKEN_SCHEMA_FILTER(object_type, kind, key_name, ...) TOKEN_KEY_FILTER_BIT(TOKEN_KEY_HASH(key_name)) |
+
+/*
+ * Declares a static TokenSchema called 'name' for objects of 'object_type'.
+ * 'field_list' is an X-macro taking the name of a macro and the type, which it
+ * calls once for each field as 'X(type, KIND, key, member...)'. 'KIND' is the
+ * end of one of the TOKEN_FIELD_* macros. Ex.
+ *
+ *   #define LINK_FIELDS(X, type)           \
+ *       X(type, STRVIEW, "title",   title) \
+ *       X(type, INT,     "score",   score) \
+ *       X(type, BOOL,    "is_self", flags, REDDIT_LINK_IS_SELF)
+ *
+ *   TOKEN_SCHEMA(linkSchema, RedditLink, LINK_FIELDS);
+ */
+#define TOKEN_SCHEMA(name, object_type, field_list)                   \
+    static const TokenField name##Fields[] = {                        \
+        field_list(TOKEN_SCHEMA_ENTRY, object_type)                   \
+    };                                                                \
+    static const TokenSchema name = {                                 \
+        .fields = name##Fields,                                       \
+        .fieldCount = sizeof(name##Fields) / sizeof(name##Fields[0]), \
+        .filter = field_list(TOKEN_SCHEMA_FILTER, object_type) 0      \
+    }
+
 
 #endif
@@ -76,8 +76,8 @@ RedditUser *redditGetUser(TokenParser *parser)
         ADD_TOKEN_IDENT_STRING("modhash",       user->modhash),
         ADD_TOKEN_IDENT_STRING("id",            user->id),
         ADD_TOKEN_IDENT_STRING("name",          user->name),
-        ADD_TOKEN_IDENT_INT   ("link_karma",    user->linkKarma),
-        ADD_TOKEN_IDENT_INT   ("comment_karma", user->commentKarma),
+        ADD_TOKEN_IDENT_INT64 ("link_karma",    user->linkKarma),
+        ADD_TOKEN_IDENT_INT64 ("comment_karma", user->commentKarma),
         ADD_TOKEN_IDENT_BOOL  ("has_mail",      user->flags, REDDIT_USER_HAS_MAIL),
         ADD_TOKEN_IDENT_BOOL  ("is_friend",     user->flags, REDDIT_USER_IS_FRIEND),
         ADD_TOKEN_IDENT_BOOL  ("has_mod_mail",  user->flags, REDDIT_USER_HAS_MOD_MAIL),
@@ -142,8 +142,10 @@ EXPORT_SYMBOL RedditErrno redditUserLoggedLogin (RedditUserLogged *log, char *na
     TokenParserResult res;
 
     TokenIdent ids[] = {
-        ADD_TOKEN_IDENT_FUNC("errors", handleErrorArray),
-        ADD_TOKEN_IDENT_FUNC("cookie", handleCookie),
+        ADD_TOKEN_IDENT_FUNC   ("errors", handleErrorArray),
+        ADD_TOKEN_IDENT_FUNC   ("cookie", handleCookie),
+        ADD_TOKEN_IDENT_DESCEND("json"),
+        ADD_TOKEN_IDENT_DESCEND("data"),
         {0}
     };
 
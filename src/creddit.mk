@@ -9,7 +9,7 @@ else
 endif
 
 ifdef STATIC
-    CREDDIT_LDFLAGS+=`curl-config --cflags` `curl-config --libs`
+    CREDDIT_LDFLAGS+=`curl-config --cflags` `curl-config --libs` -pthread -lm
 endif
 
 EXECUTABLE_NAME:=creddit
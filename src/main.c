@@ -42,10 +42,31 @@ typedef struct {
     unsigned int folded : 1;
     int foldCount;
     int indentCount;
+    int hiddenCount;
 } CommentLine;
 
+/*
+ * The comment screen gets the hidden replies of comments that are within
+ * COMMENT_PREFETCH_LINES lines of the screen in the background, with up to
+ * COMMENT_PREFETCH_REQUESTS requests running at once. While any are running
+ * it checks on them every COMMENT_PREFETCH_POLL milliseconds. Once one fails
+ * no more are started, the replies can still be gotten with 'm'.
+ */
+#define COMMENT_PREFETCH_LINES    20
+#define COMMENT_PREFETCH_REQUESTS 4
+#define COMMENT_PREFETCH_POLL     50
+
+struct CommentScreen;
+
 typedef struct {
+    struct CommentScreen *screen;
+    RedditComment *comment;
+    RedditRequest *request;
+} CommentPrefetch;
+
+typedef struct CommentScreen {
     RedditCommentList *list;
+    RedditCommentTree *tree;
     int lineCount;
     int allocLineCount;
     CommentLine **lines;
@@ -55,6 +76,9 @@ typedef struct {
     int width;
     int commentOpenSize;
     unsigned int commentOpen : 1;
+    int prefetchCount;
+    unsigned int prefetchFailed : 1;
+    CommentPrefetch prefetch[COMMENT_PREFETCH_REQUESTS];
 } CommentScreen;
 
 
@@ -83,6 +107,8 @@ wchar_t *linkScreenHelp[] = {
     L"- J -- Scroll down comment text of open comment",
     L"= PGUP -- Move up one comment at the same depth",
     L"- PGDN -- Move down one comment at the same depth",
+    L"- m -- Get the hidden replies of the selected comment",
+    L"- M -- Get every hidden reply in the thread",
     L"- q / h -- Close the open comment, or close the comment screen if no comment is open",
     L"",
     L"To report any bugs, submit patches, etc. Please see the github page at:",
@@ -162,11 +188,38 @@ void commentScreenFreeLines (CommentScreen *screen)
     screen->allocLineCount = 0;
 }
 
+/*
+ * Cancels the prefetch of 'comment', or every prefetch if it's NULL. The
+ * hidden replies they asked for are put back on their comments.
+ */
+void commentScreenPrefetchCancel(CommentScreen *screen, RedditComment *comment)
+{
+    int i;
+
+    for (i = 0; i < COMMENT_PREFETCH_REQUESTS; i++) {
+        if (screen->prefetch[i].request == NULL)
+            continue;
+
+        if (comment != NULL && screen->prefetch[i].comment != comment)
+            continue;
+
+        redditRequestCancel(screen->prefetch[i].request);
+        screen->prefetch[i].request = NULL;
+        screen->prefetchCount--;
+    }
+}
+
+/*
+ * The screen's prefetches are cancelled here, which puts their ids back on
+ * the comments in 'list', so it has to be freed before the list is.
+ */
 void commentScreenFree(CommentScreen *screen)
 {
     if (screen == NULL)
         return ;
+    commentScreenPrefetchCancel(screen, NULL);
     commentScreenFreeLines(screen);
+    redditCommentTreeFree(screen->tree);
 
     free(screen->lines);
     free(screen);
@@ -182,72 +235,258 @@ void commentScreenAddLine(CommentScreen *screen, CommentLine *line)
     screen->lines[screen->lineCount - 1] = line;
 }
 
-wchar_t *createCommentLine(RedditComment *comment, int width, int indent)
+wchar_t *createCommentLine(RedditCommentTree *tree, int index, int width)
 {
     wchar_t *text = malloc(sizeof(wchar_t) * (width+1));
-    int i, ilen = indent * 3, bodylen, texlen;
+    wchar_t *body = redditCommentBodyWide(tree->comments[index]);
+    char *author = tree->strings + tree->author[index];
+    int i, ilen = tree->depth[index] * 3, bodylen, texlen;
 
-    bodylen = wcslen(comment->wbodyEsc);
+    bodylen = wcslen(body);
     memset(text, 32, sizeof(wchar_t) * (width));
     text[width] = (wchar_t)0;
 
-    if (comment->directChildrenCount > 0)
-        swprintf(text + ilen, width + 1 - ilen, L"%s (%d hidden) > ", comment->author, comment->totalReplyCount);
+    if (tree->directChildrenCount[index] > 0)
+        swprintf(text + ilen, width + 1 - ilen, L"%s (%d hidden) > ", author, tree->totalReplyCount[index]);
     else
-        swprintf(text + ilen, width + 1 - ilen, L"%s > ", comment->author);
+        swprintf(text + ilen, width + 1 - ilen, L"%s > ", author);
 
     texlen = wcslen(text);
     for (i = 0; i <= width - texlen - 1; i++)
-        if (i <= bodylen - 1 && comment->wbodyEsc[i] != L'\n')
-            text[i + texlen] = comment->wbodyEsc[i];
+        if (i <= bodylen - 1 && body[i] != L'\n')
+            text[i + texlen] = body[i];
         else
             text[i + texlen] = (wchar_t)32;
 
     return text;
 }
 
-int getCommentScreenRecurse(CommentScreen *screen, RedditComment *comment, int width, int indent)
+CommentLine *commentScreenNewLine(CommentScreen *screen, int index)
 {
-    int i;
-    RedditComment *current;
-    CommentLine *line;
-    int indentCur = indent + 1;
-    int nested = 0;
-    for (i = 0; i < comment->replyCount; i++) {
-        current = comment->replies[i];
-        line = commentLineNew();
-        line->text = createCommentLine(current, width, indentCur);
-        line->indentCount = indentCur;
-        line->comment = current;
-        commentScreenAddLine(screen, line);
-        if (current->replyCount) {
-            line->foldCount = getCommentScreenRecurse(screen, current, width, indentCur);
-            nested += line->foldCount;
-        }
-        nested++;
-    }
-    return nested;
+    CommentLine *line = commentLineNew();
+    line->text = createCommentLine(screen->tree, index, screen->width);
+    line->indentCount = screen->tree->depth[index];
+    line->foldCount = screen->tree->subtreeSize[index];
+    line->hiddenCount = (screen->tree->directChildrenCount[index] > 0) ? screen->tree->totalReplyCount[index] : -1;
+    line->comment = screen->tree->comments[index];
+    return line;
 }
 
+/*
+ * Flattens the comments into a RedditCommentTree, and makes one line for each
+ * of them. The tree is already in the order the lines go in, so this is just
+ * one pass over it.
+ */
 void commentScreenRenderLines (CommentScreen *screen)
 {
+    int i;
+
     if (screen->lines)
         commentScreenFreeLines(screen);
 
-    getCommentScreenRecurse(screen, screen->list->baseComment, screen->width, -1);
+    redditCommentTreeFree(screen->tree);
+    screen->tree = redditCommentTreeNew(screen->list);
+
+    for (i = 0; i < screen->tree->count; i++)
+        commentScreenAddLine(screen, commentScreenNewLine(screen, i));
 }
 
-CommentScreen *getCommentScreenFromCommentList(RedditCommentList *list, int width)
+/*
+ * Returns true if the text of 'line' is out of date with entry 'index' of the
+ * tree, because it's fold or hidden count changed
+ */
+int commentScreenLineStale(CommentScreen *screen, CommentLine *line, int index)
 {
-    CommentScreen *screen;
-    if (list == NULL)
-        return NULL;
+    RedditCommentTree *tree = screen->tree;
+    int hidden = (tree->directChildrenCount[index] > 0) ? tree->totalReplyCount[index] : -1;
 
-    screen = commentScreenNew();
+    return line->foldCount != tree->subtreeSize[index] || line->hiddenCount != hidden;
+}
 
-    getCommentScreenRecurse(screen, list->baseComment, width, -1);
+/*
+ * Adds lines for the comments that were added under the comment on line
+ * 'index' (-1 for the whole list) since the lines were made, without making
+ * the rest of them over again, See redditCommentTreeUpdate.
+ *
+ * The new comments can be anywhere under 'index', so the old lines under it
+ * are merged with the new ones from the back. The old lines are still in the
+ * same order, and only ever move down, so it's done in place. Old lines with
+ * new fold or hidden counts are made again, along with the lines of the
+ * comments above 'index'. If new lines go in above the selected comment, the
+ * selection and the screen are moved down with it, so nothing moves under
+ * the user.
+ */
+void commentScreenInsertLines(CommentScreen *screen, int index)
+{
+    RedditCommentTree *tree = screen->tree;
+    int selected = screen->selected, offset = screen->offset;
+    int end, added, old, i;
 
-    return screen;
+    if (index == -1)
+        end = screen->lineCount;
+    else
+        end = index + tree->subtreeSize[index] + 1;
+
+    added = redditCommentTreeUpdate(tree, screen->list, index);
+
+    if (screen->lineCount + added >= screen->allocLineCount) {
+        screen->allocLineCount = screen->lineCount + added + 100;
+        screen->lines = realloc(screen->lines, sizeof(CommentLine*) * screen->allocLineCount);
+    }
+
+    memmove(screen->lines + end + added, screen->lines + end, sizeof(CommentLine*) * (screen->lineCount - end));
+    screen->lineCount += added;
+
+    if (screen->selected >= end)
+        selected += added;
+    if (screen->offset >= end)
+        offset += added;
+
+    old = end - 1;
+    for (i = end + added - 1; i > index; i--) {
+        if (old > index && screen->lines[old]->comment == tree->comments[i]) {
+            if (old == screen->selected)
+                selected = i;
+            if (old == screen->offset)
+                offset = i;
+
+            screen->lines[i] = screen->lines[old--];
+            if (commentScreenLineStale(screen, screen->lines[i], i)) {
+                commentLineFree(screen->lines[i]);
+                screen->lines[i] = commentScreenNewLine(screen, i);
+            }
+        } else {
+            screen->lines[i] = commentScreenNewLine(screen, i);
+        }
+    }
+
+    for (i = index; i != -1; i = tree->parent[i]) {
+        commentLineFree(screen->lines[i]);
+        screen->lines[i] = commentScreenNewLine(screen, i);
+    }
+
+    screen->offset = offset;
+    screen->selected = selected;
+    if (screen->selected > screen->offset + screen->displayed)
+        screen->offset = screen->selected - screen->displayed;
+}
+
+/*
+ * Returns the line 'comment' is on, -1 if it's the 'baseComment' (Which the
+ * top-level comments are replies to), or -2 if it's not on the screen.
+ */
+int commentScreenFindLine(CommentScreen *screen, RedditComment *comment)
+{
+    int i;
+
+    if (comment == screen->list->baseComment)
+        return -1;
+
+    for (i = 0; i < screen->lineCount; i++)
+        if (screen->lines[i]->comment == comment)
+            return i;
+
+    return -2;
+}
+
+/*
+ * Called when the hidden replies of a comment come back. The replies are
+ * already in the list, so they just need lines.
+ */
+void commentScreenPrefetchDone(RedditCommentList *list, RedditErrno err, void *data)
+{
+    CommentPrefetch *prefetch = data;
+    CommentScreen *screen = prefetch->screen;
+    int index;
+
+    prefetch->request = NULL;
+    screen->prefetchCount--;
+
+    if (err != REDDIT_SUCCESS) {
+        screen->prefetchFailed = 1;
+        return ;
+    }
+
+    index = commentScreenFindLine(screen, prefetch->comment);
+    if (index != -2)
+        commentScreenInsertLines(screen, index);
+}
+
+/*
+ * Starts getting the hidden replies of 'comment' in the background, if
+ * there's room for another request.
+ *
+ * Only one request per comment is run at a time. A comment with a lot of
+ * hidden replies takes a few requests to get them all, and the later ones can
+ * be replies to the comments that come back in the earlier ones, so they have
+ * to come back in order.
+ */
+void commentScreenPrefetchComment(CommentScreen *screen, RedditComment *comment)
+{
+    CommentPrefetch *prefetch = NULL;
+    int i;
+
+    if (comment->directChildrenCount == 0)
+        return ;
+
+    for (i = 0; i < COMMENT_PREFETCH_REQUESTS; i++)
+        if (screen->prefetch[i].request != NULL && screen->prefetch[i].comment == comment)
+            return ;
+
+    for (i = 0; i < COMMENT_PREFETCH_REQUESTS && prefetch == NULL; i++)
+        if (screen->prefetch[i].request == NULL)
+            prefetch = screen->prefetch + i;
+
+    if (prefetch == NULL)
+        return ;
+
+    prefetch->screen = screen;
+    prefetch->comment = comment;
+    prefetch->request = redditGetCommentChildrenAsync(screen->list, comment, commentScreenPrefetchDone, prefetch);
+
+    if (prefetch->request != NULL)
+        screen->prefetchCount++;
+}
+
+/*
+ * Handles any prefetches that finished, and then starts getting the hidden
+ * replies of the comments closest to the screen: The ones on it first, then
+ * the ones below it (Along with the hidden top-level comments, once the end
+ * of the list is close), then the ones above it.
+ *
+ * The fetching all happens in the background, so wgetch is set to stop
+ * waiting for a key every COMMENT_PREFETCH_POLL milliseconds while there's
+ * requests running, to give them a chance to be checked on.
+ */
+void commentScreenPrefetch(CommentScreen *screen)
+{
+    int first = screen->offset - COMMENT_PREFETCH_LINES;
+    int last = screen->offset + screen->displayed + COMMENT_PREFETCH_LINES;
+    int i;
+
+    redditAsyncPerform();
+
+    if (screen->prefetchFailed) {
+        wtimeout(stdscr, (screen->prefetchCount > 0) ? COMMENT_PREFETCH_POLL : -1);
+        return ;
+    }
+
+    if (first < 0)
+        first = 0;
+
+    if (last >= screen->lineCount)
+        last = screen->lineCount - 1;
+
+    for (i = screen->offset; i <= last && screen->prefetchCount < COMMENT_PREFETCH_REQUESTS; i++)
+        commentScreenPrefetchComment(screen, screen->lines[i]->comment);
+
+    if (last == screen->lineCount - 1)
+        commentScreenPrefetchComment(screen, screen->list->baseComment);
+
+    for (i = screen->offset - 1; i >= first && screen->prefetchCount < COMMENT_PREFETCH_REQUESTS; i--)
+        commentScreenPrefetchComment(screen, screen->lines[i]->comment);
+
+    wtimeout(stdscr, (screen->prefetchCount > 0) ? COMMENT_PREFETCH_POLL : -1);
 }
 
 void commentScreenDown(CommentScreen *screen)
@@ -263,35 +502,37 @@ void commentScreenDown(CommentScreen *screen)
     }
 }
 
-void commentScreenLevelDown(CommentScreen *screen) 
+/*
+ * Moves to the next comment at the same level, which is right after all the
+ * replies of the selected one
+ */
+void commentScreenLevelDown(CommentScreen *screen)
 {
-    int newPosition = screen->selected;
-    int indentCount = screen->lines[screen->selected]->indentCount;
-    while (++newPosition < screen->lineCount) {
-        if (screen->lines[newPosition]->indentCount < indentCount)
-            return;
-        if (screen->lines[newPosition]->indentCount == indentCount) {
-            screen->offset += newPosition - screen->selected;
-            screen->selected = newPosition;
-            return;
-        }
+    int newPosition = screen->selected + screen->lines[screen->selected]->foldCount + 1;
+
+    if (newPosition < screen->lineCount && screen->lines[newPosition]->indentCount == screen->lines[screen->selected]->indentCount) {
+        screen->offset += newPosition - screen->selected;
+        screen->selected = newPosition;
     }
 }
 
+/*
+ * Moves to the previous comment at the same level, by going over the replies
+ * of the selected comment's parent from the first one until the one before it
+ */
 void commentScreenLevelUp(CommentScreen *screen)
 {
-    int newPosition = screen->selected;
-    int indentCount = screen->lines[screen->selected]->indentCount;
-    while (--newPosition >= 0) {
-        if (screen->lines[newPosition]->indentCount < indentCount)
-            return;
-        if (screen->lines[newPosition]->indentCount == indentCount) {
-            screen->offset += newPosition - screen->selected;
-            if (screen->offset < 0) screen->offset = 0;
-            screen->selected = newPosition;
-            return;
-        }
-    }
+    int newPosition = screen->tree->parent[screen->selected] + 1;
+
+    if (newPosition == screen->selected)
+        return ;
+
+    while (newPosition + screen->lines[newPosition]->foldCount + 1 < screen->selected)
+        newPosition += screen->lines[newPosition]->foldCount + 1;
+
+    screen->offset += newPosition - screen->selected;
+    if (screen->offset < 0) screen->offset = 0;
+    screen->selected = newPosition;
 }
 
 void commentScreenUp(CommentScreen *screen)
@@ -306,7 +547,7 @@ void commentScreenUp(CommentScreen *screen)
 void commentScreenCommentScrollDown(CommentScreen *screen)
 {
     RedditComment *current = screen->lines[screen->selected]->comment;
-    wchar_t *currentTextPointer = &(current->wbodyEsc[current->advance]);
+    wchar_t *currentTextPointer = &(redditCommentBodyWide(current)[current->advance]);
     
     wchar_t *foundNewLineString = wcschr(currentTextPointer, L'\n');
 
@@ -332,7 +573,7 @@ void commentScreenCommentScrollUp(CommentScreen *screen)
     if (current->advance == 0)
         return;
 
-    wchar_t *currentTextPointer = &(current->wbodyEsc[current->advance - 1]);
+    wchar_t *currentTextPointer = &(redditCommentBodyWide(current)[current->advance - 1]);
     const wchar_t *foundNewLineString = reverse_wcsnchr(currentTextPointer - 1, current->advance - 1, L'\n');
 
     unsigned int distanceToScroll = 0;
@@ -356,6 +597,7 @@ void commentScreenDisplay(CommentScreen *screen)
     int i, screenLines;
     wchar_t *tmpbuf;
     int bufSize, lastLine, bufLen;
+    char created[CREATE_DATE_FORMAT_BYTE_COUNT];
 
     if (screen == NULL)
         return ;
@@ -406,12 +648,13 @@ void commentScreenDisplay(CommentScreen *screen)
         if (screen->lineCount >= screen->selected) {
             current = screen->lines[screen->selected]->comment;
             if (current != NULL) {
-                swprintf(tmpbuf, bufLen, L"%s - %d Score - %s", current->author, current->ups, current->created_utc);
+                redditFormatDate(created, sizeof(created), current->created_utc);
+                swprintf(tmpbuf, bufLen, L"%s - %d Score - %s", current->author, current->ups, created);
                 mvaddwstr(lastLine + 1, 0, tmpbuf);
                 swprintf(tmpbuf, bufLen, L"-------");
                 mvaddwstr(lastLine + 2, 0, tmpbuf);
 
-                mvaddwstr(lastLine + 3, 0, &(current->wbodyEsc[current->advance] ));
+                mvaddwstr(lastLine + 3, 0, &(redditCommentBodyWide(current)[current->advance] ));
             }
         }
     }
@@ -457,12 +700,12 @@ void showThread(RedditLink *link)
 
     list = redditCommentListNew();
     list->permalink = redditCopyString(link->permalink);
+    list->useArena = 1;
 
     err = redditGetCommentList(list);
     if (err != REDDIT_SUCCESS || list->baseComment->replyCount == 0)
         goto cleanup;
 
-    /*screen = getCommentScreenFromCommentList(list, COLS); */
     screen = commentScreenNew();
 
     screen->offset = 0;
@@ -473,6 +716,7 @@ void showThread(RedditLink *link)
     screen->width = COLS;
 
     commentScreenRenderLines(screen);
+    commentScreenPrefetch(screen);
     commentScreenDisplay(screen);
     int c;
     while((c = wgetch(stdscr))) {
@@ -501,10 +745,21 @@ void showThread(RedditLink *link)
             case 'l': case '\n': case KEY_ENTER:
                 commentScreenToggleComment(screen);
                 break;
+            /* Prefetches that could come back in the middle of these are
+             * cancelled first, which puts their ids back: One for the same
+             * comment could come back out of order, and any handled during
+             * redditGetAllCommentChildren wouldn't have their replies
+             * expanded along with the rest */
             case 'm':
+                commentScreenPrefetchCancel(screen, screen->lines[screen->selected]->comment);
                 redditGetCommentChildren(screen->list, screen->lines[screen->selected]->comment);
                 commentScreenRenderLines(screen);
                 break;
+            case 'M':
+                commentScreenPrefetchCancel(screen, NULL);
+                redditGetAllCommentChildren(screen->list, 0);
+                commentScreenRenderLines(screen);
+                break;
 
             case 'q': case 'h':
                 if (screen->commentOpen) {
@@ -514,12 +769,14 @@ void showThread(RedditLink *link)
                 }
                 break;
         }
+        commentScreenPrefetch(screen);
         commentScreenDisplay(screen);
     }
 
 cleanup:;
-    redditCommentListFree(list);
+    wtimeout(stdscr, -1);
     commentScreenFree(screen);
+    redditCommentListFree(list);
     return ;
 }
 
@@ -549,12 +806,12 @@ void linkScreenRenderLine (LinkScreen *screen, int line, int width)
     swprintf(screen->screenLines[line], width + 1, L"%2d. [%4d] %20s - ", line + 1, screen->list->links[line]->score, screen->list->links[line]->author);
 
     offset = wcslen(screen->screenLines[line]);
-    title = wcslen(screen->list->links[line]->wtitleEsc);
+    title = wcslen(redditLinkTitleWide(screen->list->links[line]));
     for (tmp = 0; tmp <= width - offset; tmp++)
         if (tmp >= title)
             screen->screenLines[line][tmp + offset] = (wchar_t)32;
         else
-            screen->screenLines[line][tmp + offset] = screen->list->links[line]->wtitleEsc[tmp];
+            screen->screenLines[line][tmp + offset] = redditLinkTitleWide(screen->list->links[line])[tmp];
 
     screen->screenLines[line][width] = (wchar_t)0;
 }
@@ -575,6 +832,7 @@ void linkScreenRenderLinkText (LinkScreen *screen, wchar_t *tmpbuf, int bufLen,
 {
     RedditLink *current;
     int lastLine = screenLines - screen->offset;
+    char created[CREATE_DATE_FORMAT_BYTE_COUNT];
 
     linkScreenSetupSplit(screen, tmpbuf, bufLen, lastLine);
 
@@ -582,15 +840,16 @@ void linkScreenRenderLinkText (LinkScreen *screen, wchar_t *tmpbuf, int bufLen,
     if (screen->list->linkCount >= screen->selected) {
         current = screen->list->links[screen->selected];
         if (current != NULL) {
-            swprintf(tmpbuf, bufLen, L"%s - %d Score / %d Comments / %s \nTitle: ", current->author, current->score, current->numComments, current->created_utc);
+            redditFormatDate(created, sizeof(created), current->created_utc);
+            swprintf(tmpbuf, bufLen, L"%s - %d Score / %d Comments / %s \nTitle: ", current->author, current->score, current->numComments, created);
             mvaddwstr(lastLine + 1, 0, tmpbuf);
-            addwstr(current->wtitleEsc);
+            addwstr(redditLinkTitleWide(current));
             addch('\n');
             swprintf(tmpbuf, bufLen, L"-------\n");
             addwstr(tmpbuf);
 
             if (current->flags & REDDIT_LINK_IS_SELF)
-                addwstr(&(current->wselftextEsc[current->advance]));
+                addwstr(&(redditLinkSelftextWide(current)[current->advance]));
             else
                 addstr(current->url);
         }
@@ -695,10 +954,10 @@ void linkScreenTextScrollDown(LinkScreen *screen)
 {
     RedditLink *current = screen->list->links[screen->selected];
 
-    if (current->wselftextEsc == NULL)
+    if (redditLinkSelftextWide(current) == NULL)
         return;
 
-    wchar_t *currentTextPointer = &(current->wselftextEsc[current->advance]);
+    wchar_t *currentTextPointer = &(redditLinkSelftextWide(current)[current->advance]);
     wchar_t *foundNewLineString = wcschr(currentTextPointer, '\n');
     int screenWidth = COLS;
 
@@ -726,7 +985,7 @@ void linkScreenTextScrollUp(LinkScreen *screen)
     if (current->advance == 0)
         return;
 
-    wchar_t *currentTextPointer = &(current->wselftextEsc[current->advance - 1]);
+    wchar_t *currentTextPointer = &(redditLinkSelftextWide(current)[current->advance - 1]);
     const wchar_t *foundNewLineString = reverse_wcsnchr(currentTextPointer - 1, current->advance - 1, L'\n');
 
     unsigned int distanceToScroll = 0;